@@ -0,0 +1,195 @@
+// frame_output.h - turns a frontend's framebuffer into terminal output
+//
+// Single-header library: define FRAME_OUTPUT_IMPLEMENTATION in exactly one
+// translation unit before including it. That translation unit also needs the
+// implementations of sixel.h, kitty.h, halfblock.h, term_probe.h and frame_stats.h.
+//
+// The backend is picked once at startup, either on the command line or by
+// frame_output_init_auto from what the terminal reported (term_probe.h), and
+// every frame goes through frame_output_encode, which times the palette and
+// encode stages for whichever backend is active.
+//
+// Automatic setup prefers kitty graphics, then sixel, then half blocks. It
+// limits the sixel palette to the terminal's color registers and shrinks the
+// frame by a whole factor when it would not fit the window; kitty instead
+// gets the largest whole zoom that fits, applied by the terminal for free.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "frame_stats.h"
+#include "sixel.h"
+#include "kitty.h"
+#include "halfblock.h"
+#include "term_probe.h"
+
+typedef enum {
+    OUTPUT_AUTO = -1,   // decided by frame_output_init_auto
+    OUTPUT_SIXEL = 0,
+    OUTPUT_KITTY,       // kitty graphics, shared memory with in-band fallback
+    OUTPUT_KITTY_ZLIB,  // kitty graphics, always in-band
+    OUTPUT_HALFBLOCK,   // truecolor half block characters, for terminals without graphics
+    OUTPUT_BACKEND_COUNT
+} OutputBackend;
+
+#define OUTPUT_BACKEND_NAMES "auto, sixel, kitty, kitty-zlib, halfblock"
+#define OUTPUT_MAX_DOWNSCALE 8
+
+typedef struct {
+    OutputBackend backend;
+    int downscale;  // frames are shrunk by this factor before encoding
+    KittyEncoder kitty;
+    HalfBlockRenderer halfblock;
+    std::vector<unsigned char> scaled;
+} FrameOutput;
+
+// returns 0 for an unknown name
+int frame_output_parse_backend(const char* name, OutputBackend* backend);
+void frame_output_init(FrameOutput* o, OutputBackend backend);
+// picks backend, color registers and scale for 'width' x 'height' frames
+void frame_output_init_auto(FrameOutput* o, const TermCaps* caps, int width, int height);
+void frame_output_free(FrameOutput* o);
+std::string frame_output_encode(FrameOutput* o, FrameStats* stats, const unsigned char* img, int width, int height, int channels);
+
+#ifdef FRAME_OUTPUT_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+# include <windows.h>
+#endif
+
+static const char* const output_backend_names[OUTPUT_BACKEND_COUNT] = { "sixel", "kitty", "kitty-zlib", "halfblock" };
+
+int frame_output_parse_backend(const char* name, OutputBackend* backend) {
+    if (strcmp(name, "auto") == 0) {
+        *backend = OUTPUT_AUTO;
+        return 1;
+    }
+    for (int i = 0; i < OUTPUT_BACKEND_COUNT; i++) {
+        if (strcmp(name, output_backend_names[i]) == 0) {
+            *backend = (OutputBackend)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void frame_output_init(FrameOutput* o, OutputBackend backend) {
+    o->backend = backend == OUTPUT_AUTO ? OUTPUT_SIXEL : backend;
+    o->downscale = 1;
+    kitty_init(&o->kitty, backend == OUTPUT_KITTY_ZLIB ? KITTY_ZLIB : KITTY_SHM);
+    halfblock_init(&o->halfblock);
+#ifdef _WIN32
+    // the half block glyphs are written as UTF-8
+    if (backend == OUTPUT_HALFBLOCK) {
+        SetConsoleOutputCP(CP_UTF8);
+    }
+#endif
+}
+
+void frame_output_init_auto(FrameOutput* o, const TermCaps* caps, int width, int height) {
+    // a terminal that didn't answer gets sixel, which is what always worked here
+    OutputBackend backend = OUTPUT_SIXEL;
+    if (caps->answered || caps->from_cache) {
+        if (caps->kitty) {
+            // shared memory is only visible to a terminal on the same machine
+            backend = getenv("SSH_CONNECTION") != NULL ? OUTPUT_KITTY_ZLIB : OUTPUT_KITTY;
+        }
+        else if (!caps->sixel) {
+            backend = OUTPUT_HALFBLOCK;
+        }
+    }
+    frame_output_init(o, backend);
+
+    if (backend == OUTPUT_SIXEL && caps->color_registers > 0) {
+        set_palette_limit(caps->color_registers);
+    }
+
+    // room for the image in pixels, minus one text line for the status line
+    int room_width = 0, room_height = 0;
+    if (backend == OUTPUT_HALFBLOCK) {
+        room_width = caps->cols;
+        room_height = (caps->rows - 1) * 2;
+    }
+    else if (caps->window_width > 0 && caps->window_height > caps->cell_height) {
+        room_width = caps->window_width;
+        room_height = caps->window_height - caps->cell_height;
+    }
+    if (room_width <= 0 || room_height <= 0) {
+        return;
+    }
+
+    while (o->downscale < OUTPUT_MAX_DOWNSCALE &&
+           (width / o->downscale > room_width || height / o->downscale > room_height)) {
+        o->downscale++;
+    }
+
+    if ((backend == OUTPUT_KITTY || backend == OUTPUT_KITTY_ZLIB) && o->downscale == 1 &&
+        caps->cell_width > 0 && caps->cell_height > 0) {
+        int zoom = 1;
+        while ((zoom + 1) * width <= room_width && (zoom + 1) * height <= room_height) zoom++;
+        if (zoom > 1) {
+            o->kitty.display_cols = (zoom * width + caps->cell_width - 1) / caps->cell_width;
+            o->kitty.display_rows = (zoom * height + caps->cell_height - 1) / caps->cell_height;
+        }
+    }
+}
+
+// nearest neighbour, keeping the pixel format
+static const unsigned char* frame_output_shrink(FrameOutput* o, const unsigned char* img, int* width, int* height, int channels) {
+    const int d = o->downscale;
+    const int w = *width / d, h = *height / d;
+    o->scaled.resize((size_t)w * h * channels);
+    for (int y = 0; y < h; y++) {
+        const unsigned char* src = img + (size_t)y * d * *width * channels;
+        unsigned char* dst = &o->scaled[(size_t)y * w * channels];
+        for (int x = 0; x < w; x++) {
+            memcpy(dst + x * channels, src + (size_t)x * d * channels, channels);
+        }
+    }
+    *width = w;
+    *height = h;
+    return o->scaled.data();
+}
+
+void frame_output_free(FrameOutput* o) {
+    kitty_free(&o->kitty);
+}
+
+std::string frame_output_encode(FrameOutput* o, FrameStats* stats, const unsigned char* img, int width, int height, int channels) {
+    if (o->downscale > 1) {
+        img = frame_output_shrink(o, img, &width, &height, channels);
+    }
+
+    std::string result;
+    switch (o->backend) {
+    case OUTPUT_SIXEL:
+        FRAME_STATS_BEGIN(stats, STAGE_PALETTE);
+        generate_palette(img, width, height, channels);
+        FRAME_STATS_END(stats, STAGE_PALETTE);
+
+        FRAME_STATS_BEGIN(stats, STAGE_ENCODE);
+        result = encode_sixel(img, width, height, channels);
+        FRAME_STATS_END(stats, STAGE_ENCODE);
+        break;
+    case OUTPUT_KITTY:
+    case OUTPUT_KITTY_ZLIB:
+        FRAME_STATS_BEGIN(stats, STAGE_ENCODE);
+        result = encode_kitty(&o->kitty, img, width, height, channels);
+        FRAME_STATS_END(stats, STAGE_ENCODE);
+        break;
+    case OUTPUT_HALFBLOCK:
+        FRAME_STATS_BEGIN(stats, STAGE_ENCODE);
+        result = encode_halfblock(&o->halfblock, img, width, height, channels);
+        FRAME_STATS_END(stats, STAGE_ENCODE);
+        break;
+    default:
+        break;
+    }
+    return result;
+}
+
+#endif // FRAME_OUTPUT_IMPLEMENTATION
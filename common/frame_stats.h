@@ -0,0 +1,221 @@
+// frame_stats.h - per-stage frame timing for the sixel frontends
+//
+// Single-header library: define FRAME_STATS_IMPLEMENTATION in exactly one
+// translation unit before including it.
+//
+// Every frame is split into stages (input, emulate, palette, encode, write).
+// Each stage is timed with the monotonic clock and accumulated into a
+// log-linear histogram (16 sub-buckets per power of two, ~6% resolution), so
+// p50/p99 can be reported at any time without storing per-frame samples.
+// Bytes written per frame go into a histogram of the same shape.
+//
+// Set ENABLE_FRAME_STATS to 0 before including to compile every FRAME_STATS_*
+// macro down to nothing. Compiled in, they still only read the clock for stats
+// initialized as enabled, which frontends do when the stats are shown or saved.
+
+#pragma once
+
+#ifndef ENABLE_FRAME_STATS
+# define ENABLE_FRAME_STATS 1
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+enum FrameStage {
+    STAGE_INPUT = 0,
+    STAGE_EMULATE,
+    STAGE_PALETTE,
+    STAGE_ENCODE,
+    STAGE_WRITE,
+    STAGE_COUNT
+};
+
+#define FRAME_STATS_SUB_BITS 4
+#define FRAME_STATS_BUCKETS  ((64 - FRAME_STATS_SUB_BITS + 1) << FRAME_STATS_SUB_BITS)
+
+typedef struct {
+    uint64_t counts[FRAME_STATS_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t max;
+} FrameHistogram;
+
+typedef struct {
+    const char* stage_names[STAGE_COUNT];
+    FrameHistogram stages[STAGE_COUNT];
+    FrameHistogram bytes;
+    FrameHistogram frame;
+    int64_t stage_start[STAGE_COUNT];
+    int64_t frame_start;
+    uint64_t frames;
+    bool enabled;
+} FrameStats;
+
+int64_t frame_stats_now_ns();
+void frame_stats_init(FrameStats* s, const char* emulate_name, bool enabled);
+void frame_stats_record(FrameHistogram* h, uint64_t value);
+uint64_t frame_stats_percentile(const FrameHistogram* h, double p);
+void frame_stats_begin(FrameStats* s, FrameStage stage);
+void frame_stats_end(FrameStats* s, FrameStage stage);
+void frame_stats_frame_begin(FrameStats* s);
+void frame_stats_frame_end(FrameStats* s, size_t bytes_written);
+std::string frame_stats_status_line(const FrameStats* s);
+void frame_stats_dump_json(const FrameStats* s, FILE* fp);
+int frame_stats_dump_json_file(const FrameStats* s, const char* path);
+
+#if ENABLE_FRAME_STATS
+# define FRAME_STATS_BEGIN(s, stage)      ((s)->enabled ? frame_stats_begin((s), (stage)) : (void)0)
+# define FRAME_STATS_END(s, stage)        ((s)->enabled ? frame_stats_end((s), (stage)) : (void)0)
+# define FRAME_STATS_FRAME_BEGIN(s)       ((s)->enabled ? frame_stats_frame_begin((s)) : (void)0)
+# define FRAME_STATS_FRAME_END(s, bytes)  ((s)->enabled ? frame_stats_frame_end((s), (bytes)) : (void)(bytes))
+#else
+# define FRAME_STATS_BEGIN(s, stage)      ((void)(s))
+# define FRAME_STATS_END(s, stage)        ((void)(s))
+# define FRAME_STATS_FRAME_BEGIN(s)       ((void)(s))
+# define FRAME_STATS_FRAME_END(s, bytes)  ((void)(s), (void)(bytes))
+#endif
+
+#ifdef FRAME_STATS_IMPLEMENTATION
+
+#include <string.h>
+#include <bit>
+#include <chrono>
+#include <format>
+
+int64_t frame_stats_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void frame_stats_init(FrameStats* s, const char* emulate_name, bool enabled) {
+    memset(s, 0, sizeof(*s));
+    s->enabled = enabled;
+    s->stage_names[STAGE_INPUT]   = "input";
+    s->stage_names[STAGE_EMULATE] = emulate_name ? emulate_name : "emulate";
+    s->stage_names[STAGE_PALETTE] = "palette";
+    s->stage_names[STAGE_ENCODE]  = "encode";
+    s->stage_names[STAGE_WRITE]   = "write";
+}
+
+static int frame_stats_bucket(uint64_t value) {
+    const uint64_t sub_count = 1ull << FRAME_STATS_SUB_BITS;
+    if (value < sub_count) {
+        return (int)value;
+    }
+    const int shift = (int)std::bit_width(value) - 1 - FRAME_STATS_SUB_BITS;
+    return ((shift + 1) << FRAME_STATS_SUB_BITS) + (int)((value >> shift) & (sub_count - 1));
+}
+
+// midpoint of the value range covered by 'bucket'
+static uint64_t frame_stats_bucket_value(int bucket) {
+    const int sub_count = 1 << FRAME_STATS_SUB_BITS;
+    if (bucket < sub_count) {
+        return (uint64_t)bucket;
+    }
+    const int shift = (bucket >> FRAME_STATS_SUB_BITS) - 1;
+    const uint64_t lower = (uint64_t)(sub_count + (bucket & (sub_count - 1))) << shift;
+    return lower + ((1ull << shift) >> 1);
+}
+
+void frame_stats_record(FrameHistogram* h, uint64_t value) {
+    ++h->counts[frame_stats_bucket(value)];
+    ++h->total;
+    h->sum += value;
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+uint64_t frame_stats_percentile(const FrameHistogram* h, double p) {
+    if (h->total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p * (double)h->total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > h->total) rank = h->total;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < FRAME_STATS_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            const uint64_t v = frame_stats_bucket_value(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+void frame_stats_begin(FrameStats* s, FrameStage stage) {
+    s->stage_start[stage] = frame_stats_now_ns();
+}
+
+void frame_stats_end(FrameStats* s, FrameStage stage) {
+    const int64_t elapsed = frame_stats_now_ns() - s->stage_start[stage];
+    frame_stats_record(&s->stages[stage], elapsed > 0 ? (uint64_t)elapsed : 0);
+}
+
+void frame_stats_frame_begin(FrameStats* s) {
+    s->frame_start = frame_stats_now_ns();
+}
+
+void frame_stats_frame_end(FrameStats* s, size_t bytes_written) {
+    const int64_t elapsed = frame_stats_now_ns() - s->frame_start;
+    frame_stats_record(&s->frame, elapsed > 0 ? (uint64_t)elapsed : 0);
+    frame_stats_record(&s->bytes, bytes_written);
+    ++s->frames;
+}
+
+std::string frame_stats_status_line(const FrameStats* s) {
+    std::string line = std::format("frame {:d}", s->frames);
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const FrameHistogram* h = &s->stages[i];
+        if (h->total == 0) continue;
+        line += std::format(" | {} {:.2f}/{:.2f}ms", s->stage_names[i],
+                            frame_stats_percentile(h, 0.50) / 1e6,
+                            frame_stats_percentile(h, 0.99) / 1e6);
+    }
+    line += std::format(" | {:d} KB/frame", frame_stats_percentile(&s->bytes, 0.50) / 1024);
+    // pad so a shorter line fully overwrites the previous one
+    if (line.size() < 120) line.append(120 - line.size(), ' ');
+    return line;
+}
+
+static void frame_stats_dump_histogram(const FrameHistogram* h, FILE* fp, double scale, const char* unit) {
+    const double mean = h->total ? (double)h->sum / (double)h->total : 0.0;
+    fprintf(fp, "{\"count\": %llu, \"mean_%s\": %.3f, \"p50_%s\": %.3f, \"p99_%s\": %.3f, \"max_%s\": %.3f}",
+            (unsigned long long)h->total,
+            unit, mean * scale,
+            unit, (double)frame_stats_percentile(h, 0.50) * scale,
+            unit, (double)frame_stats_percentile(h, 0.99) * scale,
+            unit, (double)h->max * scale);
+}
+
+void frame_stats_dump_json(const FrameStats* s, FILE* fp) {
+    fprintf(fp, "{\n  \"frames\": %llu,\n  \"stages\": {\n", (unsigned long long)s->frames);
+    bool first = true;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (s->stages[i].total == 0) continue;
+        fprintf(fp, "%s    \"%s\": ", first ? "" : ",\n", s->stage_names[i]);
+        frame_stats_dump_histogram(&s->stages[i], fp, 1e-3, "us");
+        first = false;
+    }
+    fprintf(fp, "\n  },\n  \"frame\": ");
+    frame_stats_dump_histogram(&s->frame, fp, 1e-3, "us");
+    fprintf(fp, ",\n  \"bytes_per_frame\": ");
+    frame_stats_dump_histogram(&s->bytes, fp, 1.0, "bytes");
+    fprintf(fp, "\n}\n");
+}
+
+int frame_stats_dump_json_file(const FrameStats* s, const char* path) {
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        return 0;
+    }
+    frame_stats_dump_json(s, fp);
+    fclose(fp);
+    return 1;
+}
+
+#endif // FRAME_STATS_IMPLEMENTATION
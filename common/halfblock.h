@@ -0,0 +1,204 @@
+// halfblock.h - truecolor text output for terminals without graphics support
+//
+// Single-header library: define HALFBLOCK_IMPLEMENTATION in exactly one
+// translation unit before including it.
+//
+// Every character cell shows two pixels stacked vertically: the upper half
+// block U+2580 in the foreground color over the background color, both set
+// with 24-bit SGR sequences. The renderer keeps the cell grid of the previous
+// frame and only rewrites cells that changed, so a mostly static screen costs
+// a few hundred bytes per frame instead of a full redraw.
+//
+// Output starts at the cursor position the frontend puts the cursor at before
+// writing, and moves only relative to it. It ends on the line below the image.
+
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+typedef struct {
+    int cols, rows;
+    std::vector<uint32_t> top, bottom;  // 0xRRGGBB per cell of the last frame
+    bool valid;                         // false forces a full redraw
+} HalfBlockRenderer;
+
+void halfblock_init(HalfBlockRenderer* r);
+// redraw everything on the next frame, e.g. after the screen was cleared
+void halfblock_invalidate(HalfBlockRenderer* r);
+std::string encode_halfblock(HalfBlockRenderer* r, const unsigned char* img, int width, int height, int channels);
+
+#ifdef HALFBLOCK_IMPLEMENTATION
+
+#include <format>
+
+#define HALFBLOCK_UNKNOWN 0xFFFFFFFFu
+
+// U+2580 and U+2584 in UTF-8
+#define HALFBLOCK_UPPER "\xe2\x96\x80"
+#define HALFBLOCK_LOWER "\xe2\x96\x84"
+
+typedef struct {
+    std::string* out;
+    int x, y;          // cursor relative to the image origin, x < 0 if unknown
+    uint32_t fg, bg;   // current SGR colors
+} HalfBlockCursor;
+
+void halfblock_init(HalfBlockRenderer* r) {
+    r->cols = r->rows = 0;
+    r->top.clear();
+    r->bottom.clear();
+    r->valid = false;
+}
+
+void halfblock_invalidate(HalfBlockRenderer* r) {
+    r->valid = false;
+}
+
+static uint32_t halfblock_pixel(const unsigned char* img, int width, int height, int channels, int x, int y) {
+    if (y >= height) {
+        return 0;
+    }
+    const unsigned char* p = img + ((size_t)y * width + x) * channels;
+    if (channels < 3) {
+        return ((uint32_t)p[0] << 16) | ((uint32_t)p[0] << 8) | p[0];
+    }
+    return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+static void halfblock_move(HalfBlockCursor* c, int x, int y) {
+    if (y > c->y) {
+        // line feeds scroll when the image sits at the bottom of the screen,
+        // which cursor down doesn't; the tty may add a carriage return
+        c->out->append((size_t)(y - c->y), '\n');
+        c->x = -1;
+    }
+    else if (y < c->y) {
+        *c->out += std::format("\x1b[{:d}A", c->y - y);
+    }
+    c->y = y;
+
+    if (c->x == x) {
+        return;
+    }
+    if (c->x < 0 || x == 0 || x < c->x) {
+        // after the last column the terminal may be in its pending wrap
+        // state, so only a carriage return puts the cursor somewhere known
+        *c->out += '\r';
+        c->x = 0;
+    }
+    if (x > c->x) {
+        if (x - c->x == 1) *c->out += "\x1b[C";
+        else               *c->out += std::format("\x1b[{:d}C", x - c->x);
+    }
+    c->x = x;
+}
+
+// SGR sequences are emitted for nearly every changed cell, too often for std::format
+static void halfblock_append_rgb(std::string* out, uint32_t color) {
+    for (int shift = 16; shift >= 0; shift -= 8) {
+        const unsigned v = (color >> shift) & 0xFF;
+        *out += ';';
+        if (v >= 100) *out += (char)('0' + v / 100);
+        if (v >= 10)  *out += (char)('0' + v / 10 % 10);
+        *out += (char)('0' + v % 10);
+    }
+}
+
+static void halfblock_sgr(HalfBlockCursor* c, uint32_t fg, uint32_t bg) {
+    const bool set_fg = fg != c->fg;
+    const bool set_bg = bg != c->bg;
+    if (!set_fg && !set_bg) {
+        return;
+    }
+    *c->out += "\x1b[";
+    if (set_fg) {
+        *c->out += "38;2";
+        halfblock_append_rgb(c->out, fg);
+    }
+    if (set_bg) {
+        if (set_fg) *c->out += ';';
+        *c->out += "48;2";
+        halfblock_append_rgb(c->out, bg);
+    }
+    *c->out += 'm';
+    c->fg = fg;
+    c->bg = bg;
+}
+
+// pick whichever of space, upper or lower half block needs the fewest color changes
+static void halfblock_put(HalfBlockCursor* c, uint32_t top, uint32_t bottom, int cols) {
+    if (top == bottom) {
+        if (c->bg != top) {
+            halfblock_sgr(c, c->fg, top);
+        }
+        *c->out += ' ';
+    }
+    else if (c->fg == bottom && c->bg == top) {
+        *c->out += HALFBLOCK_LOWER;
+    }
+    else if (c->fg == bottom || c->bg == top) {
+        halfblock_sgr(c, bottom, top);
+        *c->out += HALFBLOCK_LOWER;
+    }
+    else {
+        halfblock_sgr(c, top, bottom);
+        *c->out += HALFBLOCK_UPPER;
+    }
+    c->x = c->x + 1 < cols ? c->x + 1 : -1;
+}
+
+std::string encode_halfblock(HalfBlockRenderer* r, const unsigned char* img, int width, int height, int channels) {
+    const int rows = (height + 1) / 2;
+    if (r->cols != width || r->rows != rows) {
+        r->cols = width;
+        r->rows = rows;
+        r->top.assign((size_t)width * rows, HALFBLOCK_UNKNOWN);
+        r->bottom.assign((size_t)width * rows, HALFBLOCK_UNKNOWN);
+        r->valid = false;
+    }
+
+    std::string result;
+    HalfBlockCursor c = { &result, 0, 0, HALFBLOCK_UNKNOWN, HALFBLOCK_UNKNOWN };
+
+    for (int y = 0; y < rows; y++) {
+        uint32_t* old_top = &r->top[(size_t)y * width];
+        uint32_t* old_bottom = &r->bottom[(size_t)y * width];
+        int pending = -1;  // first unchanged cell after a write, worth rewriting if the gap is short
+
+        for (int x = 0; x < width; x++) {
+            const uint32_t top = halfblock_pixel(img, width, height, channels, x, y * 2);
+            const uint32_t bottom = halfblock_pixel(img, width, height, channels, x, y * 2 + 1);
+            if (r->valid && top == old_top[x] && bottom == old_bottom[x]) {
+                if (pending < 0 && c.y == y && c.x == x) pending = x;
+                continue;
+            }
+
+            // a gap of one or two cells is cheaper to redraw than to jump
+            // over, as long as that needs no color change
+            if (pending >= 0 && x - pending <= 2 && c.y == y && c.x == pending) {
+                for (int g = pending; g < x; g++) {
+                    const uint32_t gt = old_top[g], gb = old_bottom[g];
+                    const bool same_colors = gt == gb ? c.bg == gt : (c.fg == gt && c.bg == gb) || (c.fg == gb && c.bg == gt);
+                    if (!same_colors) break;
+                    halfblock_put(&c, gt, gb, width);
+                }
+            }
+            pending = -1;
+
+            halfblock_move(&c, x, y);
+            halfblock_put(&c, top, bottom, width);
+            old_top[x] = top;
+            old_bottom[x] = bottom;
+        }
+    }
+
+    // leave the cursor on the line below the image, where sixel output ends too
+    halfblock_move(&c, c.x, rows - 1);
+    result += "\x1b[0m\r\n";
+    r->valid = true;
+    return result;
+}
+
+#endif // HALFBLOCK_IMPLEMENTATION
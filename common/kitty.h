@@ -0,0 +1,360 @@
+// kitty.h - kitty graphics protocol output, the alternative to encode_sixel
+//
+// Single-header library: define KITTY_IMPLEMENTATION in exactly one
+// translation unit before including it.
+//
+// Frames are sent as 24-bit RGB, so there is no palette stage and no register
+// limit. Two transmission modes:
+//   KITTY_SHM   pixels go into a POSIX shared memory object (a named file
+//               mapping on Windows) and only a short control message naming it
+//               is written to the terminal (t=s). The terminal unlinks the
+//               object after reading it.
+//   KITTY_ZLIB  pixels are deflated, base64 encoded and sent in-band in 4096
+//               byte chunks (t=d, o=z). Works over ssh and in terminals without
+//               shared memory support.
+// Every frame reuses image id 1 and placement id 1, so a new frame replaces
+// the previous one at the cursor position instead of stacking up.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#define KITTY_SHM_RING 8
+
+typedef enum {
+    KITTY_SHM = 0,
+    KITTY_ZLIB
+} KittyMode;
+
+typedef struct {
+    KittyMode mode;
+    int display_cols, display_rows;  // size on screen in cells, 0 to show it at its pixel size
+    uint32_t frame;
+    std::vector<uint8_t> rgb;
+    std::vector<uint8_t> compressed;
+    // shared memory objects of recent frames; removed again once they fall out
+    // of the ring in case the terminal never picked them up
+#ifdef _WIN32
+    void* mappings[KITTY_SHM_RING];
+#else
+    std::string shm_names[KITTY_SHM_RING];
+#endif
+} KittyEncoder;
+
+void kitty_init(KittyEncoder* k, KittyMode mode);
+void kitty_free(KittyEncoder* k);
+std::string encode_kitty(KittyEncoder* k, const unsigned char* img, int width, int height, int channels);
+// zlib stream (fixed Huffman deflate) of 'size' bytes, appended to 'out'
+void kitty_zlib_compress(const uint8_t* data, size_t size, std::vector<uint8_t>* out);
+
+#ifdef KITTY_IMPLEMENTATION
+
+#include <string.h>
+#include <format>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
+#define KITTY_CHUNK 4096
+
+void kitty_init(KittyEncoder* k, KittyMode mode) {
+    k->mode = mode;
+    k->display_cols = k->display_rows = 0;
+    k->frame = 0;
+    k->rgb.clear();
+    k->compressed.clear();
+#ifdef _WIN32
+    memset(k->mappings, 0, sizeof(k->mappings));
+#endif
+}
+
+void kitty_free(KittyEncoder* k) {
+    for (int i = 0; i < KITTY_SHM_RING; i++) {
+#ifdef _WIN32
+        if (k->mappings[i] != NULL) {
+            CloseHandle((HANDLE)k->mappings[i]);
+            k->mappings[i] = NULL;
+        }
+#else
+        if (!k->shm_names[i].empty()) {
+            shm_unlink(k->shm_names[i].c_str());
+            k->shm_names[i].clear();
+        }
+#endif
+    }
+    k->rgb.clear();
+    k->compressed.clear();
+}
+
+static void kitty_base64(const uint8_t* data, size_t size, std::string* out) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i = 0;
+    for (; i + 3 <= size; i += 3) {
+        const uint32_t v = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+        *out += table[(v >> 18) & 63];
+        *out += table[(v >> 12) & 63];
+        *out += table[(v >> 6) & 63];
+        *out += table[v & 63];
+    }
+    if (i < size) {
+        const uint32_t v = ((uint32_t)data[i] << 16) | (i + 1 < size ? (uint32_t)data[i + 1] << 8 : 0);
+        *out += table[(v >> 18) & 63];
+        *out += table[(v >> 12) & 63];
+        *out += i + 1 < size ? table[(v >> 6) & 63] : '=';
+        *out += '=';
+    }
+}
+
+// packed RGB regardless of the frontend's pixel format; a fourth channel is
+// padding in the emulators' framebuffers, not alpha
+static void kitty_pack_rgb(KittyEncoder* k, const unsigned char* img, int width, int height, int channels) {
+    const size_t pixels = (size_t)width * height;
+    k->rgb.resize(pixels * 3);
+    if (channels == 3) {
+        memcpy(k->rgb.data(), img, pixels * 3);
+        return;
+    }
+    uint8_t* out = k->rgb.data();
+    for (size_t i = 0; i < pixels; i++) {
+        const unsigned char* p = img + i * channels;
+        out[0] = p[0];
+        out[1] = channels >= 3 ? p[1] : p[0];
+        out[2] = channels >= 3 ? p[2] : p[0];
+        out += 3;
+    }
+}
+
+// writes the frame into a fresh shared memory object and returns its name,
+// or an empty string if shared memory is unavailable
+static std::string kitty_write_shm(KittyEncoder* k) {
+    const size_t size = k->rgb.size();
+    const int slot = k->frame % KITTY_SHM_RING;
+#ifdef _WIN32
+    const std::string name = std::format("hello_sixel_{:d}_{:d}", (int)GetCurrentProcessId(), k->frame);
+    if (k->mappings[slot] != NULL) {
+        CloseHandle((HANDLE)k->mappings[slot]);
+        k->mappings[slot] = NULL;
+    }
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                        (DWORD)((uint64_t)size >> 32), (DWORD)size, name.c_str());
+    if (mapping == NULL) {
+        return std::string();
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+    if (view == NULL) {
+        CloseHandle(mapping);
+        return std::string();
+    }
+    memcpy(view, k->rgb.data(), size);
+    UnmapViewOfFile(view);
+    // the mapping only lives as long as a handle to it, so keep it open
+    // until the slot comes around again
+    k->mappings[slot] = mapping;
+#else
+    const std::string name = std::format("/hello_sixel_{:d}_{:d}", (int)getpid(), k->frame);
+    if (!k->shm_names[slot].empty()) {
+        shm_unlink(k->shm_names[slot].c_str());
+        k->shm_names[slot].clear();
+    }
+    const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        return std::string();
+    }
+    void* view = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0) {
+        view = mmap(NULL, size, PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (view == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        return std::string();
+    }
+    memcpy(view, k->rgb.data(), size);
+    munmap(view, size);
+    k->shm_names[slot] = name;
+#endif
+    return name;
+}
+
+std::string encode_kitty(KittyEncoder* k, const unsigned char* img, int width, int height, int channels) {
+    kitty_pack_rgb(k, img, width, height, channels);
+    // q=2 suppresses the terminal's replies, C=1 leaves the cursor where it is
+    std::string keys = std::format("a=T,q=2,C=1,i=1,p=1,f=24,s={:d},v={:d}", width, height);
+    if (k->display_cols > 0 && k->display_rows > 0) {
+        // the terminal scales the image to fill this many cells
+        keys += std::format(",c={:d},r={:d}", k->display_cols, k->display_rows);
+    }
+    std::string result;
+
+    if (k->mode == KITTY_SHM) {
+        const std::string name = kitty_write_shm(k);
+        ++k->frame;
+        if (!name.empty()) {
+            result += "\x1b_G";
+            result += keys;
+            result += std::format(",t=s,S={:d};", k->rgb.size());
+            kitty_base64((const uint8_t*)name.data(), name.size(), &result);
+            result += "\x1b\\";
+            return result;
+        }
+        // no shared memory, e.g. /dev/shm missing: send this frame in-band
+    }
+
+    k->compressed.clear();
+    kitty_zlib_compress(k->rgb.data(), k->rgb.size(), &k->compressed);
+
+    std::string payload;
+    kitty_base64(k->compressed.data(), k->compressed.size(), &payload);
+    for (size_t offset = 0; offset < payload.size(); offset += KITTY_CHUNK) {
+        const size_t chunk = payload.size() - offset < KITTY_CHUNK ? payload.size() - offset : KITTY_CHUNK;
+        const int more = offset + chunk < payload.size();
+        result += "\x1b_G";
+        if (offset == 0) {
+            result += keys;
+            result += ",t=d,o=z,";
+        }
+        result += std::format("m={:d};", more);
+        result.append(payload, offset, chunk);
+        result += "\x1b\\";
+    }
+    return result;
+}
+
+// deflate with fixed Huffman codes (RFC 1951 3.2.6) and greedy matching over
+// a single-entry hash table. Emulator frames are mostly runs and repeated
+// tiles, which this already catches; dynamic trees would buy little here.
+
+#define KITTY_HASH_BITS 15
+#define KITTY_WINDOW    32768
+#define KITTY_MIN_MATCH 3
+#define KITTY_MAX_MATCH 258
+
+typedef struct {
+    std::vector<uint8_t>* out;
+    uint32_t bits;
+    int count;
+} KittyBitWriter;
+
+static void kitty_put_bits(KittyBitWriter* w, uint32_t value, int n) {
+    w->bits |= value << w->count;
+    w->count += n;
+    while (w->count >= 8) {
+        w->out->push_back((uint8_t)w->bits);
+        w->bits >>= 8;
+        w->count -= 8;
+    }
+}
+
+// Huffman codes are defined MSB first but packed LSB first
+static void kitty_put_code(KittyBitWriter* w, uint32_t code, int n) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < n; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    kitty_put_bits(w, reversed, n);
+}
+
+static void kitty_put_symbol(KittyBitWriter* w, int symbol) {
+    if (symbol < 144)      kitty_put_code(w, 0x30 + symbol, 8);
+    else if (symbol < 256) kitty_put_code(w, 0x190 + (symbol - 144), 9);
+    else if (symbol < 280) kitty_put_code(w, symbol - 256, 7);
+    else                   kitty_put_code(w, 0xC0 + (symbol - 280), 8);
+}
+
+static void kitty_put_match(KittyBitWriter* w, int length, int distance) {
+    static const uint16_t length_base[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const uint8_t length_extra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const uint16_t dist_base[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static const uint8_t dist_extra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    int l = 28;
+    while (length_base[l] > length) l--;
+    kitty_put_symbol(w, 257 + l);
+    kitty_put_bits(w, length - length_base[l], length_extra[l]);
+
+    int d = 29;
+    while (dist_base[d] > distance) d--;
+    kitty_put_code(w, d, 5);
+    kitty_put_bits(w, distance - dist_base[d], dist_extra[d]);
+}
+
+void kitty_zlib_compress(const uint8_t* data, size_t size, std::vector<uint8_t>* out) {
+    // CMF/FLG: deflate, 32K window, fastest compression level
+    out->push_back(0x78);
+    out->push_back(0x01);
+
+    KittyBitWriter w = { out, 0, 0 };
+    kitty_put_bits(&w, 1, 1);  // BFINAL
+    kitty_put_bits(&w, 1, 2);  // BTYPE = fixed Huffman
+
+    std::vector<int32_t> head(1 << KITTY_HASH_BITS, -1);
+    size_t i = 0;
+    while (i < size) {
+        int best = 0;
+        size_t candidate = 0;
+        if (i + KITTY_MIN_MATCH <= size) {
+            const uint32_t h = ((data[i] << 16) | (data[i + 1] << 8) | data[i + 2]) * 2654435761u >> (32 - KITTY_HASH_BITS);
+            const int32_t prev = head[h];
+            head[h] = (int32_t)i;
+            if (prev >= 0 && i - prev <= KITTY_WINDOW) {
+                candidate = (size_t)prev;
+                const size_t limit = size - i < KITTY_MAX_MATCH ? size - i : KITTY_MAX_MATCH;
+                while ((size_t)best < limit && data[candidate + best] == data[i + best]) best++;
+            }
+        }
+
+        if (best >= KITTY_MIN_MATCH) {
+            kitty_put_match(&w, best, (int)(i - candidate));
+            // keep the hash table warm inside the match, sparsely for long runs
+            const size_t end = i + best;
+            for (i++; i < end; i += (best > 32 ? 4 : 1)) {
+                if (i + KITTY_MIN_MATCH <= size) {
+                    head[((data[i] << 16) | (data[i + 1] << 8) | data[i + 2]) * 2654435761u >> (32 - KITTY_HASH_BITS)] = (int32_t)i;
+                }
+            }
+            i = end;
+        }
+        else {
+            kitty_put_symbol(&w, data[i]);
+            i++;
+        }
+    }
+    kitty_put_symbol(&w, 256);
+    if (w.count > 0) {
+        kitty_put_bits(&w, 0, 8 - w.count);
+    }
+
+    uint32_t a = 1, b = 0;
+    for (size_t j = 0; j < size; ) {
+        // 5552 is the longest run before the sums can overflow
+        const size_t end = size - j < 5552 ? size : j + 5552;
+        for (; j < end; j++) {
+            a += data[j];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    const uint32_t adler = (b << 16) | a;
+    out->push_back((uint8_t)(adler >> 24));
+    out->push_back((uint8_t)(adler >> 16));
+    out->push_back((uint8_t)(adler >> 8));
+    out->push_back((uint8_t)adler);
+}
+
+#endif // KITTY_IMPLEMENTATION
@@ -0,0 +1,206 @@
+// quantize.h - palettes for images that are never held in memory whole
+//
+// Single-header library: define QUANTIZE_IMPLEMENTATION in exactly one
+// translation unit before including it. That translation unit also needs the
+// implementation of sixel.h, whose global palette these functions fill.
+//
+// generate_palette in sixel.h takes the first colors it sees, which needs the
+// whole image up front to be any good. Here the palette is either a fixed
+// uniform grid, known before the first pixel arrives, or a median cut over a
+// histogram gathered in an earlier pass. Pixels are then mapped through a
+// table of 15-bit colors, so quantizing costs one lookup per pixel.
+
+#pragma once
+
+#include <stdint.h>
+
+#define QUANTIZE_BINS (1 << 15)
+
+typedef struct {
+    uint32_t count[QUANTIZE_BINS];  // pixels per 5:5:5 color
+} ColorHistogram;
+
+typedef struct {
+    uint8_t index[QUANTIZE_BINS];   // palette entry per 5:5:5 color
+} ColorLookup;
+
+static inline int quantize_bin(uint8_t r, uint8_t g, uint8_t b) {
+    return ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+}
+
+static inline uint8_t color_lookup(const ColorLookup* lut, uint8_t r, uint8_t g, uint8_t b) {
+    return lut->index[quantize_bin(r, g, b)];
+}
+
+// evenly spaced levels per channel, as many as palette_limit allows
+void quantize_uniform_palette();
+void color_histogram_clear(ColorHistogram* h);
+// 'channels' is 1 to 4: gray, gray + alpha, RGB or RGBA; fully transparent
+// pixels are left out, as they are never painted
+void color_histogram_add(ColorHistogram* h, const unsigned char* pixels, int count, int channels);
+// up to palette_limit colors splitting the histogram at the median of the widest channel
+void quantize_median_cut(const ColorHistogram* h);
+// maps every 15-bit color to its closest entry of the current palette
+void color_lookup_build(ColorLookup* lut);
+
+#ifdef QUANTIZE_IMPLEMENTATION
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "sixel.h"
+
+void quantize_uniform_palette() {
+    reset_palette();
+    if (palette_limit < 8) {
+        // too few registers for two levels per channel, use a gray ramp
+        for (int i = 0; i < palette_limit; i++) {
+            ColorPalette* p = &palette[palette_size++];
+            p->r = p->g = p->b = (uint8_t)(i * 255 / (palette_limit - 1));
+        }
+        return;
+    }
+
+    // green gets the extra level first, red second, like 3:3:2
+    int levels = 2;
+    while ((levels + 1) * (levels + 1) * (levels + 1) <= palette_limit) levels++;
+    int r_levels = levels, g_levels = levels, b_levels = levels;
+    if (r_levels * (g_levels + 1) * b_levels <= palette_limit) g_levels++;
+    if ((r_levels + 1) * g_levels * b_levels <= palette_limit) r_levels++;
+
+    for (int r = 0; r < r_levels; r++) {
+        for (int g = 0; g < g_levels; g++) {
+            for (int b = 0; b < b_levels; b++) {
+                ColorPalette* p = &palette[palette_size++];
+                p->r = (uint8_t)(r * 255 / (r_levels - 1));
+                p->g = (uint8_t)(g * 255 / (g_levels - 1));
+                p->b = (uint8_t)(b * 255 / (b_levels - 1));
+            }
+        }
+    }
+}
+
+void color_histogram_clear(ColorHistogram* h) {
+    memset(h->count, 0, sizeof(h->count));
+}
+
+void color_histogram_add(ColorHistogram* h, const unsigned char* pixels, int count, int channels) {
+    for (int i = 0; i < count; i++) {
+        const unsigned char* p = pixels + (size_t)i * channels;
+        if ((channels == 2 || channels == 4) && p[channels - 1] == 0) continue;
+        if (channels < 3) h->count[quantize_bin(p[0], p[0], p[0])]++;
+        else              h->count[quantize_bin(p[0], p[1], p[2])]++;
+    }
+}
+
+typedef struct {
+    int first, last;   // range of 'bins' covered
+    int lo[3], hi[3];  // channel bounds, 0..31
+    uint64_t pixels;
+} QuantizeBox;
+
+static int bin_channel(int bin, int channel) {
+    return (bin >> (10 - channel * 5)) & 31;
+}
+
+static void quantize_shrink_box(QuantizeBox* box, const std::vector<int>& bins, const ColorHistogram* h) {
+    for (int c = 0; c < 3; c++) {
+        box->lo[c] = 31;
+        box->hi[c] = 0;
+    }
+    box->pixels = 0;
+    for (int i = box->first; i < box->last; i++) {
+        for (int c = 0; c < 3; c++) {
+            const int v = bin_channel(bins[i], c);
+            if (v < box->lo[c]) box->lo[c] = v;
+            if (v > box->hi[c]) box->hi[c] = v;
+        }
+        box->pixels += h->count[bins[i]];
+    }
+}
+
+void quantize_median_cut(const ColorHistogram* h) {
+    std::vector<int> bins;
+    for (int i = 0; i < QUANTIZE_BINS; i++) {
+        if (h->count[i]) bins.push_back(i);
+    }
+
+    std::vector<QuantizeBox> boxes;
+    if (!bins.empty()) {
+        QuantizeBox all = {};
+        all.last = (int)bins.size();
+        quantize_shrink_box(&all, bins, h);
+        boxes.push_back(all);
+    }
+
+    while ((int)boxes.size() < palette_limit) {
+        // split the box with the widest channel range, weighted by how many pixels it holds
+        int best = -1, best_channel = 0;
+        uint64_t best_score = 0;
+        for (int i = 0; i < (int)boxes.size(); i++) {
+            const QuantizeBox* box = &boxes[i];
+            if (box->last - box->first < 2) continue;
+            for (int c = 0; c < 3; c++) {
+                const uint64_t score = (uint64_t)(box->hi[c] - box->lo[c]) * box->pixels;
+                if (score > best_score || best < 0) {
+                    best = i;
+                    best_channel = c;
+                    best_score = score;
+                }
+            }
+        }
+        if (best < 0) break;
+
+        QuantizeBox box = boxes[best];
+        const int c = best_channel;
+        std::sort(bins.begin() + box.first, bins.begin() + box.last, [c](int a, int b) {
+            return bin_channel(a, c) < bin_channel(b, c);
+        });
+        uint64_t half = 0;
+        int split = box.first + 1;
+        for (int i = box.first; i < box.last - 1; i++) {
+            half += h->count[bins[i]];
+            split = i + 1;
+            if (half * 2 >= box.pixels) break;
+        }
+
+        QuantizeBox low = {}, high = {};
+        low.first = box.first;
+        low.last = split;
+        high.first = split;
+        high.last = box.last;
+        quantize_shrink_box(&low, bins, h);
+        quantize_shrink_box(&high, bins, h);
+        boxes[best] = low;
+        boxes.push_back(high);
+    }
+
+    reset_palette();
+    for (const QuantizeBox& box : boxes) {
+        // pixel weighted mean of the box, from the middle of each 5-bit bin
+        uint64_t sum[3] = {};
+        for (int i = box.first; i < box.last; i++) {
+            for (int c = 0; c < 3; c++) {
+                sum[c] += (uint64_t)(bin_channel(bins[i], c) * 8 + 4) * h->count[bins[i]];
+            }
+        }
+        ColorPalette* p = &palette[palette_size++];
+        p->r = (uint8_t)(sum[0] / box.pixels);
+        p->g = (uint8_t)(sum[1] / box.pixels);
+        p->b = (uint8_t)(sum[2] / box.pixels);
+    }
+    if (palette_size == 0) {
+        palette_size = 1;
+    }
+}
+
+void color_lookup_build(ColorLookup* lut) {
+    for (int i = 0; i < QUANTIZE_BINS; i++) {
+        lut->index[i] = (uint8_t)find_closest_color((uint8_t)(bin_channel(i, 0) * 8 + 4),
+                                                    (uint8_t)(bin_channel(i, 1) * 8 + 4),
+                                                    (uint8_t)(bin_channel(i, 2) * 8 + 4));
+    }
+}
+
+#endif // QUANTIZE_IMPLEMENTATION
@@ -0,0 +1,322 @@
+// sixel.h - palette building and sixel encoding shared by all frontends
+//
+// Single-header library: define SIXEL_IMPLEMENTATION in exactly one
+// translation unit before including it.
+//
+// SIXEL_START, SIXEL_START_TRANSPARENT and MAX_COLORS may be defined before
+// including to change the DCS introducers and the palette size.
+// set_palette_limit lowers the number of registers used at runtime, for
+// terminals that have fewer than MAX_COLORS.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#ifndef SIXEL_START
+# define SIXEL_START "\x1bPq"
+#endif
+// P2 = 1: pixels without sixel bits keep what the screen showed before
+#ifndef SIXEL_START_TRANSPARENT
+# define SIXEL_START_TRANSPARENT "\x1bP0;1q"
+#endif
+#define SIXEL_END "\x1b\\"
+#ifndef MAX_COLORS
+# define MAX_COLORS 256
+#endif
+
+typedef struct {
+    uint8_t r, g, b;
+    int used;
+} ColorPalette;
+
+extern ColorPalette palette[MAX_COLORS];
+extern int palette_size;
+extern int palette_limit;
+
+int find_closest_color(uint8_t r, uint8_t g, uint8_t b);
+void generate_palette(const unsigned char *data, int width, int height, int channels);
+void reset_palette();
+void set_palette_limit(int colors);
+std::string encode_sixel(const unsigned char *img, int width, int height, int channels);
+
+// Streaming encoder for images that are quantized band by band: the DCS
+// introducer, raster attributes and current palette, then one call per band
+// of up to six rows of palette indices (so MAX_COLORS must not exceed 256),
+// then SIXEL_END. Colors absent from a band are skipped and runs use '!'.
+// Indices at or above palette_size are left unpainted, which is only useful
+// with the 'transparent' introducer.
+std::string encode_sixel_header(int width, int height, bool transparent = false);
+void encode_sixel_band(std::string *out, const uint8_t *indices, int width, int rows);
+
+// Raw index dumps: a captured frame as palette + one index byte per pixel.
+//   "SIDX", uint32 width, uint32 height, uint32 colors (little endian),
+//   colors * { r, g, b }, width * height indices
+// Written against the current palette; read back expanded to RGB (3 channels).
+int write_index_dump(const char *path, const unsigned char *img, int width, int height, int channels);
+unsigned char *read_index_dump(const char *path, int *width, int *height);
+
+#ifdef SIXEL_IMPLEMENTATION
+
+#include <string.h>
+#include <format>
+#include <vector>
+
+ColorPalette palette[MAX_COLORS];
+int palette_size = 0;
+int palette_limit = MAX_COLORS;
+
+int find_closest_color(uint8_t r, uint8_t g, uint8_t b) {
+    int min_dist = 255*3;
+    int index = 0;
+
+    for (int i = 0; i < palette_size; i++) {
+        int dr = abs(r - palette[i].r);
+        int dg = abs(g - palette[i].g);
+        int db = abs(b - palette[i].b);
+        int dist = dr + dg + db;
+
+        if (dist < min_dist) {
+            min_dist = dist;
+            index = i;
+        }
+    }
+    return index;
+}
+
+void generate_palette(const unsigned char *data, int width, int height, int channels) {
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            int idx = (i * width + j) * channels;
+            uint8_t r = data[idx];
+            uint8_t g = data[idx + 1];
+            uint8_t b = data[idx + 2];
+
+            int found = 0;
+            for (int k = 0; k < palette_size; k++) {
+                if (palette[k].r == r && palette[k].g == g && palette[k].b == b) {
+                    found = 1;
+                    break;
+                }
+            }
+
+            if (!found && palette_size < palette_limit) {
+                palette[palette_size].r = r;
+                palette[palette_size].g = g;
+                palette[palette_size].b = b;
+                palette_size++;
+            }
+        }
+    }
+}
+
+void reset_palette() {
+    memset(palette, 0, sizeof(palette));
+    palette_size = 0;
+}
+
+void set_palette_limit(int colors) {
+    palette_limit = colors < 2 ? 2 : colors > MAX_COLORS ? MAX_COLORS : colors;
+    if (palette_size > palette_limit) {
+        palette_size = palette_limit;
+    }
+}
+
+std::string encode_sixel_header(int width, int height, bool transparent) {
+    std::string result;
+    result += transparent ? SIXEL_START_TRANSPARENT : SIXEL_START;
+    result += std::format("\"1;1;{:d};{:d}", width, height);
+
+    for (int i = 0; i < palette_size; i++) {
+        result += std::format("#{:d};2;{:d};{:d};{:d}", i,
+                              palette[i].r * 100 / 255,
+                              palette[i].g * 100 / 255,
+                              palette[i].b * 100 / 255);
+    }
+    return result;
+}
+
+std::string encode_sixel(const unsigned char *img, int width, int height, int channels) {
+    std::string result = encode_sixel_header(width, height);
+
+    for (int y = 0; y < height; y += 6) {
+        int band_height = (height - y) < 6 ? (height - y) : 6;
+
+        for (int c = 0; c < palette_size; c++) {
+            result += std::format("#{:d}", c);
+
+            for (int x = 0; x < width; x++) {
+                uint8_t sixel_byte = 0;
+
+                for (int dy = 0; dy < band_height; dy++) {
+                    int current_y = y + dy;
+                    if (current_y >= height) break;
+
+                    int idx = (current_y * width + x) * channels;
+                    uint8_t r = img[idx];
+                    uint8_t g = img[idx + 1];
+                    uint8_t b = img[idx + 2];
+
+                    int color_idx = find_closest_color(r, g, b);
+                    if (color_idx == c) {
+                        sixel_byte |= (1 << dy);
+                    }
+                }
+
+                result += char(sixel_byte + 0x3F);
+            }
+            result += "$";
+        }
+        result += "-";
+    }
+
+    result += SIXEL_END;
+    return result;
+}
+
+static void put_sixel_run(std::string *out, char ch, int run) {
+    if (run >= 4) {
+        *out += std::format("!{:d}", run);
+        *out += ch;
+    }
+    else {
+        out->append(run, ch);
+    }
+}
+
+void encode_sixel_band(std::string *out, const uint8_t *indices, int width, int rows) {
+    // one row of sixel bits per color that occurs in the band, built in a
+    // single pass over the pixels instead of one pass per palette entry
+    static std::vector<uint8_t> bits;
+    static std::vector<int> extent;
+    bits.resize((size_t)MAX_COLORS * width);
+    extent.assign(MAX_COLORS, -1);
+
+    for (int dy = 0; dy < rows; dy++) {
+        const uint8_t *row = indices + (size_t)dy * width;
+        for (int x = 0; x < width; x++) {
+            const int c = row[x];
+            if (c >= palette_size) continue;
+            uint8_t *color_bits = &bits[(size_t)c * width];
+            if (extent[c] < 0) {
+                memset(color_bits, 0, width);
+                extent[c] = 0;
+            }
+            color_bits[x] |= (uint8_t)(1 << dy);
+            if (x >= extent[c]) extent[c] = x + 1;
+        }
+    }
+
+    bool first = true;
+    for (int c = 0; c < palette_size; c++) {
+        if (extent[c] < 0) continue;
+        if (!first) *out += '$';
+        first = false;
+        *out += std::format("#{:d}", c);
+
+        // trailing empty columns are left out
+        const uint8_t *color_bits = &bits[(size_t)c * width];
+        char prev = (char)(color_bits[0] + 0x3F);
+        int run = 0;
+        for (int x = 0; x < extent[c]; x++) {
+            const char ch = (char)(color_bits[x] + 0x3F);
+            if (ch != prev) {
+                put_sixel_run(out, prev, run);
+                prev = ch;
+                run = 0;
+            }
+            run++;
+        }
+        put_sixel_run(out, prev, run);
+    }
+    *out += '-';
+}
+
+static void put_u32(FILE *fp, uint32_t v) {
+    const uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+    fwrite(b, 1, 4, fp);
+}
+
+static int get_u32(FILE *fp, uint32_t *v) {
+    uint8_t b[4];
+    if (fread(b, 1, 4, fp) != 4) return 0;
+    *v = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    return 1;
+}
+
+int write_index_dump(const char *path, const unsigned char *img, int width, int height, int channels) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    fwrite("SIDX", 1, 4, fp);
+    put_u32(fp, (uint32_t)width);
+    put_u32(fp, (uint32_t)height);
+    put_u32(fp, (uint32_t)palette_size);
+    for (int i = 0; i < palette_size; i++) {
+        const uint8_t rgb[3] = { palette[i].r, palette[i].g, palette[i].b };
+        fwrite(rgb, 1, 3, fp);
+    }
+
+    std::string row(width, '\0');
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const unsigned char *p = img + (y * width + x) * channels;
+            row[x] = (char)find_closest_color(p[0], p[1], p[2]);
+        }
+        fwrite(row.data(), 1, width, fp);
+    }
+
+    const int ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+unsigned char *read_index_dump(const char *path, int *width, int *height) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    char magic[4];
+    uint32_t w, h, colors;
+    uint8_t rgb[256][3] = {};
+    unsigned char *img = NULL;
+    unsigned char *indices = NULL;
+
+    if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, "SIDX", 4) != 0 ||
+        !get_u32(fp, &w) || !get_u32(fp, &h) || !get_u32(fp, &colors) ||
+        w == 0 || h == 0 || w > 32768 || h > 32768 || colors > 256 ||
+        fread(rgb, 3, colors, fp) != colors) {
+        fclose(fp);
+        return NULL;
+    }
+
+    const size_t pixels = (size_t)w * h;
+    indices = (unsigned char *)malloc(pixels);
+    img = (unsigned char *)malloc(pixels * 3);
+    if (indices == NULL || img == NULL || fread(indices, 1, pixels, fp) != pixels) {
+        free(indices);
+        free(img);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+
+    for (size_t i = 0; i < pixels; i++) {
+        const uint8_t c = indices[i] < colors ? indices[i] : 0;
+        img[i * 3 + 0] = rgb[c][0];
+        img[i * 3 + 1] = rgb[c][1];
+        img[i * 3 + 2] = rgb[c][2];
+    }
+    free(indices);
+
+    *width = (int)w;
+    *height = (int)h;
+    return img;
+}
+
+#endif // SIXEL_IMPLEMENTATION
@@ -0,0 +1,254 @@
+// sixel_capture.h - record emitted sixel frames and play them back
+//
+// Single-header library: define SIXEL_CAPTURE_IMPLEMENTATION in exactly one
+// translation unit before including it.
+//
+// Capture file layout (all integers little endian):
+//   header  "SCAP", uint32 version, uint32 width, uint32 height
+//   frames  uint64 time_us, uint32 size, size bytes of terminal output
+//   index   frames * { uint64 offset, uint64 time_us, uint32 size }
+//   footer  uint64 index offset, uint32 frame count, "SCPE"
+// The index is written when the recorder is closed, so a reader can seek to
+// any frame after reading the footer. Files without a footer (the recorder
+// never got closed) are recovered by walking the frame headers once.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#define SIXEL_CAPTURE_VERSION 1
+
+typedef struct {
+    uint64_t offset;   // of the frame data, past its header
+    uint64_t time_us;  // since the start of the recording
+    uint32_t size;
+} SixelCaptureEntry;
+
+typedef struct {
+    FILE* fp;
+    uint64_t offset;
+    int64_t start_ns;
+    std::vector<SixelCaptureEntry> index;
+} SixelRecorder;
+
+typedef struct {
+    FILE* fp;
+    int width, height;
+    int complete;      // 0 if the index was rebuilt from the frame headers
+    std::vector<SixelCaptureEntry> index;
+} SixelCapture;
+
+int sixel_recorder_open(SixelRecorder* r, const char* path, int width, int height);
+// timestamps the frame with the time since sixel_recorder_open
+int sixel_recorder_write(SixelRecorder* r, const char* data, size_t size);
+// for frames that are not produced in real time, e.g. headless runs
+int sixel_recorder_write_at(SixelRecorder* r, const char* data, size_t size, uint64_t time_us);
+// writes the index and footer; safe to call on a recorder that was never opened
+int sixel_recorder_close(SixelRecorder* r);
+
+int sixel_capture_open(SixelCapture* c, const char* path);
+int sixel_capture_read_frame(SixelCapture* c, size_t frame, std::string* out);
+// first frame whose timestamp is at or after 'time_us'
+size_t sixel_capture_find_time(const SixelCapture* c, uint64_t time_us);
+void sixel_capture_close(SixelCapture* c);
+
+#ifdef SIXEL_CAPTURE_IMPLEMENTATION
+
+#include <string.h>
+#include <chrono>
+
+// captures easily grow past 2 GB, which a long offset can't address on Windows
+#ifdef _WIN32
+# define capture_seek _fseeki64
+# define capture_tell _ftelli64
+#else
+# define capture_seek fseeko
+# define capture_tell ftello
+#endif
+
+static int64_t capture_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void capture_put(uint8_t* p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        p[i] = (uint8_t)(v >> (i * 8));
+    }
+}
+
+static uint64_t capture_get(const uint8_t* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) {
+        v |= (uint64_t)p[i] << (i * 8);
+    }
+    return v;
+}
+
+int sixel_recorder_open(SixelRecorder* r, const char* path, int width, int height) {
+    r->fp = fopen(path, "wb");
+    r->index.clear();
+    if (r->fp == NULL) {
+        return 0;
+    }
+
+    uint8_t header[16];
+    memcpy(header, "SCAP", 4);
+    capture_put(header + 4, SIXEL_CAPTURE_VERSION, 4);
+    capture_put(header + 8, (uint32_t)width, 4);
+    capture_put(header + 12, (uint32_t)height, 4);
+    fwrite(header, 1, sizeof(header), r->fp);
+
+    r->offset = sizeof(header);
+    r->start_ns = capture_now_ns();
+    return !ferror(r->fp);
+}
+
+int sixel_recorder_write(SixelRecorder* r, const char* data, size_t size) {
+    const int64_t elapsed = capture_now_ns() - r->start_ns;
+    return sixel_recorder_write_at(r, data, size, elapsed > 0 ? (uint64_t)elapsed / 1000 : 0);
+}
+
+int sixel_recorder_write_at(SixelRecorder* r, const char* data, size_t size, uint64_t time_us) {
+    if (r->fp == NULL || size > UINT32_MAX) {
+        return 0;
+    }
+
+    uint8_t header[12];
+    capture_put(header, time_us, 8);
+    capture_put(header + 8, size, 4);
+    fwrite(header, 1, sizeof(header), r->fp);
+    fwrite(data, 1, size, r->fp);
+
+    r->index.push_back({ r->offset + sizeof(header), time_us, (uint32_t)size });
+    r->offset += sizeof(header) + size;
+    return !ferror(r->fp);
+}
+
+int sixel_recorder_close(SixelRecorder* r) {
+    if (r->fp == NULL) {
+        return 1;
+    }
+
+    for (const SixelCaptureEntry& e : r->index) {
+        uint8_t entry[20];
+        capture_put(entry, e.offset, 8);
+        capture_put(entry + 8, e.time_us, 8);
+        capture_put(entry + 16, e.size, 4);
+        fwrite(entry, 1, sizeof(entry), r->fp);
+    }
+
+    uint8_t footer[16];
+    capture_put(footer, r->offset, 8);
+    capture_put(footer + 8, r->index.size(), 4);
+    memcpy(footer + 12, "SCPE", 4);
+    fwrite(footer, 1, sizeof(footer), r->fp);
+
+    const int ok = !ferror(r->fp);
+    fclose(r->fp);
+    r->fp = NULL;
+    r->index.clear();
+    return ok;
+}
+
+static int capture_read_index(SixelCapture* c, uint64_t file_size) {
+    uint8_t footer[16];
+    if (file_size < 32 || capture_seek(c->fp, (int64_t)file_size - 16, SEEK_SET) != 0 ||
+        fread(footer, 1, 16, c->fp) != 16 || memcmp(footer + 12, "SCPE", 4) != 0) {
+        return 0;
+    }
+
+    const uint64_t index_offset = capture_get(footer, 8);
+    const uint32_t count = (uint32_t)capture_get(footer + 8, 4);
+    if (index_offset + (uint64_t)count * 20 + 16 != file_size ||
+        capture_seek(c->fp, (int64_t)index_offset, SEEK_SET) != 0) {
+        return 0;
+    }
+
+    std::vector<uint8_t> raw((size_t)count * 20);
+    if (fread(raw.data(), 1, raw.size(), c->fp) != raw.size()) {
+        return 0;
+    }
+    c->index.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* e = &raw[(size_t)i * 20];
+        c->index[i] = { capture_get(e, 8), capture_get(e + 8, 8), (uint32_t)capture_get(e + 16, 4) };
+        if (c->index[i].offset + c->index[i].size > index_offset) {
+            c->index.clear();
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// unfinished recording: walk the frame headers, dropping a truncated last frame
+static void capture_scan_frames(SixelCapture* c, uint64_t file_size) {
+    c->index.clear();
+    uint64_t offset = 16;
+    uint8_t header[12];
+    while (capture_seek(c->fp, (int64_t)offset, SEEK_SET) == 0 && fread(header, 1, 12, c->fp) == 12) {
+        const SixelCaptureEntry e = { offset + 12, capture_get(header, 8), (uint32_t)capture_get(header + 8, 4) };
+        if (e.offset + e.size > file_size) break;
+        c->index.push_back(e);
+        offset = e.offset + e.size;
+    }
+}
+
+int sixel_capture_open(SixelCapture* c, const char* path) {
+    c->fp = fopen(path, "rb");
+    c->index.clear();
+    if (c->fp == NULL) {
+        return 0;
+    }
+
+    uint8_t header[16];
+    if (fread(header, 1, 16, c->fp) != 16 || memcmp(header, "SCAP", 4) != 0 ||
+        capture_get(header + 4, 4) != SIXEL_CAPTURE_VERSION) {
+        fclose(c->fp);
+        c->fp = NULL;
+        return 0;
+    }
+    c->width = (int)capture_get(header + 8, 4);
+    c->height = (int)capture_get(header + 12, 4);
+
+    capture_seek(c->fp, 0, SEEK_END);
+    const uint64_t file_size = (uint64_t)capture_tell(c->fp);
+    c->complete = capture_read_index(c, file_size);
+    if (!c->complete) {
+        capture_scan_frames(c, file_size);
+    }
+    return 1;
+}
+
+int sixel_capture_read_frame(SixelCapture* c, size_t frame, std::string* out) {
+    if (frame >= c->index.size()) {
+        return 0;
+    }
+    const SixelCaptureEntry& e = c->index[frame];
+    out->resize(e.size);
+    return capture_seek(c->fp, (int64_t)e.offset, SEEK_SET) == 0 &&
+           fread(out->data(), 1, e.size, c->fp) == e.size;
+}
+
+size_t sixel_capture_find_time(const SixelCapture* c, uint64_t time_us) {
+    size_t lo = 0, hi = c->index.size();
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (c->index[mid].time_us < time_us) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void sixel_capture_close(SixelCapture* c) {
+    if (c->fp != NULL) {
+        fclose(c->fp);
+        c->fp = NULL;
+    }
+    c->index.clear();
+}
+
+#endif // SIXEL_CAPTURE_IMPLEMENTATION
@@ -0,0 +1,323 @@
+// sixel_decode.h - streaming sixel decoder
+//
+// Single-header library: define SIXEL_DECODE_IMPLEMENTATION in exactly one
+// translation unit before including it.
+//
+// Bytes are fed in arbitrary chunks; anything outside a DCS ... q sequence
+// (cursor movement, text) is skipped. Decoding renders register indices into
+// a growable buffer, so the output can be compared against the encoder's
+// quantized input exactly, or expanded to RGB with sixel_decoder_to_rgb.
+//
+// Supported: DCS P1;P2;P3 q introducer (P2 == 1 marks the image transparent),
+// "Pan;Pad;Ph;Pv raster attributes, #Pc color selection, #Pc;Pu;Px;Py;Pz
+// definitions in RGB (Pu = 2) and HLS (Pu = 1), !Pn repeats, $ and -.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIXEL_DECODE_MAX_REGISTERS 1024
+#define SIXEL_DECODE_MAX_PARAMS    8
+#define SIXEL_DECODE_UNSET         0xFFFF
+
+typedef struct {
+    // image
+    int width, height;                // extent painted so far (or raster size if larger)
+    int raster_width, raster_height;  // from raster attributes, 0 if absent
+    int transparent;                  // P2 == 1: unset pixels keep what was underneath
+    int stride, rows;                 // allocated size of 'pixels'
+    uint16_t *pixels;                 // register per pixel or SIXEL_DECODE_UNSET
+    uint8_t registers[SIXEL_DECODE_MAX_REGISTERS][3];
+
+    // parser
+    int state;
+    int params[SIXEL_DECODE_MAX_PARAMS];
+    int param_count;
+    int x, y;
+    int color;
+    int repeat;
+    int done;                         // set once the terminating ST has been consumed
+    int error;                        // allocation failure or image exceeding the size limit
+} SixelDecoder;
+
+void sixel_decoder_init(SixelDecoder *d);
+void sixel_decoder_free(SixelDecoder *d);
+// prepare for the next image while keeping the pixel allocation
+void sixel_decoder_reset(SixelDecoder *d);
+// returns the number of bytes consumed; stops right after the ST ending an image
+size_t sixel_decoder_feed(SixelDecoder *d, const char *data, size_t len);
+// expand to 'channels' (3 or 4) bytes per pixel, unset pixels get 'background'
+void sixel_decoder_to_rgb(const SixelDecoder *d, uint8_t *out, int channels, const uint8_t background[3]);
+
+#ifdef SIXEL_DECODE_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SIXEL_DECODE_MAX_SIZE 16384
+
+enum {
+    SD_GROUND = 0,
+    SD_ESC,
+    SD_DCS_PARAMS,
+    SD_DCS_IGNORE,
+    SD_DCS_IGNORE_ESC,
+    SD_DATA,
+    SD_DATA_ESC,
+    SD_REPEAT,
+    SD_COLOR,
+    SD_RASTER
+};
+
+static uint8_t sd_percent(int p) {
+    if (p < 0) p = 0;
+    if (p > 100) p = 100;
+    return (uint8_t)((p * 255 + 50) / 100);
+}
+
+static int sd_hue_to_rgb(int m1, int m2, int h) {
+    // m1, m2 in 0..100, h in degrees
+    h = ((h % 360) + 360) % 360;
+    if (h < 60)  return m1 + (m2 - m1) * h / 60;
+    if (h < 180) return m2;
+    if (h < 240) return m1 + (m2 - m1) * (240 - h) / 60;
+    return m1;
+}
+
+static void sd_define_color(SixelDecoder *d) {
+    const int reg = d->params[0];
+    if (reg < 0 || reg >= SIXEL_DECODE_MAX_REGISTERS) return;
+
+    const int pu = d->params[1];
+    const int px = d->params[2], py = d->params[3], pz = d->params[4];
+    uint8_t *c = d->registers[reg];
+    if (pu == 2) {
+        c[0] = sd_percent(px);
+        c[1] = sd_percent(py);
+        c[2] = sd_percent(pz);
+    }
+    else if (pu == 1) {
+        // DEC HLS: hue 0 is blue, lightness and saturation in percent
+        const int l = py, s = pz;
+        const int m2 = l <= 50 ? l * (100 + s) / 100 : l + s - l * s / 100;
+        const int m1 = 2 * l - m2;
+        const int h = px - 120;
+        c[0] = sd_percent(s == 0 ? l : sd_hue_to_rgb(m1, m2, h + 120));
+        c[1] = sd_percent(s == 0 ? l : sd_hue_to_rgb(m1, m2, h));
+        c[2] = sd_percent(s == 0 ? l : sd_hue_to_rgb(m1, m2, h - 120));
+    }
+}
+
+static int sd_reserve(SixelDecoder *d, int width, int height) {
+    if (width <= d->stride && height <= d->rows) return 1;
+    if (width > SIXEL_DECODE_MAX_SIZE || height > SIXEL_DECODE_MAX_SIZE) {
+        d->error = 1;
+        return 0;
+    }
+
+    int stride = d->stride ? d->stride : 256;
+    int rows = d->rows ? d->rows : 240;
+    while (stride < width) stride *= 2;
+    while (rows < height) rows *= 2;
+
+    uint16_t *pixels = (uint16_t *)malloc((size_t)stride * rows * sizeof(uint16_t));
+    if (pixels == NULL) {
+        d->error = 1;
+        return 0;
+    }
+    memset(pixels, 0xFF, (size_t)stride * rows * sizeof(uint16_t));
+    for (int y = 0; y < d->rows && y < d->height; y++) {
+        memcpy(pixels + (size_t)y * stride, d->pixels + (size_t)y * d->stride, (size_t)d->width * sizeof(uint16_t));
+    }
+    free(d->pixels);
+    d->pixels = pixels;
+    d->stride = stride;
+    d->rows = rows;
+    return 1;
+}
+
+static void sd_sixel(SixelDecoder *d, int bits, int count) {
+    if (count <= 0) count = 1;
+    const int x1 = d->x + count;
+    if (bits != 0) {
+        if (!sd_reserve(d, x1, d->y + 6)) return;
+        const uint16_t color = (uint16_t)d->color;
+        for (int dy = 0; dy < 6; dy++) {
+            if ((bits >> dy) & 1) {
+                uint16_t *row = d->pixels + (size_t)(d->y + dy) * d->stride;
+                for (int x = d->x; x < x1; x++) {
+                    row[x] = color;
+                }
+                if (d->y + dy + 1 > d->height) d->height = d->y + dy + 1;
+            }
+        }
+        if (x1 > d->width) d->width = x1;
+    }
+    d->x = x1;
+}
+
+static void sd_begin_params(SixelDecoder *d, int state) {
+    d->state = state;
+    d->param_count = 1;
+    memset(d->params, 0, sizeof(d->params));
+}
+
+static void sd_param_char(SixelDecoder *d, char ch) {
+    if (ch >= '0' && ch <= '9') {
+        int *p = &d->params[d->param_count - 1];
+        if (*p < 100000) *p = *p * 10 + (ch - '0');
+    }
+    else if (ch == ';' && d->param_count < SIXEL_DECODE_MAX_PARAMS) {
+        ++d->param_count;
+    }
+}
+
+static void sd_finish_params(SixelDecoder *d) {
+    if (d->state == SD_COLOR) {
+        if (d->param_count >= 5) {
+            sd_define_color(d);
+        }
+        const int reg = d->params[0];
+        d->color = reg >= 0 && reg < SIXEL_DECODE_MAX_REGISTERS ? reg : 0;
+    }
+    else if (d->state == SD_RASTER) {
+        if (d->param_count >= 4) {
+            d->raster_width = d->params[2];
+            d->raster_height = d->params[3];
+            if (sd_reserve(d, d->raster_width, d->raster_height)) {
+                if (d->raster_width > d->width) d->width = d->raster_width;
+                if (d->raster_height > d->height) d->height = d->raster_height;
+            }
+        }
+    }
+    else if (d->state == SD_REPEAT) {
+        d->repeat = d->params[0];
+    }
+    d->state = SD_DATA;
+}
+
+void sixel_decoder_init(SixelDecoder *d) {
+    memset(d, 0, sizeof(*d));
+}
+
+void sixel_decoder_free(SixelDecoder *d) {
+    free(d->pixels);
+    memset(d, 0, sizeof(*d));
+}
+
+void sixel_decoder_reset(SixelDecoder *d) {
+    if (d->pixels != NULL) {
+        memset(d->pixels, 0xFF, (size_t)d->stride * d->rows * sizeof(uint16_t));
+    }
+    d->width = d->height = 0;
+    d->raster_width = d->raster_height = 0;
+    d->transparent = 0;
+    d->state = SD_GROUND;
+    d->x = d->y = 0;
+    d->color = 0;
+    d->repeat = 0;
+    d->done = 0;
+    d->error = 0;
+}
+
+size_t sixel_decoder_feed(SixelDecoder *d, const char *data, size_t len) {
+    size_t i = 0;
+    while (i < len && !d->done) {
+        const char ch = data[i++];
+        switch (d->state) {
+        case SD_GROUND:
+            if (ch == 0x1b) d->state = SD_ESC;
+            else if ((uint8_t)ch == 0x90) sd_begin_params(d, SD_DCS_PARAMS);
+            break;
+        case SD_ESC:
+            if (ch == 'P') sd_begin_params(d, SD_DCS_PARAMS);
+            else d->state = ch == 0x1b ? SD_ESC : SD_GROUND;
+            break;
+        case SD_DCS_PARAMS:
+            if ((ch >= '0' && ch <= '9') || ch == ';') {
+                sd_param_char(d, ch);
+            }
+            else if (ch == 'q') {
+                d->transparent = d->param_count >= 2 && d->params[1] == 1;
+                d->state = SD_DATA;
+            }
+            else {
+                // some other device control string
+                d->state = SD_DCS_IGNORE;
+            }
+            break;
+        case SD_DCS_IGNORE:
+            if (ch == 0x1b) d->state = SD_DCS_IGNORE_ESC;
+            else if ((uint8_t)ch == 0x9c) d->state = SD_GROUND;
+            break;
+        case SD_DCS_IGNORE_ESC:
+            d->state = ch == '\\' ? SD_GROUND : SD_DCS_IGNORE;
+            break;
+        case SD_REPEAT:
+        case SD_COLOR:
+        case SD_RASTER:
+            if ((ch >= '0' && ch <= '9') || ch == ';') {
+                sd_param_char(d, ch);
+                break;
+            }
+            sd_finish_params(d);
+            --i; // reprocess as data
+            break;
+        case SD_DATA:
+            if (ch >= '?' && ch <= '~') {
+                sd_sixel(d, ch - '?', d->repeat);
+                d->repeat = 0;
+            }
+            else if (ch == '!') {
+                sd_begin_params(d, SD_REPEAT);
+            }
+            else if (ch == '#') {
+                sd_begin_params(d, SD_COLOR);
+            }
+            else if (ch == '"') {
+                sd_begin_params(d, SD_RASTER);
+            }
+            else if (ch == '$') {
+                d->x = 0;
+            }
+            else if (ch == '-') {
+                d->x = 0;
+                d->y += 6;
+            }
+            else if (ch == 0x1b) {
+                d->state = SD_DATA_ESC;
+            }
+            else if ((uint8_t)ch == 0x9c) {
+                d->state = SD_GROUND;
+                d->done = 1;
+            }
+            break;
+        case SD_DATA_ESC:
+            // ESC \ is the string terminator; any other escape sequence also ends the image
+            d->state = SD_GROUND;
+            d->done = 1;
+            break;
+        }
+    }
+    return i;
+}
+
+void sixel_decoder_to_rgb(const SixelDecoder *d, uint8_t *out, int channels, const uint8_t background[3]) {
+    for (int y = 0; y < d->height; y++) {
+        const uint16_t *row = d->pixels + (size_t)y * d->stride;
+        for (int x = 0; x < d->width; x++) {
+            const uint16_t reg = row[x];
+            const uint8_t *c = reg == SIXEL_DECODE_UNSET ? background : d->registers[reg];
+            uint8_t *p = out + ((size_t)y * d->width + x) * channels;
+            p[0] = c[0];
+            p[1] = c[1];
+            p[2] = c[2];
+            if (channels == 4) {
+                p[3] = reg == SIXEL_DECODE_UNSET && d->transparent ? 0 : 255;
+            }
+        }
+    }
+}
+
+#endif // SIXEL_DECODE_IMPLEMENTATION
@@ -0,0 +1,759 @@
+// term_probe.h - ask the terminal what it can display before the first frame
+//
+// Single-header library: define TERM_PROBE_IMPLEMENTATION in exactly one
+// translation unit before including it.
+//
+// All queries go out in one write and end with DA1 (CSI c). Terminals answer
+// in order and every one of them answers DA1, so once its reply is in,
+// anything still missing is unsupported and no timeout has to expire:
+//   ESC _ G i=31,a=q,...  kitty graphics query, answered "ESC _ G i=31;OK"
+//   CSI ? 1 ; 1 ; 0 S     XTSMGRAPHICS, number of sixel color registers
+//   CSI 14 t, 16 t, 18 t  text area in pixels, cell size, text area in cells
+//   OSC 11 ; ? ST         background color, answered "OSC 11 ; rgb:RRRR/GGGG/BBBB"
+//   CSI > 0 q             XTVERSION, answered "DCS > | name(version) ST"
+//   CSI > c               DA2, terminal type, version and ROM cartridge number
+//   CSI c                 DA1, attribute 4 means sixel
+// Results are cached at two levels. Per session, keyed on the environment and
+// the tty (checked against the tty's change time, which moves when the pty is
+// handed to a new terminal, or $WT_SESSION on Windows), everything including
+// the background color is kept, so later runs in the same window send nothing
+// at all and take the size from the tty driver. Per terminal, keyed on $TERM,
+// $TERM_PROGRAM[_VERSION] and the XTVERSION, DA2 and DA1 replies (xterm,
+// Konsole and GNOME Terminal all say TERM=xterm-256color), only the
+// capabilities are kept, so a new window asks for the geometry and identity
+// and then for the capabilities only if that terminal is new. Sixel support
+// always comes from a DA1 reply of the same session.
+//
+// term_probe_io works on a pair of callbacks, which lets a pty stand in for
+// the terminal; term_probe_console wires it to the real console. Defining
+// TERM_PROBE_SELF_TEST as well adds term_probe_self_test, which wires it to
+// scripted replies.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#define TERM_PROBE_CAPS     1  // graphics support and color registers
+#define TERM_PROBE_GEOMETRY 2  // window and cell sizes, background color
+#define TERM_PROBE_IDENTITY 4  // XTVERSION and DA2, for the cache key
+#define TERM_PROBE_TIMEOUT  500
+
+typedef struct {
+    int answered;                     // got the DA1 reply, everything below is trustworthy
+    int sixel;                        // DA1 lists attribute 4
+    int kitty;                        // kitty graphics query answered OK
+    int color_registers;              // from XTSMGRAPHICS, 0 if unknown
+    int cell_width, cell_height;      // pixels, 0 if unknown
+    int window_width, window_height;  // text area in pixels, 0 if unknown
+    int cols, rows;                   // text area in cells, 0 if unknown
+    int has_background;
+    uint32_t background;              // 0xRRGGBB
+    char version[64];                 // XTVERSION reply, "" if unanswered
+    char da2[32], da1[64];            // their parameters as received, "" if unanswered
+    int from_cache;
+} TermCaps;
+
+typedef struct {
+    // both return the number of bytes transferred, or < 0 on error;
+    // read returns 0 once 'timeout_ms' passed without input
+    int (*write)(void* ctx, const char* data, size_t size);
+    int (*read)(void* ctx, char* data, size_t size, int timeout_ms);
+    void* ctx;
+} TermIO;
+
+// sends the queries selected by 'what' and parses replies until DA1 or the timeout
+int term_probe_io(const TermIO* io, int what, TermCaps* caps, int timeout_ms);
+// probes stdin/stdout, using the cache unless 'refresh' is set; returns 0
+// without writing anything if they are not a terminal
+int term_probe_console(TermCaps* caps, int refresh);
+// the session's cached results and the tty's current size, without writing or
+// reading anything; returns 0 if this session hasn't been probed yet
+int term_probe_cached(TermCaps* caps);
+// cache key of the current terminal, from the environment and the identity
+// replies in 'caps'
+std::string term_probe_cache_key(const TermCaps* caps);
+#ifdef TERM_PROBE_SELF_TEST
+// runs term_probe_io against scripted terminals, split replies, garbage and
+// timeouts; prints every failed check to 'log' and returns how many failed
+int term_probe_self_test(FILE* log);
+#endif
+
+#ifdef TERM_PROBE_IMPLEMENTATION
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <filesystem>
+#ifdef _WIN32
+# include <windows.h>
+# include <io.h>
+# include <direct.h>
+# include <process.h>
+#else
+# include <poll.h>
+# include <termios.h>
+# include <unistd.h>
+# include <sys/ioctl.h>
+# include <sys/stat.h>
+#endif
+
+#define TERM_PROBE_KITTY_QUERY "\x1b_Gi=31,s=1,v=1,a=q,t=d,f=24;AAAA\x1b\\"
+
+static int term_probe_params(const std::string& s, size_t start, size_t end, int* params, int max) {
+    int count = 0;
+    int value = 0;
+    bool any = false;
+    for (size_t i = start; i < end; i++) {
+        const char ch = s[i];
+        if (ch >= '0' && ch <= '9') {
+            value = value * 10 + (ch - '0');
+            any = true;
+        }
+        else if (ch == ';') {
+            if (count < max) params[count++] = value;
+            value = 0;
+        }
+    }
+    if ((any || count > 0) && count < max) params[count++] = value;
+    return count;
+}
+
+// "11;rgb:RRRR/GGGG/BBBB", each component one to four hex digits
+static void term_probe_parse_color(const std::string& s, size_t start, size_t end, TermCaps* caps) {
+    if (s.compare(start, 7, "11;rgb:") != 0) return;
+    uint32_t color = 0;
+    size_t i = start + 7;
+    for (int component = 0; component < 3; component++) {
+        uint32_t value = 0, max = 0;
+        for (; i < end && isxdigit((unsigned char)s[i]) && max < 0xFFFF; i++) {
+            const char ch = s[i];
+            value = value * 16 + (ch <= '9' ? ch - '0' : (ch | 0x20) - 'a' + 10);
+            max = max * 16 + 15;
+        }
+        if (max == 0) return;
+        color = (color << 8) | (value * 255 + max / 2) / max;
+        if (component < 2) {
+            if (i >= end || s[i] != '/') return;
+            i++;
+        }
+    }
+    caps->background = color;
+    caps->has_background = 1;
+}
+
+// copies s[start, end) into a fixed size field, cut short if it doesn't fit
+static void term_probe_copy(char* dst, size_t size, const std::string& s, size_t start, size_t end) {
+    size_t n = end - start;
+    if (n >= size) n = size - 1;
+    memcpy(dst, s.data() + start, n);
+    dst[n] = '\0';
+}
+
+// consumes every complete reply in 'buf'; returns 1 once DA1 has been seen
+static int term_probe_parse(std::string* buf, TermCaps* caps) {
+    int da1 = 0;
+    size_t i = 0;
+    size_t partial = std::string::npos;  // start of an incomplete reply
+    while ((i = buf->find('\x1b', i)) != std::string::npos) {
+        if (i + 1 >= buf->size()) {
+            partial = i;
+            break;
+        }
+
+        if ((*buf)[i + 1] == '[') {
+            // CSI: parameter bytes up to the final byte
+            size_t end = i + 2;
+            while (end < buf->size() && ((*buf)[end] < 0x40 || (*buf)[end] > 0x7e)) end++;
+            if (end >= buf->size()) {
+                partial = i;
+                break;
+            }
+
+            const char final_byte = (*buf)[end];
+            const bool private_marker = i + 2 < end && (*buf)[i + 2] == '?';
+            const bool da2_marker = i + 2 < end && (*buf)[i + 2] == '>';
+            int p[16];
+            const int n = term_probe_params(*buf, i + 2, end, p, 16);
+            if (final_byte == 'c' && private_marker) {
+                // recomputed from every reply, never kept from an earlier one
+                da1 = 1;
+                caps->sixel = 0;
+                for (int k = 1; k < n; k++) {
+                    if (p[k] == 4) caps->sixel = 1;
+                }
+                term_probe_copy(caps->da1, sizeof(caps->da1), *buf, i + 3, end);
+            }
+            else if (final_byte == 'c' && da2_marker) {
+                term_probe_copy(caps->da2, sizeof(caps->da2), *buf, i + 3, end);
+            }
+            else if (final_byte == 'S' && private_marker && n >= 3 && p[0] == 1 && p[1] == 0) {
+                caps->color_registers = p[2];
+            }
+            else if (final_byte == 't' && n >= 3) {
+                if (p[0] == 4) { caps->window_height = p[1]; caps->window_width = p[2]; }
+                if (p[0] == 6) { caps->cell_height = p[1]; caps->cell_width = p[2]; }
+                if (p[0] == 8) { caps->rows = p[1]; caps->cols = p[2]; }
+            }
+            i = end + 1;
+        }
+        else if ((*buf)[i + 1] == ']') {
+            // OSC up to BEL or ST
+            size_t end = i + 2;
+            while (end < buf->size() && (*buf)[end] != '\a' && (*buf)[end] != '\x1b') end++;
+            if (end >= buf->size() || ((*buf)[end] == '\x1b' && end + 1 >= buf->size())) {
+                partial = i;
+                break;
+            }
+            term_probe_parse_color(*buf, i + 2, end, caps);
+            i = end + ((*buf)[end] == '\a' ? 1 : 2);
+        }
+        else if ((*buf)[i + 1] == 'P') {
+            // DCS up to ST
+            const size_t end = buf->find("\x1b\\", i + 2);
+            if (end == std::string::npos) {
+                partial = i;
+                break;
+            }
+            if (buf->compare(i + 2, 2, ">|") == 0) {
+                term_probe_copy(caps->version, sizeof(caps->version), *buf, i + 4, end);
+            }
+            i = end + 2;
+        }
+        else if ((*buf)[i + 1] == '_') {
+            // APC up to ST
+            const size_t end = buf->find("\x1b\\", i + 2);
+            if (end == std::string::npos) {
+                partial = i;
+                break;
+            }
+            const std::string body = buf->substr(i + 2, end - i - 2);
+            if (body.compare(0, 6, "Gi=31;") == 0 && body.compare(6, 2, "OK") == 0) {
+                caps->kitty = 1;
+            }
+            i = end + 2;
+        }
+        else {
+            i++;
+        }
+    }
+    // keep a partial reply for the next read
+    if (partial != std::string::npos) buf->erase(0, partial);
+    else buf->clear();
+    return da1;
+}
+
+int term_probe_io(const TermIO* io, int what, TermCaps* caps, int timeout_ms) {
+    std::string query;
+    if (what & TERM_PROBE_CAPS) {
+        query += TERM_PROBE_KITTY_QUERY;
+        query += "\x1b[?1;1;0S";
+    }
+    if (what & TERM_PROBE_GEOMETRY) {
+        query += "\x1b[14t\x1b[16t\x1b[18t\x1b]11;?\x1b\\";
+    }
+    if (what & TERM_PROBE_IDENTITY) {
+        query += "\x1b[>0q\x1b[>c";
+    }
+    query += "\x1b[c";
+    if (io->write(io->ctx, query.data(), query.size()) != (int)query.size()) {
+        return 0;
+    }
+
+    using clock = std::chrono::steady_clock;
+    const clock::time_point deadline = clock::now() + std::chrono::milliseconds(timeout_ms);
+    std::string buf;
+    char chunk[256];
+    while (true) {
+        const int left = (int)std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now()).count();
+        if (left <= 0) break;
+        const int n = io->read(io->ctx, chunk, sizeof(chunk), left);
+        if (n < 0) break;
+        buf.append(chunk, n);
+        if (term_probe_parse(&buf, caps)) {
+            caps->answered = 1;
+            break;
+        }
+    }
+    return caps->answered;
+}
+
+static std::string term_probe_env_key() {
+    std::string key;
+    const char* vars[] = { "TERM", "TERM_PROGRAM", "TERM_PROGRAM_VERSION" };
+    for (const char* var : vars) {
+        const char* value = getenv(var);
+        key += var;
+        key += '=';
+        key += value ? value : "";
+        key += ';';
+    }
+#ifdef _WIN32
+    // Windows Terminal sets no TERM but identifies itself this way
+    if (getenv("WT_SESSION") != NULL) key += "WT;";
+#endif
+    for (char& ch : key) {
+        if (ch == '\t' || ch == '\n') ch = ' ';
+    }
+    return key;
+}
+
+std::string term_probe_cache_key(const TermCaps* caps) {
+    std::string key = term_probe_env_key() + "XTVERSION=" + caps->version + ";DA2=" + caps->da2 +
+                      ";DA1=" + caps->da1 + ";";
+    for (char& ch : key) {
+        if (ch == '\t' || ch == '\n') ch = ' ';
+    }
+    return key;
+}
+
+// key of the current session and the stamp its entry must carry; empty if
+// there is nothing that tells this window apart from the next one
+static std::string term_probe_session_key(long long* stamp) {
+    *stamp = 0;
+#ifdef _WIN32
+    // a new GUID for every Windows Terminal tab
+    const char* session = getenv("WT_SESSION");
+    if (session == NULL) return std::string();
+    return "WT_SESSION=" + std::string(session) + ";" + term_probe_env_key();
+#else
+    const char* tty = ttyname(STDOUT_FILENO);
+    struct stat st;
+    if (tty == NULL || stat(tty, &st) != 0) return std::string();
+    // a pty's change time is set when a terminal opens it and stays put after
+#ifdef __APPLE__
+    *stamp = (long long)st.st_ctimespec.tv_sec * 1000000000 + st.st_ctimespec.tv_nsec;
+#else
+    *stamp = (long long)st.st_ctim.tv_sec * 1000000000 + st.st_ctim.tv_nsec;
+#endif
+    return "TTY=" + std::string(tty) + ";" + term_probe_env_key();
+#endif
+}
+
+static std::string term_probe_cache_path(bool create_dir) {
+#ifdef _WIN32
+    const char* base = getenv("LOCALAPPDATA");
+    if (base == NULL) return std::string();
+    std::string dir = std::string(base) + "\\hello_sixel";
+    if (create_dir) _mkdir(dir.c_str());
+    return dir + "\\termcaps";
+#else
+    std::string dir;
+    if (const char* xdg = getenv("XDG_CACHE_HOME")) dir = xdg;
+    else if (const char* home = getenv("HOME")) dir = std::string(home) + "/.cache";
+    else return std::string();
+    if (create_dir) mkdir(dir.c_str(), 0755);
+    dir += "/hello_sixel";
+    if (create_dir) mkdir(dir.c_str(), 0755);
+    return dir + "/termcaps";
+#endif
+}
+
+// one line per terminal or session: key, tab, sixel kitty registers cell_width
+// cell_height has_background background stamp. the last three are missing
+// from lines written before sessions were cached
+static int term_probe_cache_load(const std::string& key, TermCaps* entry, long long* stamp) {
+    const std::string path = term_probe_cache_path(false);
+    FILE* fp = path.empty() ? NULL : fopen(path.c_str(), "r");
+    if (fp == NULL) return 0;
+
+    int found = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        char* tab = strchr(line, '\t');
+        if (tab == NULL || key.compare(0, std::string::npos, line, tab - line) != 0) continue;
+        TermCaps c = {};
+        long long s = 0;
+        if (sscanf(tab + 1, "%d %d %d %d %d %d %x %lld", &c.sixel, &c.kitty, &c.color_registers,
+                   &c.cell_width, &c.cell_height, &c.has_background, &c.background, &s) >= 5) {
+            *entry = c;
+            *stamp = s;
+            found = 1;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+static void term_probe_cache_save(const std::string& key, const TermCaps* caps, long long stamp) {
+    const std::string path = term_probe_cache_path(true);
+    if (path.empty()) return;
+
+    // rewrite the file without the old entry for this terminal
+    std::string contents;
+    if (FILE* fp = fopen(path.c_str(), "r")) {
+        char line[1024];
+        while (fgets(line, sizeof(line), fp)) {
+            const char* tab = strchr(line, '\t');
+            if (tab != NULL && key.compare(0, std::string::npos, line, tab - line) == 0) continue;
+            contents += line;
+        }
+        fclose(fp);
+    }
+    // written under a name of this process's own and renamed over the cache,
+    // so frontends starting together never interleave into one file. the last
+    // rename wins, an entry lost that way is only probed again next time
+#ifdef _WIN32
+    const std::string tmp_path = path + "." + std::to_string(_getpid()) + ".tmp";
+#else
+    const std::string tmp_path = path + "." + std::to_string((int)getpid()) + ".tmp";
+#endif
+    FILE* fp = fopen(tmp_path.c_str(), "w");
+    if (fp == NULL) return;
+    fputs(contents.c_str(), fp);
+    fprintf(fp, "%s\t%d %d %d %d %d %d %06x %lld\n", key.c_str(), caps->sixel, caps->kitty,
+            caps->color_registers, caps->cell_width, caps->cell_height, caps->has_background,
+            (unsigned)caps->background, stamp);
+    std::error_code ec;
+    if (fclose(fp) != 0) {
+        std::filesystem::remove(tmp_path, ec);
+        return;
+    }
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) std::filesystem::remove(tmp_path, ec);
+}
+
+#ifdef _WIN32
+static int term_probe_console_write(void* ctx, const char* data, size_t size) {
+    (void)ctx;
+    DWORD written = 0;
+    if (!WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), data, (DWORD)size, &written, NULL)) return -1;
+    return (int)written;
+}
+
+static int term_probe_console_read(void* ctx, char* data, size_t size, int timeout_ms) {
+    (void)ctx;
+    HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
+    if (WaitForSingleObject(in, (DWORD)timeout_ms) != WAIT_OBJECT_0) return 0;
+    // with ENABLE_VIRTUAL_TERMINAL_INPUT replies arrive as key events
+    INPUT_RECORD records[64];
+    DWORD count = 0;
+    if (!ReadConsoleInputA(in, records, size < 64 ? (DWORD)size : 64, &count)) return -1;
+    int n = 0;
+    for (DWORD i = 0; i < count; i++) {
+        const KEY_EVENT_RECORD& key = records[i].Event.KeyEvent;
+        if (records[i].EventType == KEY_EVENT && key.bKeyDown && key.uChar.AsciiChar != 0) {
+            data[n++] = key.uChar.AsciiChar;
+        }
+    }
+    return n;
+}
+#else
+static int term_probe_console_write(void* ctx, const char* data, size_t size) {
+    (void)ctx;
+    return (int)write(STDOUT_FILENO, data, size);
+}
+
+static int term_probe_console_read(void* ctx, char* data, size_t size, int timeout_ms) {
+    (void)ctx;
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    const int ready = poll(&pfd, 1, timeout_ms);
+    if (ready <= 0) return ready;
+    return (int)read(STDIN_FILENO, data, size);
+}
+#endif
+
+// the text area from the tty driver, which knows its size in cells and often
+// in pixels too; the cached cell size fills in for the rest
+static void term_probe_winsize(TermCaps* caps) {
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (!GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) return;
+    caps->cols = info.srWindow.Right - info.srWindow.Left + 1;
+    caps->rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+    caps->window_width = caps->window_height = 0;
+#else
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0 || ws.ws_col == 0 || ws.ws_row == 0) return;
+    caps->cols = ws.ws_col;
+    caps->rows = ws.ws_row;
+    caps->window_width = ws.ws_xpixel;
+    caps->window_height = ws.ws_ypixel;
+    if (ws.ws_xpixel > 0 && ws.ws_ypixel > 0) {
+        caps->cell_width = ws.ws_xpixel / ws.ws_col;
+        caps->cell_height = ws.ws_ypixel / ws.ws_row;
+    }
+#endif
+    if (caps->window_width <= 0 || caps->window_height <= 0) {
+        caps->window_width = caps->cols * caps->cell_width;
+        caps->window_height = caps->rows * caps->cell_height;
+    }
+}
+
+int term_probe_cached(TermCaps* caps) {
+    memset(caps, 0, sizeof(*caps));
+#ifdef _WIN32
+    if (!_isatty(_fileno(stdin)) || !_isatty(_fileno(stdout))) return 0;
+#else
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) return 0;
+#endif
+    long long stamp, saved = 0;
+    const std::string key = term_probe_session_key(&stamp);
+    if (key.empty() || !term_probe_cache_load(key, caps, &saved) || saved != stamp) {
+        memset(caps, 0, sizeof(*caps));
+        return 0;
+    }
+    caps->from_cache = 1;
+    term_probe_winsize(caps);
+    return 1;
+}
+
+// asks for the geometry and identity, then for the capabilities only if the
+// terminal is known; everything in one go when refreshing
+static void term_probe_run(const TermIO* io, TermCaps* caps, int refresh) {
+    if (refresh) {
+        term_probe_io(io, TERM_PROBE_CAPS | TERM_PROBE_GEOMETRY | TERM_PROBE_IDENTITY, caps, TERM_PROBE_TIMEOUT);
+        return;
+    }
+    // a terminal that doesn't answer can't be told apart from the others
+    if (!term_probe_io(io, TERM_PROBE_GEOMETRY | TERM_PROBE_IDENTITY, caps, TERM_PROBE_TIMEOUT)) return;
+    TermCaps known;
+    long long stamp;
+    if (term_probe_cache_load(term_probe_cache_key(caps), &known, &stamp)) {
+        caps->kitty = known.kitty;
+        caps->color_registers = known.color_registers;
+        if (caps->cell_width <= 0 || caps->cell_height <= 0) {
+            caps->cell_width = known.cell_width;
+            caps->cell_height = known.cell_height;
+        }
+        caps->from_cache = 1;
+        return;
+    }
+    caps->answered = 0;
+    term_probe_io(io, TERM_PROBE_CAPS, caps, TERM_PROBE_TIMEOUT);
+}
+
+int term_probe_console(TermCaps* caps, int refresh) {
+    if (!refresh && term_probe_cached(caps)) {
+        return 1;
+    }
+    memset(caps, 0, sizeof(*caps));
+
+    const TermIO io = { term_probe_console_write, term_probe_console_read, NULL };
+#ifdef _WIN32
+    HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
+    DWORD old_mode = 0;
+    if (!_isatty(_fileno(stdin)) || !_isatty(_fileno(stdout)) || !GetConsoleMode(in, &old_mode)) {
+        return 0;
+    }
+    fflush(stdout);
+    SetConsoleMode(in, ENABLE_VIRTUAL_TERMINAL_INPUT);
+    FlushConsoleInputBuffer(in);
+    term_probe_run(&io, caps, refresh);
+    SetConsoleMode(in, old_mode);
+#else
+    struct termios old_mode;
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) || tcgetattr(STDIN_FILENO, &old_mode) != 0) {
+        return 0;
+    }
+    fflush(stdout);
+    struct termios raw = old_mode;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    term_probe_run(&io, caps, refresh);
+    // late replies would otherwise end up on the shell's command line
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &old_mode);
+#endif
+
+    if (caps->answered) {
+        if (!caps->from_cache) term_probe_cache_save(term_probe_cache_key(caps), caps, 0);
+        long long stamp;
+        const std::string session = term_probe_session_key(&stamp);
+        if (!session.empty()) term_probe_cache_save(session, caps, stamp);
+    }
+    return caps->answered || caps->from_cache;
+}
+
+#ifdef TERM_PROBE_SELF_TEST
+
+#include <thread>
+#include <vector>
+
+// a terminal that answers with fixed chunks, one per read, and then stays
+// silent until the timeout, or fails the read or write instead
+typedef struct {
+    std::vector<std::string> chunks;
+    size_t next, offset;
+    std::string written;
+    int fail_write, fail_read;
+} TermProbeScript;
+
+static int term_probe_script_write(void* ctx, const char* data, size_t size) {
+    TermProbeScript* script = (TermProbeScript*)ctx;
+    if (script->fail_write) return -1;
+    script->written.append(data, size);
+    return (int)size;
+}
+
+static int term_probe_script_read(void* ctx, char* data, size_t size, int timeout_ms) {
+    TermProbeScript* script = (TermProbeScript*)ctx;
+    if (script->next >= script->chunks.size()) {
+        if (script->fail_read) return -1;
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+        return 0;
+    }
+    const std::string& chunk = script->chunks[script->next];
+    size_t n = chunk.size() - script->offset;
+    if (n > size) n = size;
+    memcpy(data, chunk.data() + script->offset, n);
+    script->offset += n;
+    if (script->offset == chunk.size()) {
+        script->next++;
+        script->offset = 0;
+    }
+    return (int)n;
+}
+
+static int term_probe_script_run(TermProbeScript* script, int what, TermCaps* caps, int timeout_ms) {
+    const TermIO io = { term_probe_script_write, term_probe_script_read, script };
+    memset(caps, 0, sizeof(*caps));
+    return term_probe_io(&io, what, caps, timeout_ms);
+}
+
+int term_probe_self_test(FILE* log) {
+    int failures = 0;
+    const char* test = "";
+    auto check = [&](bool ok, const char* what) {
+        if (!ok) {
+            fprintf(log, "term_probe %s: %s\n", test, what);
+            failures++;
+        }
+    };
+    const int all = TERM_PROBE_CAPS | TERM_PROBE_GEOMETRY | TERM_PROBE_IDENTITY;
+    const int silent_ms = 30;
+    TermCaps caps;
+
+    // xterm with sixel, answering everything; all at once and one byte per read
+    const std::string xterm =
+        "\x1b_Gi=31;OK\x1b\\"
+        "\x1b[?1;0;256S"
+        "\x1b[4;600;800t" "\x1b[6;20;10t" "\x1b[8;30;80t"
+        "\x1b]11;rgb:ffff/8080/0000\x1b\\"
+        "\x1bP>|XTerm(390)\x1b\\"
+        "\x1b[>41;390;0c"
+        "\x1b[?62;4;22c";
+    for (int split = 0; split < 2; split++) {
+        test = split ? "full reply, byte by byte" : "full reply";
+        TermProbeScript script = {};
+        if (split) {
+            for (char ch : xterm) script.chunks.push_back(std::string(1, ch));
+        }
+        else {
+            script.chunks.push_back(xterm);
+        }
+        check(term_probe_script_run(&script, all, &caps, TERM_PROBE_TIMEOUT) == 1, "not answered");
+        check(caps.kitty == 1, "kitty");
+        check(caps.sixel == 1, "sixel");
+        check(caps.color_registers == 256, "XTSMGRAPHICS color registers");
+        check(caps.window_width == 800 && caps.window_height == 600, "CSI 14 t window size");
+        check(caps.cell_width == 10 && caps.cell_height == 20, "CSI 16 t cell size");
+        check(caps.cols == 80 && caps.rows == 30, "CSI 18 t text area");
+        check(caps.has_background && caps.background == 0xFF8000, "OSC 11 background");
+        check(strcmp(caps.version, "XTerm(390)") == 0, "XTVERSION");
+        check(strcmp(caps.da2, "41;390;0") == 0, "DA2");
+        check(strcmp(caps.da1, "62;4;22") == 0, "DA1");
+        check(script.next == script.chunks.size(), "stopped reading before DA1");
+    }
+
+    // the queries follow 'what', and DA1 always goes last
+    test = "queries";
+    {
+        TermProbeScript script = {};
+        script.chunks.push_back("\x1b[?1;2c");
+        term_probe_script_run(&script, TERM_PROBE_CAPS, &caps, TERM_PROBE_TIMEOUT);
+        const std::string& q = script.written;
+        check(q.find("\x1b_G") != std::string::npos && q.find("\x1b[?1;1;0S") != std::string::npos,
+              "caps queries missing");
+        check(q.find("\x1b[14t") == std::string::npos && q.find("\x1b[>c") == std::string::npos,
+              "unasked queries sent");
+        check(q.size() >= 3 && q.compare(q.size() - 3, 3, "\x1b[c") == 0, "DA1 not last");
+
+        script = {};
+        script.chunks.push_back("\x1b[?1;2c");
+        term_probe_script_run(&script, TERM_PROBE_GEOMETRY | TERM_PROBE_IDENTITY, &caps, TERM_PROBE_TIMEOUT);
+        const std::string& g = script.written;
+        check(g.find("\x1b]11;?\x1b\\") != std::string::npos && g.find("\x1b[>0q") != std::string::npos,
+              "geometry or identity queries missing");
+        check(g.find("\x1b_G") == std::string::npos, "unasked kitty query sent");
+    }
+
+    // a VT100-class terminal only knows DA1, and that is enough to stop waiting
+    test = "DA1 only";
+    {
+        TermProbeScript script = {};
+        script.chunks.push_back("\x1b[?1;2c");
+        const auto start = std::chrono::steady_clock::now();
+        check(term_probe_script_run(&script, all, &caps, TERM_PROBE_TIMEOUT) == 1, "not answered");
+        const auto waited = std::chrono::steady_clock::now() - start;
+        check(waited < std::chrono::milliseconds(TERM_PROBE_TIMEOUT / 2), "waited for the timeout");
+        check(!caps.sixel && !caps.kitty && caps.color_registers == 0 && !caps.has_background, "made up capabilities");
+        check(caps.version[0] == '\0' && caps.da2[0] == '\0', "made up identity");
+    }
+
+    // keys typed during the probe, unknown sequences and replies cut at every
+    // awkward place; OSC 11 ends in BEL with two hex digits per component
+    test = "garbage and split replies";
+    {
+        TermProbeScript script = {};
+        script.chunks.push_back("abc\x1b[1;5A\x1b");
+        script.chunks.push_back("]11;rgb:ff/80/00\a\x1bOP\x1b[?1;0;2");
+        script.chunks.push_back("56S\x1bP>|kit");
+        script.chunks.push_back("ty(0.31)\x1b");
+        script.chunks.push_back("\\\x1b[?62;");
+        script.chunks.push_back("4c");
+        check(term_probe_script_run(&script, all, &caps, TERM_PROBE_TIMEOUT) == 1, "not answered");
+        check(caps.sixel == 1, "sixel");
+        check(caps.color_registers == 256, "XTSMGRAPHICS color registers");
+        check(caps.has_background && caps.background == 0xFF8000, "OSC 11 background");
+        check(strcmp(caps.version, "kitty(0.31)") == 0, "XTVERSION");
+    }
+
+    // an OSC 11 reply that isn't a color leaves the background unknown
+    test = "bad color";
+    {
+        TermProbeScript script = {};
+        script.chunks.push_back("\x1b]11;rgb:zz/00/00\x1b\\\x1b[?1;2c");
+        check(term_probe_script_run(&script, all, &caps, TERM_PROBE_TIMEOUT) == 1, "not answered");
+        check(!caps.has_background, "background from a bad reply");
+    }
+
+    // no DA1: replies that did arrive are kept, but the probe fails at the timeout
+    test = "timeout";
+    {
+        TermProbeScript script = {};
+        script.chunks.push_back("\x1b[8;30;80tzzz\x1b[?1;0;2");
+        const auto start = std::chrono::steady_clock::now();
+        check(term_probe_script_run(&script, all, &caps, silent_ms) == 0, "answered");
+        check(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(silent_ms / 2), "gave up early");
+        check(caps.cols == 80 && caps.rows == 30, "lost the replies before the timeout");
+        check(caps.color_registers == 0, "parsed a partial reply");
+    }
+
+    test = "read error";
+    {
+        TermProbeScript script = {};
+        script.fail_read = 1;
+        script.chunks.push_back("\x1b[8;30;80t");
+        check(term_probe_script_run(&script, all, &caps, TERM_PROBE_TIMEOUT) == 0, "answered");
+        check(caps.cols == 80, "lost the reply before the error");
+    }
+
+    test = "write error";
+    {
+        TermProbeScript script = {};
+        script.fail_write = 1;
+        script.chunks.push_back("\x1b[?1;4c");
+        check(term_probe_script_run(&script, all, &caps, TERM_PROBE_TIMEOUT) == 0, "answered");
+        check(script.next == 0, "read after a failed write");
+    }
+    return failures;
+}
+
+#endif // TERM_PROBE_SELF_TEST
+
+#endif // TERM_PROBE_IMPLEMENTATION
@@ -8,118 +8,108 @@
 
 #include "PureDOOM.h"
 
+#define FRAME_STATS_IMPLEMENTATION
+#include "frame_stats.h"
+
 doom_key_t win32_keycode_to_doom_key(int win32_keycode);
 bool key_status[256];
 
-#pragma region sixel
-#define SIXEL_START "\x1bPq"
-#define SIXEL_END   "\x1b\\"
-#define MAX_COLORS  256
+// doom quits through exit(), so stats, the frame dump and the capture index
+// are written from an atexit handler
+static FrameStats stats;
+static const char* stats_json_path = NULL;
+static const char* dump_path = NULL;
+static const char* record_path = NULL;
+
 //#define MAX_COLORS  16 // a playable fps
+#define SIXEL_IMPLEMENTATION
+#include "sixel.h"
 
-typedef struct {
-    uint8_t r, g, b;
-    int used;
-} ColorPalette;
+#define SIXEL_CAPTURE_IMPLEMENTATION
+#include "sixel_capture.h"
 
-ColorPalette palette[MAX_COLORS];
-int palette_size = 0;
-int palette_inited = 0;
+#define KITTY_IMPLEMENTATION
+#include "kitty.h"
 
-int find_closest_color(uint8_t r, uint8_t g, uint8_t b) {
-    int min_dist = 255*3;
-    int index = 0;
+#define HALFBLOCK_IMPLEMENTATION
+#include "halfblock.h"
 
-    for (int i = 0; i < palette_size; i++) {
-        int dr = abs(r - palette[i].r);
-        int dg = abs(g - palette[i].g);
-        int db = abs(b - palette[i].b);
-        int dist = dr + dg + db;
+#define TERM_PROBE_IMPLEMENTATION
+#include "term_probe.h"
 
-        if (dist < min_dist) {
-            min_dist = dist;
-            index = i;
-        }
-    }
-    return index;
-}
+#define FRAME_OUTPUT_IMPLEMENTATION
+#include "frame_output.h"
 
-void generate_palette(const unsigned char *data, int width, int height, int channels) {
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            int idx = (i * width + j) * channels;
-            uint8_t r = data[idx];
-            uint8_t g = data[idx + 1];
-            uint8_t b = data[idx + 2];
-
-            int found = 0;
-            for (int k = 0; k < palette_size; k++) {
-                if (palette[k].r == r && palette[k].g == g && palette[k].b == b) {
-                    found = 1;
-                    break;
-                }
-            }
+static SixelRecorder recorder;
+static FrameOutput frame_output;
 
-            if (!found && palette_size < MAX_COLORS) {
-                palette[palette_size].r = r;
-                palette[palette_size].g = g;
-                palette[palette_size].b = b;
-                palette_size++;
-            }
+void write_exit_files() {
+#if ENABLE_FRAME_STATS
+    if (stats_json_path != NULL && !frame_stats_dump_json_file(&stats, stats_json_path)) {
+        fprintf(stderr, "Failed to write stats file %s\n", stats_json_path);
+    }
+#endif
+    if (dump_path != NULL) {
+        const unsigned char* image = doom_get_framebuffer(3);
+        if (!write_index_dump(dump_path, image, SCREENWIDTH, SCREENHEIGHT, 3)) {
+            fprintf(stderr, "Failed to write %s\n", dump_path);
         }
     }
-}
-
-std::string encode_sixel(const unsigned char *img, int width, int height, int channels) {
-    std::string result;
-    result += SIXEL_START;
-    result += std::format("\"1;1;{:d};{:d}", width, height);
-
-    for (int i = 0; i < palette_size; i++) {
-        result += std::format("#{:d};2;{:d};{:d};{:d}", i,
-                              palette[i].r * 100 / 255,
-                              palette[i].g * 100 / 255,
-                              palette[i].b * 100 / 255);
+    if (!sixel_recorder_close(&recorder)) {
+        fprintf(stderr, "Failed to write capture file %s\n", record_path);
     }
+    // removes shared memory objects the terminal hasn't picked up
+    frame_output_free(&frame_output);
+}
 
-    for (int y = 0; y < height; y += 6) {
-        int band_height = (height - y) < 6 ? (height - y) : 6;
-
-        for (int c = 0; c < palette_size; c++) {
-            result += std::format("#{:d}", c);
-
-            for (int x = 0; x < width; x++) {
-                uint8_t sixel_byte = 0;
-
-                for (int dy = 0; dy < band_height; dy++) {
-                    int current_y = y + dy;
-                    if (current_y >= height) break;
-
-                    int idx = (current_y * width + x) * channels;
-                    uint8_t r = img[idx];
-                    uint8_t g = img[idx + 1];
-                    uint8_t b = img[idx + 2];
-
-                    int color_idx = find_closest_color(r, g, b);
-                    if (color_idx == c) {
-                        sixel_byte |= (1 << dy);
-                    }
-                }
-
-                result += char(sixel_byte + 0x3F);
+int main(int argc, char **args)
+{
+    // doom_init ignores arguments it does not know about
+    bool show_stats = false;
+    OutputBackend backend = OUTPUT_AUTO;
+    bool reprobe = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(args[i], "--stats") == 0) {
+            show_stats = true;
+        }
+        else if (strcmp(args[i], "--stats-json") == 0 && i + 1 < argc) {
+            stats_json_path = args[++i];
+        }
+        else if (strcmp(args[i], "--dump") == 0 && i + 1 < argc) {
+            dump_path = args[++i];
+        }
+        else if (strcmp(args[i], "--record") == 0 && i + 1 < argc) {
+            record_path = args[++i];
+        }
+        else if (strcmp(args[i], "--backend") == 0 && i + 1 < argc) {
+            if (!frame_output_parse_backend(args[++i], &backend)) {
+                fprintf(stderr, "Unknown backend %s, expected one of " OUTPUT_BACKEND_NAMES "\n", args[i]);
+                return EXIT_FAILURE;
             }
-            result += "$";
         }
-        result += "-";
+        else if (strcmp(args[i], "--reprobe") == 0) {
+            reprobe = true;
+        }
     }
+#if ENABLE_FRAME_STATS
+    frame_stats_init(&stats, "doom_update", show_stats || stats_json_path != NULL);
+#else
+    (void)show_stats;
+#endif
+    if (record_path != NULL && !sixel_recorder_open(&recorder, record_path, SCREENWIDTH, SCREENHEIGHT)) {
+        fprintf(stderr, "Failed to open %s\n", record_path);
+        return EXIT_FAILURE;
+    }
+    if (backend == OUTPUT_AUTO) {
+        TermCaps caps;
+        term_probe_console(&caps, reprobe);
+        frame_output_init_auto(&frame_output, &caps, SCREENWIDTH, SCREENHEIGHT);
+    }
+    else {
+        frame_output_init(&frame_output, backend);
+    }
+    atexit(write_exit_files);
 
-    result += SIXEL_END;
-    return result;
-}
-#pragma endregion sixel
-
-int main(int argc, char **args)
-{
     HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
     CONSOLE_SCREEN_BUFFER_INFO bufferInfo;
     GetConsoleScreenBufferInfo(output, &bufferInfo);
@@ -146,7 +136,8 @@ int main(int argc, char **args)
     std::string result;
 
     while(true) {
-
+        FRAME_STATS_FRAME_BEGIN(&stats);
+        FRAME_STATS_BEGIN(&stats, STAGE_INPUT);
         for (int i = 0; i < 256; i++) {
             if (GetAsyncKeyState(i) & 0x8000) {
                 // GetAsyncKeyState & 0x8000 keydown
@@ -162,15 +153,26 @@ int main(int argc, char **args)
                 }
             }
         }
+        FRAME_STATS_END(&stats, STAGE_INPUT);
 
+        FRAME_STATS_BEGIN(&stats, STAGE_EMULATE);
         doom_update();
+        FRAME_STATS_END(&stats, STAGE_EMULATE);
 
         const unsigned char* image = doom_get_framebuffer(3);
-        generate_palette(image, SCREENWIDTH, SCREENHEIGHT, 3);
-        result = encode_sixel(image, SCREENWIDTH, SCREENHEIGHT, 3);
+        result = frame_output_encode(&frame_output, &stats, image, SCREENWIDTH, SCREENHEIGHT, 3);
 
+        FRAME_STATS_BEGIN(&stats, STAGE_WRITE);
         SetConsoleCursorPosition(output, bufferInfo.dwCursorPosition);
         printf(result.c_str());
+        sixel_recorder_write(&recorder, result.data(), result.size());
+#if ENABLE_FRAME_STATS
+        if (show_stats) {
+            printf("\n%s", frame_stats_status_line(&stats).c_str());
+        }
+#endif
+        FRAME_STATS_END(&stats, STAGE_WRITE);
+        FRAME_STATS_FRAME_END(&stats, result.size());
     }
 
     return EXIT_SUCCESS;
@@ -18,6 +18,9 @@ extern "C" {
 #define MINIAUDIO_IMPLEMENTATION
 #include "miniaudio.h"
 
+#define FRAME_STATS_IMPLEMENTATION
+#include "frame_stats.h"
+
 struct priv_t
 {
 	uint8_t *rom;
@@ -108,115 +111,189 @@ void audio_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_ui
     minigb_apu_audio_callback(&apu, (audio_sample_t*)pOutput);
 }
 
-#pragma region sixel
-#define SIXEL_START "\x1bPq"
-#define SIXEL_END   "\x1b\\"
-#define MAX_COLORS  256
+#define SIXEL_IMPLEMENTATION
+#include "sixel.h"
 
-typedef struct {
-    uint8_t r, g, b;
-    int used;
-} ColorPalette;
+#define SIXEL_CAPTURE_IMPLEMENTATION
+#include "sixel_capture.h"
 
-ColorPalette palette[MAX_COLORS];
-int palette_size = 0;
+#define KITTY_IMPLEMENTATION
+#include "kitty.h"
 
-int find_closest_color(uint8_t r, uint8_t g, uint8_t b) {
-    int min_dist = 255*3;
-    int index = 0;
+#define HALFBLOCK_IMPLEMENTATION
+#include "halfblock.h"
 
-    for (int i = 0; i < palette_size; i++) {
-        int dr = abs(r - palette[i].r);
-        int dg = abs(g - palette[i].g);
-        int db = abs(b - palette[i].b);
-        int dist = dr + dg + db;
+#define TERM_PROBE_IMPLEMENTATION
+#include "term_probe.h"
 
-        if (dist < min_dist) {
-            min_dist = dist;
-            index = i;
-        }
-    }
-    return index;
-}
+#define FRAME_OUTPUT_IMPLEMENTATION
+#include "frame_output.h"
 
-void generate_palette(unsigned char *data, int width, int height, int channels) {
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            int idx = (i * width + j) * channels;
-            uint8_t r = data[idx];
-            uint8_t g = data[idx + 1];
-            uint8_t b = data[idx + 2];
-
-            int found = 0;
-            for (int k = 0; k < palette_size; k++) {
-                if (palette[k].r == r && palette[k].g == g && palette[k].b == b) {
-                    found = 1;
-                    break;
-                }
-            }
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
 
-            if (!found && palette_size < MAX_COLORS) {
-                palette[palette_size].r = r;
-                palette[palette_size].g = g;
-                palette[palette_size].b = b;
-                palette_size++;
-            }
-        }
+void write_stats(const FrameStats* stats, const char* path) {
+#if ENABLE_FRAME_STATS
+    if (path != NULL && !frame_stats_dump_json_file(stats, path)) {
+        fprintf(stderr, "Failed to write stats file %s\n", path);
     }
+#else
+    (void)stats;
+    (void)path;
+#endif
 }
 
-std::string encode_sixel(unsigned char *img, int width, int height, int channels) {
-    std::string result;
-    result += SIXEL_START;
-    result += std::format("\"1;1;{:d};{:d}", width, height);
-
-    for (int i = 0; i < palette_size; i++) {
-        result += std::format("#{:d};2;{:d};{:d};{:d}", i,
-                              palette[i].r * 100 / 255,
-                              palette[i].g * 100 / 255,
-                              palette[i].b * 100 / 255);
+/* Benchmark mode: no audio device, no console output and no pacing. Runs
+ * 'frames' frames as fast as possible and reports the emulated fps. With
+ * 'encode' every frame also goes through the output backend into the null
+ * device, timed separately from emulation. 'dump_path' receives the last
+ * frame as a raw index dump for sixel_bench; encoded frames go into
+ * 'recorder' (if open) stamped with emulated time. */
+int run_headless(gb_s* gb, priv_t* priv, int frames, bool encode, FrameOutput* output, const char* dump_path, SixelRecorder* recorder, FrameStats* stats) {
+    FILE* null_out = NULL;
+    if (encode) {
+        null_out = fopen(NULL_DEVICE, "wb");
+        if (null_out == NULL) {
+            fprintf(stderr, "Failed to open %s\n", NULL_DEVICE);
+            return EXIT_FAILURE;
+        }
     }
 
-    for (int y = 0; y < height; y += 6) {
-        int band_height = (height - y) < 6 ? (height - y) : 6;
-
-        for (int c = 0; c < palette_size; c++) {
-            result += std::format("#{:d}", c);
-
-            for (int x = 0; x < width; x++) {
-                uint8_t sixel_byte = 0;
-
-                for (int dy = 0; dy < band_height; dy++) {
-                    int current_y = y + dy;
-                    if (current_y >= height) break;
-
-                    int idx = (current_y * width + x) * channels;
-                    uint8_t r = img[idx];
-                    uint8_t g = img[idx + 1];
-                    uint8_t b = img[idx + 2];
+    using clock = std::chrono::steady_clock;
+    clock::duration emulate_time{};
+    clock::duration encode_time{};
+    uint64_t bytes = 0;
+
+    const clock::time_point start = clock::now();
+    for (int f = 0; f < frames; f++) {
+        FRAME_STATS_FRAME_BEGIN(stats);
+
+        FRAME_STATS_BEGIN(stats, STAGE_EMULATE);
+        const clock::time_point t0 = clock::now();
+        gb_run_frame(gb);
+        const clock::time_point t1 = clock::now();
+        FRAME_STATS_END(stats, STAGE_EMULATE);
+        emulate_time += t1 - t0;
+
+        size_t frame_bytes = 0;
+        if (encode) {
+            unsigned char* image = (unsigned char*)priv->fb;
+            std::string result = frame_output_encode(output, stats, image, LCD_WIDTH, LCD_HEIGHT, 4);
+
+            FRAME_STATS_BEGIN(stats, STAGE_WRITE);
+            fwrite(result.data(), 1, result.size(), null_out);
+            sixel_recorder_write_at(recorder, result.data(), result.size(), (uint64_t)(f * 1e6 / VERTICAL_SYNC));
+            FRAME_STATS_END(stats, STAGE_WRITE);
+
+            encode_time += clock::now() - t1;
+            frame_bytes = result.size();
+            bytes += frame_bytes;
+        }
+        FRAME_STATS_FRAME_END(stats, frame_bytes);
+    }
+    const double total_s = std::chrono::duration<double>(clock::now() - start).count();
+    const double emulate_s = std::chrono::duration<double>(emulate_time).count();
+    const double encode_s = std::chrono::duration<double>(encode_time).count();
 
-                    int color_idx = find_closest_color(r, g, b);
-                    if (color_idx == c) {
-                        sixel_byte |= (1 << dy);
-                    }
-                }
+    if (null_out != NULL) {
+        fclose(null_out);
+    }
 
-                result += char(sixel_byte + 0x3F);
-            }
-            result += "$";
+    if (dump_path != NULL) {
+        unsigned char* image = (unsigned char*)priv->fb;
+        generate_palette(image, LCD_WIDTH, LCD_HEIGHT, 4);
+        if (!write_index_dump(dump_path, image, LCD_WIDTH, LCD_HEIGHT, 4)) {
+            fprintf(stderr, "Failed to write %s\n", dump_path);
         }
-        result += "-";
     }
 
-    result += SIXEL_END;
-    return result;
+    printf("headless: %d frames in %.3f s\n", frames, total_s);
+    printf("  emulation: %9.1f fps  %8.3f ms/frame\n", frames / emulate_s, emulate_s * 1000.0 / frames);
+    if (encode) {
+        printf("  encode:    %9.1f fps  %8.3f ms/frame  %llu bytes/frame\n", frames / encode_s,
+               encode_s * 1000.0 / frames, (unsigned long long)(bytes / frames));
+    }
+    printf("  overall:   %9.1f fps\n", frames / total_s);
+    return EXIT_SUCCESS;
 }
-#pragma endregion sixel
 
 int main(int argc, char **argv)
 {
     if (argc < 2) {
-        fprintf(stderr, "%s ROM\n", argv[0]);
+        fprintf(stderr, "%s ROM [--stats] [--stats-json <file>] [--headless [--frames <n>] [--encode] [--dump <file>]] [--record <file>]\n"
+                        "    [--backend " OUTPUT_BACKEND_NAMES "] [--reprobe]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    bool show_stats = false;
+    const char* stats_json_path = NULL;
+    bool headless = false;
+    bool headless_encode = false;
+    int headless_frames = 600;
+    const char* dump_path = NULL;
+    const char* record_path = NULL;
+    OutputBackend backend = OUTPUT_AUTO;
+    bool reprobe = false;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = true;
+        }
+        else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc) {
+            stats_json_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            headless_frames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--encode") == 0) {
+            headless_encode = true;
+        }
+        else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dump_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            if (!frame_output_parse_backend(argv[++i], &backend)) {
+                fprintf(stderr, "Unknown backend %s, expected one of " OUTPUT_BACKEND_NAMES "\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--reprobe") == 0) {
+            reprobe = true;
+        }
+    }
+    if (headless_frames <= 0) {
+        fprintf(stderr, "--frames must be positive\n");
+        exit(EXIT_FAILURE);
+    }
+
+    static FrameStats stats;
+#if ENABLE_FRAME_STATS
+    frame_stats_init(&stats, "gb_run_frame", show_stats || stats_json_path != NULL);
+#else
+    (void)show_stats;
+#endif
+
+    static FrameOutput frame_output;
+    if (backend == OUTPUT_AUTO && !headless) {
+        TermCaps caps;
+        term_probe_console(&caps, reprobe);
+        frame_output_init_auto(&frame_output, &caps, LCD_WIDTH, LCD_HEIGHT);
+    }
+    else {
+        frame_output_init(&frame_output, backend);
+    }
+
+    static SixelRecorder recorder;
+    if (record_path != NULL && !sixel_recorder_open(&recorder, record_path, LCD_WIDTH, LCD_HEIGHT)) {
+        fprintf(stderr, "Failed to open %s\n", record_path);
         exit(EXIT_FAILURE);
     }
 
@@ -245,6 +322,18 @@ int main(int argc, char **argv)
 //    gb.direct.interlace = 1;
 #endif
 
+    if (headless) {
+        /* APU registers are still written during emulation, so keep its state valid */
+        minigb_apu_audio_init(&apu);
+        int status = run_headless(&gb, &priv, headless_frames, headless_encode, &frame_output, dump_path, &recorder, &stats);
+        write_stats(&stats, stats_json_path);
+        sixel_recorder_close(&recorder);
+        frame_output_free(&frame_output);
+        free(priv.cart_ram);
+        free(priv.rom);
+        return status;
+    }
+
     HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
     CONSOLE_SCREEN_BUFFER_INFO bufferInfo;
     GetConsoleScreenBufferInfo(output, &bufferInfo);
@@ -284,6 +373,8 @@ int main(int argc, char **argv)
         dt = static_cast<double>(std::chrono::duration_cast<std::chrono::milliseconds>(time - prev_time).count()) / 1000.0f;
         prev_time = time;
 
+        FRAME_STATS_FRAME_BEGIN(&stats);
+        FRAME_STATS_BEGIN(&stats, STAGE_INPUT);
         gb.direct.joypad = 0xff;
         for (int i = 0; i < 256; i++) {
             if ((GetAsyncKeyState(i) & 0x8000) || (GetAsyncKeyState(i) & 0b1)) {
@@ -308,15 +399,26 @@ int main(int argc, char **argv)
                 }
             }
         }
+        FRAME_STATS_END(&stats, STAGE_INPUT);
 
+        FRAME_STATS_BEGIN(&stats, STAGE_EMULATE);
         gb_run_frame(&gb);
+        FRAME_STATS_END(&stats, STAGE_EMULATE);
 
         unsigned char* image = (unsigned char*)priv.fb;
-        generate_palette(image, LCD_WIDTH, LCD_HEIGHT, 4);
-        std::string result = encode_sixel(image, LCD_WIDTH, LCD_HEIGHT, 4);
+        std::string result = frame_output_encode(&frame_output, &stats, image, LCD_WIDTH, LCD_HEIGHT, 4);
 
+        FRAME_STATS_BEGIN(&stats, STAGE_WRITE);
         SetConsoleCursorPosition(output, bufferInfo.dwCursorPosition);
         printf(result.c_str());
+        sixel_recorder_write(&recorder, result.data(), result.size());
+#if ENABLE_FRAME_STATS
+        if (show_stats) {
+            printf("\n%s", frame_stats_status_line(&stats).c_str());
+        }
+#endif
+        FRAME_STATS_END(&stats, STAGE_WRITE);
+        FRAME_STATS_FRAME_END(&stats, result.size());
 
         using namespace std::chrono_literals;
         double time_to_16ms = (1.0 / 60) - dt;
@@ -325,6 +427,13 @@ int main(int argc, char **argv)
     }
 
     ma_device_uninit(&device);
+
+    write_stats(&stats, stats_json_path);
+    if (!sixel_recorder_close(&recorder)) {
+        fprintf(stderr, "Failed to write capture file %s\n", record_path);
+    }
+    frame_output_free(&frame_output);
+
 	free(priv.cart_ram);
 	free(priv.rom);
 
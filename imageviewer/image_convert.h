@@ -0,0 +1,235 @@
+// image_convert.h - any decoded pixel format to the quantizer's 8-bit RGB
+//
+// Single-header library: define IMAGE_CONVERT_IMPLEMENTATION in exactly one
+// translation unit before including it.
+//
+// stb_image hands out 1 to 4 channels (gray, gray + alpha, RGB, RGBA) of
+// 8-bit, 16-bit or float samples. The palette and encoder only take 8-bit
+// RGB, so everything goes through here first: alpha is blended over the
+// terminal's background color, 16-bit samples are rounded down to 8 bits and
+// HDR values are tone mapped (Reinhard, with an exposure factor) and gamma
+// encoded to sRGB through a table.
+//
+// The per-pixel loops are instantiated for each channel count and hold only
+// arithmetic: no branches, no table lookups and no 64-bit division (16-bit
+// blending is done in double, which is exact at these magnitudes). The sRGB
+// table lookup and the transparency mask each get a pass of their own. GCC
+// vectorizes every loop but the table lookup at -O3, the default Release
+// build, once AVX2 is allowed (-march=x86-64-v3 or native). On the plain SSE2
+// baseline its cost model keeps some channel counts scalar, because shuffling
+// 1, 2 or 4 channels into 3 is expensive there.
+//
+// Fully transparent pixels are blended like the rest, but can also be marked
+// in 'opaque' (0 for transparent, 1 otherwise) for encoders that leave them
+// unpainted. Each function returns how many there were.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t background;  // 0xRRGGBB behind transparent pixels
+    float exposure;       // HDR only, scales linear values before tone mapping
+} ImageConvert;
+
+// 'opaque' may be NULL
+size_t convert_rgb8(const ImageConvert* c, const uint8_t* src, int channels, size_t pixels, uint8_t* dst, uint8_t* opaque);
+size_t convert_rgb16(const ImageConvert* c, const uint16_t* src, int channels, size_t pixels, uint8_t* dst, uint8_t* opaque);
+size_t convert_hdr(const ImageConvert* c, const float* src, int channels, size_t pixels, uint8_t* dst, uint8_t* opaque);
+
+#ifdef IMAGE_CONVERT_IMPLEMENTATION
+
+#include <math.h>
+#include <string.h>
+
+#define CONVERT_GAMMA_STEPS 4096
+#define CONVERT_HDR_BLOCK 1024  // pixels tone mapped before each table pass
+
+static inline int convert_background(const ImageConvert* c, int channel) {
+    return (c->background >> (16 - channel * 8)) & 0xFF;
+}
+
+// counts the pixels whose alpha is zero and marks them in 'opaque'
+template <int CHANNELS, typename T>
+static size_t convert_mask_pixels(const T* src, size_t pixels, uint8_t* opaque) {
+    const T* alpha = src + CHANNELS - 1;
+    size_t transparent = 0;
+    for (size_t i = 0; i < pixels; i++) {
+        transparent += alpha[i * CHANNELS] <= 0;
+    }
+    if (opaque) {
+        for (size_t i = 0; i < pixels; i++) {
+            opaque[i] = !(alpha[i * CHANNELS] <= 0);
+        }
+    }
+    return transparent;
+}
+
+template <typename T>
+static size_t convert_mask(const T* src, int channels, size_t pixels, uint8_t* opaque) {
+    switch (channels) {
+    case 2: return convert_mask_pixels<2>(src, pixels, opaque);
+    case 4: return convert_mask_pixels<4>(src, pixels, opaque);
+    default:
+        if (opaque) memset(opaque, 1, pixels);
+        return 0;
+    }
+}
+
+template <int CHANNELS>
+static void convert_rgb8_pixels(const uint16_t background[3], const uint8_t* src, size_t pixels, uint8_t* dst) {
+    // a copy, or every store through the output might have changed it
+    const uint16_t bg[3] = { background[0], background[1], background[2] };
+    const bool gray = CHANNELS < 3;
+    const bool has_alpha = CHANNELS == 2 || CHANNELS == 4;
+    for (size_t i = 0; i < pixels; i++) {
+        const uint8_t* p = src + i * CHANNELS;
+        const uint16_t a = has_alpha ? p[CHANNELS - 1] : 255;
+        for (int k = 0; k < 3; k++) {
+            // (x + 127) / 255 without the division. x is at most 65153, so
+            // this all fits in 16 bits, which SSE2 multiplies 8 at a time
+            const uint16_t x = (uint16_t)(p[gray ? 0 : k] * a + bg[k] * (255 - a) + 128);
+            dst[i * 3 + k] = (uint8_t)((uint16_t)(x + (x >> 8)) >> 8);
+        }
+    }
+}
+
+size_t convert_rgb8(const ImageConvert* c, const uint8_t* src, int channels, size_t pixels, uint8_t* dst, uint8_t* opaque) {
+    const uint16_t bg[3] = { (uint16_t)convert_background(c, 0), (uint16_t)convert_background(c, 1),
+                             (uint16_t)convert_background(c, 2) };
+    switch (channels) {
+    case 1: convert_rgb8_pixels<1>(bg, src, pixels, dst); break;
+    case 2: convert_rgb8_pixels<2>(bg, src, pixels, dst); break;
+    case 3: convert_rgb8_pixels<3>(bg, src, pixels, dst); break;
+    default: convert_rgb8_pixels<4>(bg, src, pixels, dst); break;
+    }
+    return convert_mask(src, channels, pixels, opaque);
+}
+
+template <int CHANNELS>
+static void convert_rgb16_pixels(const double background[3], const uint16_t* src, size_t pixels, uint8_t* dst) {
+    // a copy, or every store through the output might have changed it
+    const double bg[3] = { background[0], background[1], background[2] };
+    const bool gray = CHANNELS < 3;
+    const bool has_alpha = CHANNELS == 2 || CHANNELS == 4;
+    for (size_t i = 0; i < pixels; i++) {
+        const uint16_t* p = src + i * CHANNELS;
+        const double a = has_alpha ? p[CHANNELS - 1] : 65535.0;
+        for (int k = 0; k < 3; k++) {
+            // blended in 16 bits, then 0..65535 to 0..255 rounded. the sums stay
+            // below 2^33 and a quotient that isn't whole is at least 1/65535
+            // from the next one, so truncating the double division is exact
+            const double blended = (double)(int32_t)((p[gray ? 0 : k] * a + bg[k] * (65535.0 - a) + 32767.0) / 65535.0);
+            dst[i * 3 + k] = (uint8_t)(int32_t)((blended * 255.0 + 32767.0) / 65535.0);
+        }
+    }
+}
+
+size_t convert_rgb16(const ImageConvert* c, const uint16_t* src, int channels, size_t pixels, uint8_t* dst, uint8_t* opaque) {
+    const double bg[3] = { convert_background(c, 0) * 257.0, convert_background(c, 1) * 257.0,
+                           convert_background(c, 2) * 257.0 };
+    switch (channels) {
+    case 1: convert_rgb16_pixels<1>(bg, src, pixels, dst); break;
+    case 2: convert_rgb16_pixels<2>(bg, src, pixels, dst); break;
+    case 3: convert_rgb16_pixels<3>(bg, src, pixels, dst); break;
+    default: convert_rgb16_pixels<4>(bg, src, pixels, dst); break;
+    }
+    return convert_mask(src, channels, pixels, opaque);
+}
+
+typedef struct {
+    uint8_t srgb[CONVERT_GAMMA_STEPS + 1];
+} ConvertGamma;
+
+// sRGB transfer function sampled over 0..1
+static ConvertGamma convert_gamma_table() {
+    ConvertGamma t;
+    for (int i = 0; i <= CONVERT_GAMMA_STEPS; i++) {
+        const double x = (double)i / CONVERT_GAMMA_STEPS;
+        const double s = x <= 0.0031308 ? x * 12.92 : 1.055 * pow(x, 1.0 / 2.4) - 0.055;
+        t.srgb[i] = (uint8_t)(s * 255.0 + 0.5);
+    }
+    return t;
+}
+
+// max(v, 0) and min(max(v, 0), 1) on the bits, since a float compare here is
+// turned into a branch around the arithmetic after it. -NaN gives 0, +NaN
+// stays NaN for the first and gives 1 for the second
+static inline float convert_clamp0(float v) {
+    int32_t bits;
+    memcpy(&bits, &v, sizeof bits);
+    bits &= ~(bits >> 31);
+    memcpy(&v, &bits, sizeof v);
+    return v;
+}
+
+static inline float convert_clamp01(float v) {
+    int32_t bits;
+    memcpy(&bits, &v, sizeof bits);
+    bits &= ~(bits >> 31);
+    bits = bits < 0x3f800000 ? bits : 0x3f800000;
+    memcpy(&v, &bits, sizeof v);
+    return v;
+}
+
+// one linear value tone mapped, blended over 'under' (the background already
+// scaled by 1 - alpha) and turned into a position in the gamma table. NaN and
+// infinity end up at 0
+static inline uint16_t convert_hdr_step(float v, float a, float under) {
+    v = convert_clamp0(v);
+    v = v / (1.0f + v);  // Reinhard, 0..1
+    int step = (int)((v * a + under) * CONVERT_GAMMA_STEPS + 0.5f);
+    step = step > 0 ? step : 0;
+    step = step < CONVERT_GAMMA_STEPS ? step : CONVERT_GAMMA_STEPS;
+    return (uint16_t)step;
+}
+
+// written out per channel: left as a loop over them, GCC doesn't vectorize it
+template <int CHANNELS>
+static void convert_hdr_steps(const float background[3], float exposure, const float* src, size_t pixels, uint16_t* steps) {
+    // a copy, or every store through the output might have changed it
+    const float bg[3] = { background[0], background[1], background[2] };
+    const bool gray = CHANNELS < 3;
+    const bool has_alpha = CHANNELS == 2 || CHANNELS == 4;
+    for (size_t i = 0; i < pixels; i++) {
+        const float* p = src + i * CHANNELS;
+        const float a = has_alpha ? convert_clamp01(p[CHANNELS - 1]) : 1.0f;
+        const float keep = 1.0f - a;
+        steps[i * 3 + 0] = convert_hdr_step(p[0] * exposure, a, bg[0] * keep);
+        steps[i * 3 + 1] = convert_hdr_step(p[gray ? 0 : 1] * exposure, a, bg[1] * keep);
+        steps[i * 3 + 2] = convert_hdr_step(p[gray ? 0 : 2] * exposure, a, bg[2] * keep);
+    }
+}
+
+size_t convert_hdr(const ImageConvert* c, const float* src, int channels, size_t pixels, uint8_t* dst, uint8_t* opaque) {
+    // built on first use, safely even from the contact sheet's worker threads
+    static const ConvertGamma gamma = convert_gamma_table();
+
+    // the background is sRGB, blending happens in linear light
+    float bg[3];
+    for (int k = 0; k < 3; k++) {
+        const float s = convert_background(c, k) / 255.0f;
+        bg[k] = s <= 0.04045f ? s / 12.92f : powf((s + 0.055f) / 1.055f, 2.4f);
+    }
+
+    const float exposure = c->exposure > 0 ? c->exposure : 1.0f;
+    uint16_t steps[CONVERT_HDR_BLOCK * 3];
+    for (size_t i = 0; i < pixels; i += CONVERT_HDR_BLOCK) {
+        const size_t n = pixels - i < CONVERT_HDR_BLOCK ? pixels - i : CONVERT_HDR_BLOCK;
+        const float* block = src + i * channels;
+        switch (channels) {
+        case 1: convert_hdr_steps<1>(bg, exposure, block, n, steps); break;
+        case 2: convert_hdr_steps<2>(bg, exposure, block, n, steps); break;
+        case 3: convert_hdr_steps<3>(bg, exposure, block, n, steps); break;
+        default: convert_hdr_steps<4>(bg, exposure, block, n, steps); break;
+        }
+        uint8_t* out = dst + i * 3;
+        for (size_t j = 0; j < n * 3; j++) {
+            out[j] = gamma.srgb[steps[j]];
+        }
+    }
+    return convert_mask(src, channels, pixels, opaque);
+}
+
+#endif // IMAGE_CONVERT_IMPLEMENTATION
@@ -0,0 +1,693 @@
+// image_stream.h - row by row decoding of images too large to load whole
+//
+// Single-header library: define IMAGE_STREAM_IMPLEMENTATION in exactly one
+// translation unit before including it.
+//
+// Handles non-interlaced PNG (every color type, 1 to 16 bits per sample) and
+// binary PNM (P5 gray and P6 RGB, up to 16 bits per sample). Rows are handed
+// to a callback as 8-bit RGB as soon as they are decoded, so memory stays at
+// two scanlines plus the inflate window however large the image is. Alpha is
+// blended over 'background', like image_convert.h does for whole images, and
+// images with an alpha channel or a tRNS chunk also pass which pixels are
+// fully transparent.
+// Anything else is left to stb_image: image_stream_open fails and the caller
+// loads the image whole.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// 'opaque' is 0 for fully transparent pixels, or NULL for images without alpha
+typedef void (*ImageRowFunc)(void* user, const unsigned char* rgb, const uint8_t* opaque, int y);
+
+typedef enum {
+    IMAGE_STREAM_PNG,
+    IMAGE_STREAM_PNM
+} ImageStreamFormat;
+
+typedef struct {
+    FILE* fp;
+    ImageStreamFormat format;
+    int width, height;
+    int bit_depth;           // bits per sample
+    int samples;             // per pixel, as stored in the file
+    int color_type;          // PNG only
+    int has_alpha;
+    int maxval;              // PNM only
+    long long data_offset;   // first IDAT chunk or first PNM row, for another pass
+    uint32_t background;     // 0xRRGGBB behind transparent pixels, set by the caller
+    unsigned char plte[256 * 3];
+    uint8_t plte_alpha[256];  // from tRNS, 255 past its entries
+    int has_key;              // tRNS for gray and RGB: pixels of this color are transparent
+    uint16_t key[3];          // as stored, before scaling to 8 bits
+    const char* error;        // why image_stream_read failed, in stb_image's words where it has them
+} ImageStream;
+
+// reads the header; returns 0 for files this decoder doesn't handle
+int image_stream_open(ImageStream* s, const char* path);
+// decodes all rows in order and may be called again for a second pass;
+// returns 0 on corrupt or truncated data, after the rows that did decode,
+// and sets 'error'
+int image_stream_read(ImageStream* s, ImageRowFunc fn, void* user);
+void image_stream_close(ImageStream* s);
+
+#ifdef IMAGE_STREAM_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#ifdef _WIN32
+# define stream_seek _fseeki64
+# define stream_tell _ftelli64
+#else
+# define stream_seek fseeko
+# define stream_tell ftello
+#endif
+
+static uint32_t stream_be32(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int png_stream_open(ImageStream* s) {
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    unsigned char header[8];
+    if (fread(header, 1, 8, s->fp) != 8 || memcmp(header, signature, 8) != 0) {
+        return 0;
+    }
+
+    memset(s->plte_alpha, 255, sizeof(s->plte_alpha));
+    bool have_header = false;
+    for (;;) {
+        const long long offset = stream_tell(s->fp);
+        unsigned char chunk[8];
+        if (fread(chunk, 1, 8, s->fp) != 8) {
+            return 0;
+        }
+        const uint32_t length = stream_be32(chunk);
+
+        if (memcmp(chunk + 4, "IHDR", 4) == 0) {
+            unsigned char ihdr[13];
+            if (length != 13 || fread(ihdr, 1, 13, s->fp) != 13) {
+                return 0;
+            }
+            s->width = (int)stream_be32(ihdr);
+            s->height = (int)stream_be32(ihdr + 4);
+            s->bit_depth = ihdr[8];
+            s->color_type = ihdr[9];
+            // compression, filter method and interlacing; Adam7 needs the whole image
+            if (ihdr[10] != 0 || ihdr[11] != 0 || ihdr[12] != 0 || s->width <= 0 || s->height <= 0) {
+                return 0;
+            }
+            switch (s->color_type) {
+            case 0: s->samples = 1; break;
+            case 2: s->samples = 3; break;
+            case 3: s->samples = 1; break;
+            case 4: s->samples = 2; break;
+            case 6: s->samples = 4; break;
+            default: return 0;
+            }
+            const int d = s->bit_depth;
+            if (d != 1 && d != 2 && d != 4 && d != 8 && d != 16) return 0;
+            if (d < 8 && s->color_type != 0 && s->color_type != 3) return 0;
+            if (d == 16 && s->color_type == 3) return 0;
+            s->has_alpha = s->color_type == 4 || s->color_type == 6;
+            have_header = true;
+            stream_seek(s->fp, 4, SEEK_CUR);
+        }
+        else if (memcmp(chunk + 4, "PLTE", 4) == 0) {
+            if (length > sizeof(s->plte) || length % 3 != 0 || fread(s->plte, 1, length, s->fp) != length) {
+                return 0;
+            }
+            stream_seek(s->fp, 4, SEEK_CUR);
+        }
+        else if (memcmp(chunk + 4, "tRNS", 4) == 0 && have_header &&
+                 (s->color_type == 0 || s->color_type == 2 || s->color_type == 3)) {
+            unsigned char trns[256];
+            if (length > sizeof(trns) || fread(trns, 1, length, s->fp) != length) {
+                return 0;
+            }
+            if (s->color_type == 3) {
+                memcpy(s->plte_alpha, trns, length);
+            }
+            else {
+                const int keys = s->color_type == 0 ? 1 : 3;
+                if ((int)length != keys * 2) return 0;
+                for (int k = 0; k < keys; k++) s->key[k] = (uint16_t)(trns[k * 2] << 8 | trns[k * 2 + 1]);
+                s->has_key = 1;
+            }
+            s->has_alpha = 1;
+            stream_seek(s->fp, 4, SEEK_CUR);
+        }
+        else if (memcmp(chunk + 4, "IDAT", 4) == 0) {
+            s->data_offset = offset;
+            return have_header;
+        }
+        else if (memcmp(chunk + 4, "IEND", 4) == 0) {
+            return 0;
+        }
+        else {
+            stream_seek(s->fp, (long long)length + 4, SEEK_CUR);
+        }
+    }
+}
+
+static int pnm_stream_token(FILE* fp) {
+    int c = fgetc(fp);
+    for (;;) {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) c = fgetc(fp);
+        }
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            c = fgetc(fp);
+        }
+        else {
+            break;
+        }
+    }
+    int value = -1;
+    while (c >= '0' && c <= '9') {
+        value = (value < 0 ? 0 : value * 10) + (c - '0');
+        if (value > (1 << 24)) return -1;
+        c = fgetc(fp);
+    }
+    // exactly one whitespace character ends the token, the last one before the samples
+    return value;
+}
+
+static int pnm_stream_open(ImageStream* s) {
+    char magic[2];
+    if (fread(magic, 1, 2, s->fp) != 2 || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6')) {
+        return 0;
+    }
+    s->samples = magic[1] == '5' ? 1 : 3;
+    s->width = pnm_stream_token(s->fp);
+    s->height = pnm_stream_token(s->fp);
+    s->maxval = pnm_stream_token(s->fp);
+    if (s->width <= 0 || s->height <= 0 || s->maxval <= 0 || s->maxval > 65535) {
+        return 0;
+    }
+    s->bit_depth = s->maxval > 255 ? 16 : 8;
+    s->data_offset = stream_tell(s->fp);
+    return 1;
+}
+
+int image_stream_open(ImageStream* s, const char* path) {
+    memset(s, 0, sizeof(*s));
+    s->fp = fopen(path, "rb");
+    if (!s->fp) {
+        return 0;
+    }
+    s->format = IMAGE_STREAM_PNG;
+    if (png_stream_open(s)) {
+        return 1;
+    }
+    stream_seek(s->fp, 0, SEEK_SET);
+    s->format = IMAGE_STREAM_PNM;
+    if (pnm_stream_open(s)) {
+        return 1;
+    }
+    image_stream_close(s);
+    return 0;
+}
+
+void image_stream_close(ImageStream* s) {
+    if (s->fp) {
+        fclose(s->fp);
+        s->fp = NULL;
+    }
+}
+
+static int pnm_stream_read(ImageStream* s, ImageRowFunc fn, void* user) {
+    const int bytes = s->bit_depth / 8;
+    std::vector<unsigned char> row((size_t)s->width * s->samples * bytes);
+    std::vector<unsigned char> rgb((size_t)s->width * 3);
+    for (int y = 0; y < s->height; y++) {
+        if (fread(row.data(), 1, row.size(), s->fp) != row.size()) {
+            return 0;
+        }
+        for (int x = 0; x < s->width; x++) {
+            for (int c = 0; c < 3; c++) {
+                const unsigned char* p = &row[((size_t)x * s->samples + (s->samples == 1 ? 0 : c)) * bytes];
+                const int v = bytes == 2 ? (p[0] << 8) | p[1] : p[0];
+                rgb[(size_t)x * 3 + c] = (unsigned char)(s->maxval == 255 ? v : (v * 255 + s->maxval / 2) / s->maxval);
+            }
+        }
+        fn(user, rgb.data(), NULL, y);
+    }
+    return 1;
+}
+
+// ---- inflate (RFC 1950/1951) over the IDAT chunks ----
+
+#define INFLATE_FAST_BITS 10
+#define INFLATE_WINDOW 65536             // twice the largest match distance
+#define INFLATE_FLUSH (INFLATE_WINDOW / 4)
+
+typedef struct {
+    uint16_t fast[1 << INFLATE_FAST_BITS];  // symbol << 4 | length, 0 for longer codes
+    uint16_t count[16];                     // codes per length
+    uint16_t symbol[288];                   // symbols in canonical order
+} InflateTable;
+
+typedef struct {
+    ImageStream* s;
+    ImageRowFunc fn;
+    void* user;
+
+    // input: the payload of consecutive IDAT chunks
+    unsigned char in[65536];
+    size_t in_pos, in_len;
+    uint32_t chunk_left;
+    bool chunks_done;
+    uint64_t bits;
+    int bit_count;
+    int padding;       // zero bytes fed in past the end of the data
+
+    // output
+    unsigned char window[INFLATE_WINDOW];
+    uint64_t out_pos, flushed;  // bytes inflated and handed on so far, past 4 GiB for huge images
+    uint32_t adler;             // Adler-32 of the flushed bytes, checked against the zlib trailer
+
+    // scanlines
+    std::vector<unsigned char> line, prev, rgb;  // filter byte first, then the row
+    std::vector<uint8_t> opaque;
+    size_t line_fill;
+    int bpp;           // bytes per complete pixel, at least 1, for the filters
+    int y;
+    const char* error; // set by png_emit_row, which can't return it
+
+    InflateTable lit, dist;
+} PngInflate;
+
+static int png_next_byte(PngInflate* z) {
+    while (z->in_pos == z->in_len) {
+        if (z->chunks_done) {
+            z->padding++;
+            return 0;
+        }
+        if (z->chunk_left == 0) {
+            // the CRC of the previous chunk was skipped when it ran out
+            unsigned char chunk[8];
+            if (fread(chunk, 1, 8, z->s->fp) != 8 || memcmp(chunk + 4, "IDAT", 4) != 0) {
+                z->chunks_done = true;
+                continue;
+            }
+            z->chunk_left = stream_be32(chunk);
+            if (z->chunk_left == 0) {
+                stream_seek(z->s->fp, 4, SEEK_CUR);
+            }
+            continue;
+        }
+        size_t want = z->chunk_left < sizeof(z->in) ? z->chunk_left : sizeof(z->in);
+        z->in_len = fread(z->in, 1, want, z->s->fp);
+        z->in_pos = 0;
+        if (z->in_len == 0) {
+            z->chunks_done = true;
+            continue;
+        }
+        z->chunk_left -= (uint32_t)z->in_len;
+        if (z->chunk_left == 0) {
+            stream_seek(z->s->fp, 4, SEEK_CUR);
+        }
+    }
+    return z->in[z->in_pos++];
+}
+
+static inline void png_refill(PngInflate* z) {
+    while (z->bit_count <= 56) {
+        z->bits |= (uint64_t)png_next_byte(z) << z->bit_count;
+        z->bit_count += 8;
+    }
+}
+
+static inline uint32_t png_bits(PngInflate* z, int n) {
+    if (z->bit_count < n) png_refill(z);
+    const uint32_t v = (uint32_t)(z->bits & ((1ull << n) - 1));
+    z->bits >>= n;
+    z->bit_count -= n;
+    return v;
+}
+
+// true once bits from past the end of the data were used
+static inline bool png_overrun(const PngInflate* z) {
+    return z->bit_count < z->padding * 8;
+}
+
+static int inflate_build(InflateTable* t, const uint8_t* lengths, int n) {
+    memset(t->count, 0, sizeof(t->count));
+    for (int i = 0; i < n; i++) t->count[lengths[i]]++;
+    t->count[0] = 0;
+
+    int left = 1;
+    for (int len = 1; len < 16; len++) {
+        left = left * 2 - t->count[len];
+        if (left < 0) return 0;  // over-subscribed
+    }
+
+    uint16_t offs[16];
+    offs[1] = 0;
+    for (int len = 1; len < 15; len++) offs[len + 1] = offs[len] + t->count[len];
+    for (int i = 0; i < n; i++) {
+        if (lengths[i]) t->symbol[offs[lengths[i]]++] = (uint16_t)i;
+    }
+
+    // codes up to INFLATE_FAST_BITS long, indexed by their bit-reversed value
+    memset(t->fast, 0, sizeof(t->fast));
+    int code = 0, index = 0;
+    for (int len = 1; len <= INFLATE_FAST_BITS; len++) {
+        for (int k = 0; k < t->count[len]; k++, code++, index++) {
+            int reversed = 0;
+            for (int b = 0; b < len; b++) reversed |= ((code >> b) & 1) << (len - 1 - b);
+            for (int fill = reversed; fill < (1 << INFLATE_FAST_BITS); fill += 1 << len) {
+                t->fast[fill] = (uint16_t)(t->symbol[index] << 4 | len);
+            }
+        }
+        code <<= 1;
+    }
+    return 1;
+}
+
+static inline int inflate_decode(PngInflate* z, const InflateTable* t) {
+    if (z->bit_count < 15) png_refill(z);
+    const uint16_t entry = t->fast[z->bits & ((1 << INFLATE_FAST_BITS) - 1)];
+    if (entry) {
+        z->bits >>= entry & 15;
+        z->bit_count -= entry & 15;
+        return entry >> 4;
+    }
+    // canonical decode one bit at a time, for the rare long codes
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; len++) {
+        code |= (int)png_bits(z, 1);
+        const int count = t->count[len];
+        if (code - count < first) {
+            return t->symbol[index + (code - first)];
+        }
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static inline int paeth(int a, int b, int c) {
+    const int p = a + b - c;
+    const int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+static void png_emit_row(PngInflate* z) {
+    ImageStream* s = z->s;
+    unsigned char* cur = &z->line[1];
+    const unsigned char* up = &z->prev[1];
+    const size_t stride = z->line.size() - 1;
+    const int bpp = z->bpp;
+
+    switch (z->line[0]) {
+    case 0:
+        break;
+    case 1:
+        for (size_t i = bpp; i < stride; i++) cur[i] += cur[i - bpp];
+        break;
+    case 2:
+        for (size_t i = 0; i < stride; i++) cur[i] += up[i];
+        break;
+    case 3:
+        for (size_t i = 0; i < stride; i++) {
+            cur[i] += (unsigned char)(((i >= (size_t)bpp ? cur[i - bpp] : 0) + up[i]) >> 1);
+        }
+        break;
+    case 4:
+        for (size_t i = 0; i < stride; i++) {
+            const int a = i >= (size_t)bpp ? cur[i - bpp] : 0;
+            const int c = i >= (size_t)bpp ? up[i - bpp] : 0;
+            cur[i] += (unsigned char)paeth(a, up[i], c);
+        }
+        break;
+    default:
+        z->error = "invalid filter";
+        return;
+    }
+
+    unsigned char* out = z->rgb.data();
+    const int d = s->bit_depth;
+    const bool gray = s->color_type == 0 || s->color_type == 4;
+    for (int x = 0; x < s->width; x++, out += 3) {
+        // color and alpha, 8-bit or 16-bit as 'one' says, and the samples as
+        // stored for the tRNS key
+        uint32_t v[4];
+        uint32_t raw[4];
+        uint32_t one = 255;
+        uint32_t a = 255;
+        if (s->color_type == 3) {
+            const int i = d < 8 ? (cur[x * d / 8] >> (8 - d - x * d % 8)) & ((1 << d) - 1) : cur[x];
+            for (int k = 0; k < 3; k++) v[k] = s->plte[i * 3 + k];
+            a = s->plte_alpha[i];
+        }
+        else if (d < 8) {
+            raw[0] = (cur[x * d / 8] >> (8 - d - x * d % 8)) & ((1 << d) - 1);
+            v[0] = raw[0] * 255 / ((1 << d) - 1);
+        }
+        else {
+            const int step = d / 8;
+            const unsigned char* p = cur + (size_t)x * s->samples * step;
+            for (int k = 0; k < s->samples; k++) {
+                raw[k] = step == 2 ? (uint32_t)p[k * 2] << 8 | p[k * 2 + 1] : p[k];
+                v[k] = raw[k];
+            }
+            if (step == 2) one = a = 65535;
+            if (s->color_type == 4 || s->color_type == 6) a = v[s->samples - 1];
+        }
+        if (s->has_key && raw[0] == s->key[0] && (gray || (raw[1] == s->key[1] && raw[2] == s->key[2]))) {
+            a = 0;
+        }
+
+        if (s->has_alpha) z->opaque[x] = a != 0;
+        for (int k = 0; k < 3; k++) {
+            const uint32_t bg = (s->background >> (16 - k * 8)) & 0xFF;
+            const uint32_t c = gray ? v[0] : v[k];
+            if (one == 255) {
+                out[k] = (unsigned char)((c * a + bg * (255 - a) + 127) / 255);
+            }
+            else {
+                // 16-bit samples are blended in 16 bits and then rounded to 8
+                const uint64_t blended = ((uint64_t)c * a + (uint64_t)bg * 257 * (65535 - a) + 32767) / 65535;
+                out[k] = (unsigned char)((blended * 255 + 32767) / 65535);
+            }
+        }
+    }
+
+    z->fn(z->user, z->rgb.data(), s->has_alpha ? z->opaque.data() : NULL, z->y++);
+    z->line.swap(z->prev);
+    z->line_fill = 0;
+}
+
+static void png_adler(PngInflate* z, const unsigned char* p, uint32_t n) {
+    uint32_t a = z->adler & 0xFFFF, b = z->adler >> 16;
+    while (n > 0) {
+        // 5552 bytes is the most the sums take before they could overflow
+        uint32_t k = n < 5552 ? n : 5552;
+        n -= k;
+        while (k--) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    z->adler = b << 16 | a;
+}
+
+// hands the window's new bytes to the scanline assembler
+static void png_flush(PngInflate* z) {
+    // the checksum covers all of them, the padding past the last row too
+    for (uint64_t pos = z->flushed; pos != z->out_pos;) {
+        const uint32_t start = (uint32_t)(pos & (INFLATE_WINDOW - 1));
+        uint32_t n = (uint32_t)(z->out_pos - pos);
+        if (start + n > INFLATE_WINDOW) n = INFLATE_WINDOW - start;
+        png_adler(z, &z->window[start], n);
+        pos += n;
+    }
+    while (z->flushed != z->out_pos && z->y < z->s->height && !z->error) {
+        const uint32_t start = (uint32_t)(z->flushed & (INFLATE_WINDOW - 1));
+        uint32_t n = (uint32_t)(z->out_pos - z->flushed);
+        if (start + n > INFLATE_WINDOW) n = INFLATE_WINDOW - start;
+        const size_t room = z->line.size() - z->line_fill;
+        if (n > room) n = (uint32_t)room;
+        memcpy(&z->line[z->line_fill], &z->window[start], n);
+        z->line_fill += n;
+        z->flushed += n;
+        if (z->line_fill == z->line.size()) {
+            png_emit_row(z);
+        }
+    }
+    z->flushed = z->out_pos;
+}
+
+static const uint16_t length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                          35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                          3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                        8193, 12289, 16385, 24577 };
+static const uint8_t dist_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static int inflate_dynamic_tables(PngInflate* z) {
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    const int nlit = (int)png_bits(z, 5) + 257;
+    const int ndist = (int)png_bits(z, 5) + 1;
+    const int ncode = (int)png_bits(z, 4) + 4;
+    if (nlit > 286 || ndist > 30) return 0;
+
+    uint8_t lengths[320] = {};
+    for (int i = 0; i < ncode; i++) lengths[order[i]] = (uint8_t)png_bits(z, 3);
+    InflateTable code_table;
+    if (!inflate_build(&code_table, lengths, 19)) return 0;
+
+    memset(lengths, 0, sizeof(lengths));
+    int i = 0;
+    while (i < nlit + ndist) {
+        const int sym = inflate_decode(z, &code_table);
+        if (sym < 0 || png_overrun(z)) return 0;
+        if (sym < 16) {
+            lengths[i++] = (uint8_t)sym;
+            continue;
+        }
+        int repeat, value = 0;
+        if (sym == 16) {
+            if (i == 0) return 0;
+            value = lengths[i - 1];
+            repeat = 3 + (int)png_bits(z, 2);
+        }
+        else if (sym == 17) {
+            repeat = 3 + (int)png_bits(z, 3);
+        }
+        else {
+            repeat = 11 + (int)png_bits(z, 7);
+        }
+        if (i + repeat > nlit + ndist) return 0;
+        while (repeat--) lengths[i++] = (uint8_t)value;
+    }
+    return inflate_build(&z->lit, lengths, nlit) && inflate_build(&z->dist, lengths + nlit, ndist);
+}
+
+static int inflate_fixed_tables(PngInflate* z) {
+    uint8_t lengths[320];
+    int i = 0;
+    for (; i < 144; i++) lengths[i] = 8;
+    for (; i < 256; i++) lengths[i] = 9;
+    for (; i < 280; i++) lengths[i] = 7;
+    for (; i < 288; i++) lengths[i] = 8;
+    for (i = 0; i < 30; i++) lengths[288 + i] = 5;
+    return inflate_build(&z->lit, lengths, 288) && inflate_build(&z->dist, lengths + 288, 30);
+}
+
+static int inflate_codes(PngInflate* z) {
+    for (;;) {
+        if (z->out_pos - z->flushed >= INFLATE_FLUSH) {
+            png_flush(z);
+            if (z->error) return 0;
+        }
+
+        const int sym = inflate_decode(z, &z->lit);
+        if (sym < 0 || png_overrun(z)) return 0;
+        if (sym < 256) {
+            z->window[z->out_pos++ & (INFLATE_WINDOW - 1)] = (unsigned char)sym;
+            continue;
+        }
+        if (sym == 256) return 1;
+        if (sym > 285) return 0;
+
+        const int len = length_base[sym - 257] + (int)png_bits(z, length_extra[sym - 257]);
+        const int dsym = inflate_decode(z, &z->dist);
+        if (dsym < 0 || dsym > 29) return 0;
+        const uint32_t distance = dist_base[dsym] + png_bits(z, dist_extra[dsym]);
+        if (distance > z->out_pos || png_overrun(z)) return 0;
+
+        for (int i = 0; i < len; i++, z->out_pos++) {
+            z->window[z->out_pos & (INFLATE_WINDOW - 1)] = z->window[(z->out_pos - distance) & (INFLATE_WINDOW - 1)];
+        }
+    }
+}
+
+static int png_stream_read(ImageStream* s, ImageRowFunc fn, void* user) {
+    PngInflate* z = new PngInflate();
+    z->s = s;
+    z->fn = fn;
+    z->user = user;
+    const size_t stride = ((size_t)s->width * s->samples * s->bit_depth + 7) / 8;
+    z->line.assign(stride + 1, 0);
+    z->prev.assign(stride + 1, 0);
+    z->rgb.assign((size_t)s->width * 3, 0);
+    z->opaque.assign(s->width, 1);
+    z->bpp = s->samples * s->bit_depth / 8 > 0 ? s->samples * s->bit_depth / 8 : 1;
+    z->adler = 1;
+
+    const int cmf = (int)png_bits(z, 8), flg = (int)png_bits(z, 8);
+    int ok = (cmf & 15) == 8 && (cmf * 256 + flg) % 31 == 0 && !(flg & 0x20);
+
+    bool last = !ok;
+    while (!last) {
+        last = png_bits(z, 1) != 0;
+        const int type = (int)png_bits(z, 2);
+        if (type == 0) {
+            png_bits(z, z->bit_count & 7);
+            const uint32_t len = png_bits(z, 16), nlen = png_bits(z, 16);
+            if ((len ^ 0xFFFF) != nlen) {
+                ok = 0;
+                break;
+            }
+            for (uint32_t i = 0; i < len && !z->error; i++) {
+                if (z->out_pos - z->flushed >= INFLATE_FLUSH) png_flush(z);
+                z->window[z->out_pos++ & (INFLATE_WINDOW - 1)] = (unsigned char)png_bits(z, 8);
+            }
+            ok = !png_overrun(z) && !z->error;
+        }
+        else if (type == 1) {
+            ok = inflate_fixed_tables(z) && inflate_codes(z);
+        }
+        else if (type == 2) {
+            ok = inflate_dynamic_tables(z) && inflate_codes(z);
+        }
+        else {
+            ok = 0;
+        }
+        if (!ok) break;
+    }
+    png_flush(z);
+
+    if (ok && !z->error) {
+        // the zlib trailer, big-endian after the last block. one cut off
+        // reads as zeros, which never match
+        png_bits(z, z->bit_count & 7);
+        uint32_t adler = 0;
+        for (int i = 0; i < 4; i++) adler = adler << 8 | png_bits(z, 8);
+        if (adler != z->adler) z->error = "bad zlib checksum";
+    }
+    if (z->error) {
+        s->error = z->error;
+        ok = 0;
+    }
+    ok = ok && z->y == s->height;
+    delete z;
+    return ok;
+}
+
+int image_stream_read(ImageStream* s, ImageRowFunc fn, void* user) {
+    s->error = NULL;
+    int ok = stream_seek(s->fp, s->data_offset, SEEK_SET) == 0;
+    if (ok) {
+        ok = s->format == IMAGE_STREAM_PNG ? png_stream_read(s, fn, user) : pnm_stream_read(s, fn, user);
+    }
+    if (!ok && !s->error) {
+        s->error = "corrupt or truncated data";
+    }
+    return ok;
+}
+
+#endif // IMAGE_STREAM_IMPLEMENTATION
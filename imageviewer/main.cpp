@@ -1,138 +1,765 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <string>
+#include <vector>
 #include <format>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 #define SIXEL_START "\x1bP0;0;8q"
+#define SIXEL_START_TRANSPARENT "\x1bP0;1;8q"
 //#define SIXEL_START "\x1bPq"
-#define SIXEL_END "\x1b\\"
-#define MAX_COLORS 256
+#define SIXEL_IMPLEMENTATION
+#include "sixel.h"
+
+#define QUANTIZE_IMPLEMENTATION
+#include "quantize.h"
+
+#define TERM_PROBE_IMPLEMENTATION
+#define TERM_PROBE_SELF_TEST
+#include "term_probe.h"
+
+#define IMAGE_STREAM_IMPLEMENTATION
+#include "image_stream.h"
+
+#define MAPPED_FILE_IMPLEMENTATION
+#include "mapped_file.h"
+
+#define SIXEL_CACHE_IMPLEMENTATION
+#include "sixel_cache.h"
+
+#define IMAGE_CONVERT_IMPLEMENTATION
+#include "image_convert.h"
+
+// images with more pixels than this are streamed band by band when the
+// format allows, instead of being decoded whole (about 64 MB of RGBA)
+#define STREAM_MIN_PIXELS (4096 * 4096)
+
+// contact sheet cells are a multiple of six pixels high so that grid rows
+// end on sixel band boundaries and can be written as soon as they are done
+#define SHEET_THUMB 128
+#define SHEET_GAP 4
+#define SHEET_COLUMNS 8  // when the terminal doesn't report its size
+
+#define GIF_UNCHANGED 255  // palette index past the end, for pixels a frame leaves alone
+#define GIF_MIN_DELAY 20   // ms; shorter delays get the 100 ms browsers use instead
+
+// every frame is drawn from the cursor position saved before the first one
+#define CURSOR_SAVE    "\x1b" "7"
+#define CURSOR_RESTORE "\x1b" "8"
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "Usage: %s [options] <image-file>\n"
+            "  '-' reads the image from stdin\n"
+            "  --stream    decode and encode six rows at a time, with a fixed palette\n"
+            "              (default for PNG and PNM images over %d megapixels)\n"
+            "  --two-pass  stream twice, building the palette from a histogram first\n"
+            "  --no-stream always load the whole image\n"
+            "  --no-cache  neither use nor fill the cache of encoded images\n"
+            "  --cache-size <MB>  cache limit, least recently viewed go first (default %d)\n"
+            "  --loop <n>  play animated GIFs n times (default: forever on a terminal, else once)\n"
+            "  --background <RRGGBB>  color behind transparent pixels (default: the terminal's)\n"
+            "  --exposure <f>  scales HDR images before tone mapping (default 1)\n"
+            "  --self-test run the terminal probe against scripted replies and exit\n"
+            "A directory or a wildcard pattern such as textures/*.png shows a contact sheet:\n"
+            "  --thumb <px>    thumbnail size (default %d)\n"
+            "  --columns <n>   thumbnails per row (default: as many as fit the terminal)\n",
+            argv0, STREAM_MIN_PIXELS / 1000000, SIXEL_CACHE_DEFAULT_MB, SHEET_THUMB);
+}
+
+// everything written for a single image goes to the cache entry too, if there is one
+static SixelCacheEntry cache_entry;
+
+static void write_output(const char* data, size_t size) {
+    fwrite(data, 1, size, stdout);
+    sixel_cache_append(&cache_entry, data, size);
+}
 
 typedef struct {
-    uint8_t r, g, b;
-    int used;
-} ColorPalette;
+    int width;
+    int rows;                       // rows collected in the current band
+    std::vector<uint8_t> indices;   // 6 rows of palette indices, palette_size where transparent
+    ColorLookup lut;
+    std::string out;
+} SixelBandWriter;
 
-ColorPalette palette[MAX_COLORS];
-int palette_size = 0;
+static void write_band(SixelBandWriter* w) {
+    encode_sixel_band(&w->out, w->indices.data(), w->width, w->rows);
+    write_output(w->out.data(), w->out.size());
+    w->out.clear();
+    w->rows = 0;
+}
 
-int find_closest_color(uint8_t r, uint8_t g, uint8_t b) {
-    int min_dist = 255*3;
-    int index = 0;
+static void quantize_row(void* user, const unsigned char* rgb, const uint8_t* opaque, int y) {
+    (void)y;
+    SixelBandWriter* w = (SixelBandWriter*)user;
+    uint8_t* dst = &w->indices[(size_t)w->rows * w->width];
+    for (int x = 0; x < w->width; x++, rgb += 3) {
+        dst[x] = color_lookup(&w->lut, rgb[0], rgb[1], rgb[2]);
+    }
+    if (opaque) {
+        for (int x = 0; x < w->width; x++) {
+            if (!opaque[x]) dst[x] = (uint8_t)palette_size;
+        }
+    }
+    if (++w->rows == 6) {
+        write_band(w);
+    }
+}
+
+typedef struct {
+    int width;
+    ColorHistogram histogram;
+} HistogramPass;
 
-    for (int i = 0; i < palette_size; i++) {
-        int dr = abs(r - palette[i].r);
-        int dg = abs(g - palette[i].g);
-        int db = abs(b - palette[i].b);
-        int dist = dr + dg + db;
+static void histogram_row(void* user, const unsigned char* rgb, const uint8_t* opaque, int y) {
+    (void)y;
+    HistogramPass* h = (HistogramPass*)user;
+    if (!opaque) {
+        color_histogram_add(&h->histogram, rgb, h->width, 3);
+        return;
+    }
+    for (int x = 0; x < h->width; x++, rgb += 3) {
+        if (opaque[x]) h->histogram.count[quantize_bin(rgb[0], rgb[1], rgb[2])]++;
+    }
+}
 
-        if (dist < min_dist) {
-            min_dist = dist;
-            index = i;
+// never holds more than one band of the image; returns 0 on a decode error
+static int view_streamed(ImageStream* s, bool two_pass) {
+    // transparent pixels take the index after the palette
+    if (s->has_alpha) {
+        set_palette_limit(std::min(palette_limit, 255));
+    }
+    if (two_pass) {
+        HistogramPass* h = new HistogramPass();
+        h->width = s->width;
+        const int ok = image_stream_read(s, histogram_row, h);
+        if (ok) {
+            quantize_median_cut(&h->histogram);
+        }
+        delete h;
+        if (!ok) {
+            return 0;
         }
     }
-    return index;
+    else {
+        quantize_uniform_palette();
+    }
+
+    SixelBandWriter* w = new SixelBandWriter();
+    w->width = s->width;
+    w->rows = 0;
+    w->indices.resize((size_t)6 * s->width);
+    color_lookup_build(&w->lut);
+
+    w->out = encode_sixel_header(s->width, s->height, s->has_alpha);
+    const int ok = image_stream_read(s, quantize_row, w);
+    if (w->rows > 0) {
+        write_band(w);
+    }
+    write_output(SIXEL_END, strlen(SIXEL_END));
+    delete w;
+    return ok;
 }
 
-void generate_palette(unsigned char *data, int width, int height, int channels) {
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            int idx = (i * width + j) * channels;
-            uint8_t r = data[idx];
-            uint8_t g = data[idx + 1];
-            uint8_t b = data[idx + 2];
+// an image with fully transparent pixels: the palette comes from the visible
+// ones and the rest are left out of every color's bits
+static void write_transparent(const unsigned char* img, const uint8_t* opaque, int width, int height) {
+    set_palette_limit(std::min(palette_limit, 255));
+    const size_t pixels = (size_t)width * height;
+    std::vector<unsigned char> visible;
+    visible.reserve(pixels * 3);
+    for (size_t i = 0; i < pixels; i++) {
+        if (opaque[i]) visible.insert(visible.end(), img + i * 3, img + i * 3 + 3);
+    }
+    generate_palette(visible.data(), (int)(visible.size() / 3), 1, 3);
+    static ColorLookup lut;
+    color_lookup_build(&lut);
 
-//            r = (r >> 5) * 36;
-//            g = (g >> 5) * 36;
-//            b = (b >> 6) * 85;
+    std::string out = encode_sixel_header(width, height, true);
+    std::vector<uint8_t> indices((size_t)6 * width);
+    for (int y = 0; y < height; y += 6) {
+        const int rows = std::min(6, height - y);
+        for (size_t i = 0; i < (size_t)rows * width; i++) {
+            const size_t p = (size_t)y * width + i;
+            const unsigned char* c = img + p * 3;
+            indices[i] = opaque[p] ? color_lookup(&lut, c[0], c[1], c[2]) : (uint8_t)palette_size;
+        }
+        encode_sixel_band(&out, indices.data(), width, rows);
+    }
+    out += SIXEL_END;
+    write_output(out.data(), out.size());
+}
 
-            int found = 0;
-            for (int k = 0; k < palette_size; k++) {
-                if (palette[k].r == r && palette[k].g == g && palette[k].b == b) {
-                    found = 1;
-                    break;
-                }
+// 8-bit RGB from 8-bit, 16-bit and HDR images of 1 to 4 channels; free() the result
+// 'opaque' gets one byte per pixel, 0 where it is fully transparent, and is
+// left empty when no pixel is; it may be NULL
+static unsigned char* decode_image_rgb(const unsigned char* data, size_t size, const ImageConvert* convert, int* width, int* height,
+                                       std::vector<uint8_t>* opaque) {
+    const int len = (int)size;
+    int channels;
+    unsigned char* rgb = NULL;
+    size_t transparent = 0;
+    std::vector<uint8_t> mask;
+    if (stbi_is_hdr_from_memory(data, len)) {
+        float* img = stbi_loadf_from_memory(data, len, width, height, &channels, 0);
+        if (img) {
+            rgb = (unsigned char*)malloc((size_t)*width * *height * 3);
+            mask.resize(opaque ? (size_t)*width * *height : 0);
+            transparent = convert_hdr(convert, img, channels, (size_t)*width * *height, rgb, opaque ? mask.data() : NULL);
+            stbi_image_free(img);
+        }
+    }
+    else if (stbi_is_16_bit_from_memory(data, len)) {
+        stbi_us* img = stbi_load_16_from_memory(data, len, width, height, &channels, 0);
+        if (img) {
+            rgb = (unsigned char*)malloc((size_t)*width * *height * 3);
+            mask.resize(opaque ? (size_t)*width * *height : 0);
+            transparent = convert_rgb16(convert, img, channels, (size_t)*width * *height, rgb, opaque ? mask.data() : NULL);
+            stbi_image_free(img);
+        }
+    }
+    else {
+        stbi_uc* img = stbi_load_from_memory(data, len, width, height, &channels, 0);
+        if (img) {
+            rgb = (unsigned char*)malloc((size_t)*width * *height * 3);
+            mask.resize(opaque ? (size_t)*width * *height : 0);
+            transparent = convert_rgb8(convert, img, channels, (size_t)*width * *height, rgb, opaque ? mask.data() : NULL);
+            stbi_image_free(img);
+        }
+    }
+    if (opaque) {
+        opaque->clear();
+        if (transparent > 0) opaque->swap(mask);
+    }
+    return rgb;
+}
+
+// decodes from a mapping of the file where possible, saving stdio's copy of
+// it; stdin, pipes and the like are read into memory first
+static unsigned char* load_image_rgb(const char* path, const ImageConvert* convert, int* width, int* height,
+                                     std::vector<uint8_t>* opaque) {
+    MappedFile file;
+    if (strcmp(path, "-") != 0 && mapped_file_open(&file, path, 1)) {
+        unsigned char* rgb = decode_image_rgb(file.data, file.size, convert, width, height, opaque);
+        mapped_file_close(&file);
+        return rgb;
+    }
+
+    FILE* fp = stdin;
+    if (strcmp(path, "-") == 0) {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    }
+    else if ((fp = fopen(path, "rb")) == NULL) {
+        return stbi_load(path, width, height, NULL, 3);  // for its error message
+    }
+    std::vector<unsigned char> data;
+    unsigned char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    return decode_image_rgb(data.data(), data.size(), convert, width, height, opaque);
+}
+
+typedef struct {
+    int width, height;
+    std::vector<uint8_t> indices;  // of the frame last encoded
+    std::vector<uint8_t> delta;
+    uint8_t background;            // paints pixels that turn transparent
+    ColorLookup lut;
+} GifEncoder;
+
+// the whole frame, or with 'previous' only the pixels whose color changed;
+// the transparent introducer leaves the rest of the screen alone, which also
+// shows the terminal through the GIF's transparent pixels
+static std::string encode_gif_frame(GifEncoder* g, const unsigned char* rgba, const std::vector<uint8_t>* previous) {
+    const size_t pixels = (size_t)g->width * g->height;
+    g->indices.resize(pixels);
+    for (size_t i = 0; i < pixels; i++) {
+        const unsigned char* p = rgba + i * 4;
+        g->indices[i] = p[3] == 0 ? GIF_UNCHANGED : color_lookup(&g->lut, p[0], p[1], p[2]);
+    }
+
+    const uint8_t* indices = g->indices.data();
+    if (previous) {
+        g->delta.resize(pixels);
+        bool changed = false;
+        for (size_t i = 0; i < pixels; i++) {
+            // what a frame painted stays on screen, even where the next one is transparent
+            const bool same = g->indices[i] == (*previous)[i];
+            g->delta[i] = same ? GIF_UNCHANGED : g->indices[i] == GIF_UNCHANGED ? g->background : g->indices[i];
+            changed |= !same;
+        }
+        if (!changed) {
+            return std::string();
+        }
+        indices = g->delta.data();
+    }
+
+    std::string out = encode_sixel_header(g->width, g->height, true);
+    for (int y = 0; y < g->height; y += 6) {
+        encode_sixel_band(&out, indices + (size_t)y * g->width, g->width, std::min(6, g->height - y));
+    }
+    out += SIXEL_END;
+    return out;
+}
+
+// plays an animated GIF 'loops' times, 0 meaning until interrupted; frames
+// are encoded during the first loop and only written out after that.
+// Returns -1 without output for a GIF with a single frame.
+static int play_gif(const unsigned char* data, size_t size, int loops, uint32_t background) {
+    int* delays = NULL;
+    int width, height, frames, channels;
+    unsigned char* pixels = stbi_load_gif_from_memory(data, (int)size, &delays, &width, &height, &frames, &channels, 4);
+    if (!pixels) {
+        fprintf(stderr, "Error loading image: %s\n", stbi_failure_reason());
+        return 1;
+    }
+    if (frames < 2) {
+        stbi_image_free(pixels);
+        free(delays);
+        return -1;
+    }
+
+    // one palette for all frames, so unchanged pixels keep their index
+    const size_t frame_size = (size_t)width * height * 4;
+    ColorHistogram* histogram = new ColorHistogram();
+    for (int f = 0; f < frames; f++) {
+        color_histogram_add(histogram, pixels + f * frame_size, width * height, 4);
+    }
+    set_palette_limit(std::min(palette_limit, (int)GIF_UNCHANGED));
+    quantize_median_cut(histogram);
+    delete histogram;
+
+    GifEncoder* g = new GifEncoder();
+    g->width = width;
+    g->height = height;
+    color_lookup_build(&g->lut);
+    g->background = color_lookup(&g->lut, (uint8_t)(background >> 16), (uint8_t)(background >> 8), (uint8_t)background);
+
+    std::vector<std::string> encoded(frames);
+    std::string wrap;  // last frame back to the first, for every loop after the first
+    std::vector<uint8_t> previous;
+
+    using clock = std::chrono::steady_clock;
+    clock::time_point due = clock::now();
+    fputs(CURSOR_SAVE, stdout);
+    for (int loop = 0; loops == 0 || loop < loops; loop++) {
+        for (int f = 0; f < frames; f++) {
+            const unsigned char* frame = pixels + f * frame_size;
+            if (loop == 0) {
+                encoded[f] = encode_gif_frame(g, frame, f == 0 ? NULL : &previous);
+                previous.swap(g->indices);
+            }
+            else if (loop == 1 && f == 0) {
+                wrap = encode_gif_frame(g, frame, &previous);
+                std::vector<uint8_t>().swap(previous);
             }
 
-            if (!found && palette_size < MAX_COLORS) {
-                palette[palette_size].r = r;
-                palette[palette_size].g = g;
-                palette[palette_size].b = b;
-                palette_size++;
+            const std::string& out = loop > 0 && f == 0 ? wrap : encoded[f];
+            std::this_thread::sleep_until(due);
+            if (!out.empty()) {
+                fputs(CURSOR_RESTORE, stdout);
+                fwrite(out.data(), 1, out.size(), stdout);
+                fflush(stdout);
             }
+            due += std::chrono::milliseconds(delays[f] < GIF_MIN_DELAY ? 100 : delays[f]);
         }
     }
+
+    delete g;
+    stbi_image_free(pixels);
+    free(delays);
+    return 0;
 }
 
-void encode_sixel(unsigned char *img, int width, int height, int channels) {
-    printf(SIXEL_START);
-    printf("\"1;1;%d;%d", width, height);
+typedef struct {
+    std::vector<std::string> paths;
+    int thumb;
+    int cell;
+    int columns;
+    uint8_t background;                       // palette index of the gaps
+    ImageConvert convert;
+    ColorLookup lut;
+    unsigned char* missing;                   // missing_tex.png, drawn for files that don't load
+    int missing_width, missing_height;
+
+    std::atomic<int> next;                    // next path for a worker to take
+    std::mutex lock;
+    std::condition_variable ready;
+    std::vector<std::vector<uint8_t>> cells;  // cell * cell palette indices, empty until done
+} ContactSheet;
+
+static bool match_wildcard(const char* pattern, const char* name) {
+    if (*pattern == '\0') return *name == '\0';
+    if (*pattern == '*') {
+        for (;; name++) {
+            if (match_wildcard(pattern + 1, name)) return true;
+            if (*name == '\0') return false;
+        }
+    }
+    return *name != '\0' && (*pattern == '?' || *pattern == *name) && match_wildcard(pattern + 1, name + 1);
+}
 
-    for (int i = 0; i < palette_size; i++) {
-        printf("#%d;2;%d;%d;%d", i,
-               palette[i].r * 100 / 255,
-               palette[i].g * 100 / 255,
-               palette[i].b * 100 / 255);
+// the images of a directory, or the files matching a pattern in its last component
+static bool list_sheet_paths(const char* arg, std::vector<std::string>* paths) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    const fs::path path(arg);
+    const std::string name = path.filename().string();
+    const bool pattern = name.find_first_of("*?") != std::string::npos;
+    if (!pattern && !fs::is_directory(path, ec)) {
+        return false;
     }
 
-    for (int y = 0; y < height; y += 6) {
-        std::string band_height_str;
+    static const char* const extensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ".tga", ".gif",
+                                              ".psd", ".hdr", ".pic", ".pnm", ".ppm", ".pgm" };
+    const fs::path dir = pattern ? (path.has_parent_path() ? path.parent_path() : fs::path(".")) : path;
+    for (const fs::directory_entry& entry : fs::directory_iterator(dir, ec)) {
+        if (!entry.is_regular_file(ec)) continue;
+        const std::string file = entry.path().filename().string();
+        if (pattern) {
+            if (!match_wildcard(name.c_str(), file.c_str())) continue;
+        }
+        else {
+            std::string ext = entry.path().extension().string();
+            std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)tolower(c); });
+            if (std::find_if(std::begin(extensions), std::end(extensions),
+                             [&](const char* e) { return ext == e; }) == std::end(extensions)) continue;
+        }
+        paths->push_back(entry.path().string());
+    }
+    std::sort(paths->begin(), paths->end());
+    return true;
+}
+
+// box filter down (or nearest neighbour up) to fit the thumbnail, centered in the cell
+static void draw_thumbnail(ContactSheet* sheet, const unsigned char* img, int width, int height, uint8_t* cell) {
+    int tw = sheet->thumb, th = sheet->thumb;
+    if (width > height) th = std::max(1, (int)((long long)height * sheet->thumb / width));
+    else                tw = std::max(1, (int)((long long)width * sheet->thumb / height));
+    const int ox = (sheet->cell - tw) / 2, oy = (sheet->cell - th) / 2;
+
+    for (int ty = 0; ty < th; ty++) {
+        const int y0 = (int)((long long)ty * height / th);
+        const int y1 = std::max(y0 + 1, (int)((long long)(ty + 1) * height / th));
+        uint8_t* dst = cell + (size_t)(oy + ty) * sheet->cell + ox;
+        for (int tx = 0; tx < tw; tx++) {
+            const int x0 = (int)((long long)tx * width / tw);
+            const int x1 = std::max(x0 + 1, (int)((long long)(tx + 1) * width / tw));
+            uint32_t sum[3] = {};
+            for (int y = y0; y < y1; y++) {
+                const unsigned char* p = img + ((size_t)y * width + x0) * 3;
+                for (int x = x0; x < x1; x++, p += 3) {
+                    sum[0] += p[0];
+                    sum[1] += p[1];
+                    sum[2] += p[2];
+                }
+            }
+            const uint32_t n = (uint32_t)(y1 - y0) * (x1 - x0);
+            dst[tx] = color_lookup(&sheet->lut, (uint8_t)(sum[0] / n), (uint8_t)(sum[1] / n), (uint8_t)(sum[2] / n));
+        }
+    }
+}
 
-        int band_height = (height - y) < 6 ? (height - y) : 6;
+static void sheet_worker(ContactSheet* sheet) {
+    for (;;) {
+        // in order, so the first grid row is ready as early as possible
+        const int i = sheet->next++;
+        if (i >= (int)sheet->paths.size()) {
+            return;
+        }
+        std::vector<uint8_t> cell((size_t)sheet->cell * sheet->cell, sheet->background);
+        int width, height;
+        unsigned char* img = load_image_rgb(sheet->paths[i].c_str(), &sheet->convert, &width, &height, NULL);
+        if (img) {
+            draw_thumbnail(sheet, img, width, height, cell.data());
+            free(img);
+        }
+        else {
+            fprintf(stderr, "%s: %s\n", sheet->paths[i].c_str(), stbi_failure_reason());
+            if (sheet->missing) {
+                draw_thumbnail(sheet, sheet->missing, sheet->missing_width, sheet->missing_height, cell.data());
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(sheet->lock);
+        sheet->cells[i].swap(cell);
+        sheet->ready.notify_all();
+    }
+}
 
-        for (int c = 0; c < palette_size; c++) {
-            band_height_str += std::format("#{:d}", c);
+// one sixel image for all thumbnails, written a grid row at a time as they finish
+static void view_contact_sheet(ContactSheet* sheet, const char* argv0, const TermCaps* caps) {
+    const int count = (int)sheet->paths.size();
+    sheet->cell = (sheet->thumb + SHEET_GAP + 5) / 6 * 6;
+    if (sheet->columns <= 0) {
+        sheet->columns = caps->window_width >= sheet->cell ? caps->window_width / sheet->cell : SHEET_COLUMNS;
+    }
+    sheet->columns = std::min(sheet->columns, count);
+    const int grid_rows = (count + sheet->columns - 1) / sheet->columns;
+    const int width = sheet->columns * sheet->cell;
 
-            for (int x = 0; x < width; x++) {
-                uint8_t sixel_byte = 0;
+    quantize_uniform_palette();
+    color_lookup_build(&sheet->lut);
+    const uint32_t bg = sheet->convert.background;
+    sheet->background = color_lookup(&sheet->lut, (uint8_t)(bg >> 16), (uint8_t)(bg >> 8), (uint8_t)bg);
 
-                for (int dy = 0; dy < band_height; dy++) {
-                    int current_y = y + dy;
-                    if (current_y >= height) break;
+    const std::filesystem::path missing = std::filesystem::path(argv0).parent_path() / "missing_tex.png";
+    int channels;
+    sheet->missing = stbi_load(missing.string().c_str(), &sheet->missing_width, &sheet->missing_height, &channels, 3);
 
-                    int idx = (current_y * width + x) * channels;
-                    uint8_t r = img[idx];
-                    uint8_t g = img[idx + 1];
-                    uint8_t b = img[idx + 2];
+    sheet->cells.resize(count);
+    sheet->next = 0;
+    std::vector<std::thread> workers;
+    const int threads = std::max(1, std::min((int)std::thread::hardware_concurrency(), count));
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back(sheet_worker, sheet);
+    }
 
-                    int color_idx = find_closest_color(r, g, b);
-                    if (color_idx == c) {
-                        sixel_byte |= (1 << dy);
-                    }
+    std::string out = encode_sixel_header(width, grid_rows * sheet->cell);
+    std::vector<uint8_t> band((size_t)6 * width);
+    for (int row = 0; row < grid_rows; row++) {
+        const int first = row * sheet->columns;
+        const int last = std::min(first + sheet->columns, count);
+        {
+            std::unique_lock<std::mutex> guard(sheet->lock);
+            sheet->ready.wait(guard, [&] {
+                for (int i = first; i < last; i++) {
+                    if (sheet->cells[i].empty()) return false;
                 }
+                return true;
+            });
+        }
 
-                band_height_str += char(sixel_byte + 0x3F);
+        for (int y = 0; y < sheet->cell; y += 6) {
+            for (int dy = 0; dy < 6; dy++) {
+                for (int c = 0; c < sheet->columns; c++) {
+                    uint8_t* dst = &band[(size_t)dy * width + (size_t)c * sheet->cell];
+                    if (first + c < last) memcpy(dst, &sheet->cells[first + c][(size_t)(y + dy) * sheet->cell], sheet->cell);
+                    else                  memset(dst, sheet->background, sheet->cell);
+                }
             }
-            band_height_str += "$";
+            encode_sixel_band(&out, band.data(), width, 6);
+        }
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+        out.clear();
+
+        std::lock_guard<std::mutex> guard(sheet->lock);
+        for (int i = first; i < last; i++) {
+            std::vector<uint8_t>().swap(sheet->cells[i]);
         }
-        band_height_str += "-";
-        printf(band_height_str.c_str());
     }
+    fputs(SIXEL_END, stdout);
 
-    printf(SIXEL_END);
+    for (std::thread& t : workers) {
+        t.join();
+    }
+    if (sheet->missing) {
+        stbi_image_free(sheet->missing);
+    }
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <image-file>\n", argv[0]);
+    int stream = -1;  // -1 decides by image size
+    bool two_pass = false;
+    int thumb = SHEET_THUMB;
+    int columns = 0;
+    bool use_cache = true;
+    int cache_mb = SIXEL_CACHE_DEFAULT_MB;
+    int loops = -1;
+    int background = -1;  // 0xRRGGBB, -1 asks the terminal
+    float exposure = 1.0f;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stream") == 0) {
+            stream = 1;
+        }
+        else if (strcmp(argv[i], "--two-pass") == 0) {
+            stream = 1;
+            two_pass = true;
+        }
+        else if (strcmp(argv[i], "--no-stream") == 0) {
+            stream = 0;
+        }
+        else if (strcmp(argv[i], "--thumb") == 0 && i + 1 < argc) {
+            thumb = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--columns") == 0 && i + 1 < argc) {
+            columns = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--no-cache") == 0) {
+            use_cache = false;
+        }
+        else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            cache_mb = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--loop") == 0 && i + 1 < argc) {
+            loops = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--background") == 0 && i + 1 < argc) {
+            background = (int)(strtoul(argv[++i], NULL, 16) & 0xFFFFFF);
+        }
+        else if (strcmp(argv[i], "--exposure") == 0 && i + 1 < argc) {
+            exposure = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--self-test") == 0) {
+            const int failures = term_probe_self_test(stderr);
+            printf("term_probe: %d failed checks\n", failures);
+            return failures ? 1 : 0;
+        }
+        else if ((argv[i][0] == '-' && argv[i][1] != '\0') || path != NULL) {
+            usage(argv[0]);
+            return 1;
+        }
+        else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL || thumb <= 0) {
+        usage(argv[0]);
         return 1;
     }
 
-    int width, height, channels;
-    unsigned char *img = stbi_load(argv[1], &width, &height, &channels, 0);
+    // stay within the terminal's color registers, when it tells us how many it has.
+    // only the first run in a window talks to the terminal, later ones are
+    // answered from the probe's cache
+    TermCaps caps;
+    if (term_probe_console(&caps, 0) && caps.color_registers > 0) {
+        set_palette_limit(caps.color_registers);
+    }
+
+    // transparent pixels are blended over the terminal's own background
+    ImageConvert convert;
+    convert.background = background >= 0 ? (uint32_t)background : caps.has_background ? caps.background : 0;
+    convert.exposure = exposure;
+
+    // with the probe out of the way a hit costs one pass over the file to hash
+    // it and one write
+    SixelCache cache;
+    if (use_cache && cache_mb > 0 && strcmp(path, "-") != 0 && sixel_cache_open(&cache, (uint64_t)cache_mb << 20)) {
+        MappedFile file;
+        if (mapped_file_open(&file, path, 1)) {
+            // GIFs are played below rather than encoded once, so never cached
+            const bool gif = file.size >= 6 && memcmp(file.data, "GIF8", 4) == 0;
+            uint64_t key = 0;
+            if (!gif) {
+                const std::string settings = std::format("{};{:d};{:d};{:d};{:06x};{}", SIXEL_START, palette_limit, stream,
+                                                         two_pass, convert.background, convert.exposure);
+                key = sixel_cache_key(file.data, file.size, settings);
+            }
+            mapped_file_close(&file);
+            if (!gif) {
+                if (sixel_cache_serve(&cache, key, stdout)) {
+                    return 0;
+                }
+                sixel_cache_begin(&cache, key, &cache_entry);
+            }
+        }
+    }
+
+    ContactSheet* sheet = new ContactSheet();
+    if (list_sheet_paths(path, &sheet->paths)) {
+        if (sheet->paths.empty()) {
+            fprintf(stderr, "No images in %s\n", path);
+            delete sheet;
+            return 1;
+        }
+        sheet->thumb = thumb;
+        sheet->columns = columns;
+        sheet->convert = convert;
+        view_contact_sheet(sheet, argv[0], &caps);
+        delete sheet;
+        return 0;
+    }
+    delete sheet;
+
+    // animations are played here, a GIF with one frame is shown like any other image
+    if (strcmp(path, "-") != 0) {
+        MappedFile file;
+        if (mapped_file_open(&file, path, 1)) {
+            int result = -1;
+            if (file.size >= 6 && memcmp(file.data, "GIF8", 4) == 0) {
+#ifdef _WIN32
+                const bool terminal = _isatty(_fileno(stdout));
+#else
+                const bool terminal = isatty(fileno(stdout));
+#endif
+                result = play_gif(file.data, file.size, loops >= 0 ? loops : terminal ? 0 : 1, convert.background);
+            }
+            mapped_file_close(&file);
+            if (result >= 0) {
+                return result;
+            }
+        }
+    }
+
+    if (stream != 0 && strcmp(path, "-") != 0) {
+        ImageStream s;
+        if (image_stream_open(&s, path)) {
+            s.background = convert.background;
+            if (stream == 1 || (long long)s.width * s.height > STREAM_MIN_PIXELS) {
+                const int ok = view_streamed(&s, two_pass);
+                image_stream_close(&s);
+                if (!ok) {
+                    fprintf(stderr, "Error loading image: %s\n", s.error);
+                    sixel_cache_abort(&cache_entry);
+                    return 1;
+                }
+                sixel_cache_commit(&cache, &cache_entry);
+                return 0;
+            }
+            image_stream_close(&s);
+        }
+        else if (stream == 1) {
+            fprintf(stderr, "Streaming needs a non-interlaced PNG or a binary PNM, loading the whole image\n");
+        }
+    }
+
+    int width, height;
+    std::vector<uint8_t> opaque;
+    unsigned char *img = load_image_rgb(path, &convert, &width, &height, &opaque);
     if (!img) {
         fprintf(stderr, "Error loading image: %s\n", stbi_failure_reason());
+        sixel_cache_abort(&cache_entry);
         return 1;
     }
 
-    generate_palette(img, width, height, channels);
-
-    encode_sixel(img, width, height, channels);
+    if (opaque.empty()) {
+        generate_palette(img, width, height, 3);
+        std::string result = encode_sixel(img, width, height, 3);
+        write_output(result.data(), result.size());
+    }
+    else {
+        write_transparent(img, opaque.data(), width, height);
+    }
+    sixel_cache_commit(&cache, &cache_entry);
 
-    stbi_image_free(img);
+    free(img);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,117 @@
+// mapped_file.h - read-only memory mapping of whole files
+//
+// Single-header library: define MAPPED_FILE_IMPLEMENTATION in exactly one
+// translation unit before including it.
+//
+// Images are decoded straight from the page cache instead of being copied
+// through stdio buffers first. Only regular files are mapped: pipes, ttys,
+// empty files and files too large for the decoder make mapped_file_open fail,
+// and the caller reads them the usual way.
+
+#pragma once
+
+#include <stddef.h>
+
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+#ifdef _WIN32
+    void* file;
+    void* mapping;
+#endif
+} MappedFile;
+
+// 'sequential' tells the OS the file is read front to back once, so it reads ahead aggressively
+int mapped_file_open(MappedFile* m, const char* path, int sequential);
+void mapped_file_close(MappedFile* m);
+
+#ifdef MAPPED_FILE_IMPLEMENTATION
+
+#include <limits.h>
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+int mapped_file_open(MappedFile* m, const char* path, int sequential) {
+    m->data = NULL;
+    m->size = 0;
+    m->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                          sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL, NULL);
+    if (m->file == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    LARGE_INTEGER size;
+    if (GetFileType(m->file) != FILE_TYPE_DISK || !GetFileSizeEx(m->file, &size) ||
+        size.QuadPart <= 0 || size.QuadPart > INT_MAX) {
+        CloseHandle(m->file);
+        return 0;
+    }
+    m->mapping = CreateFileMappingA(m->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m->mapping == NULL) {
+        CloseHandle(m->file);
+        return 0;
+    }
+    m->data = (const unsigned char*)MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (m->data == NULL) {
+        CloseHandle(m->mapping);
+        CloseHandle(m->file);
+        return 0;
+    }
+    m->size = (size_t)size.QuadPart;
+    return 1;
+}
+
+void mapped_file_close(MappedFile* m) {
+    if (m->data) {
+        UnmapViewOfFile(m->data);
+        CloseHandle(m->mapping);
+        CloseHandle(m->file);
+        m->data = NULL;
+    }
+}
+
+#else
+
+int mapped_file_open(MappedFile* m, const char* path, int sequential) {
+    m->data = NULL;
+    m->size = 0;
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 || st.st_size > INT_MAX) {
+        close(fd);
+        return 0;
+    }
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file referenced
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+    if (sequential) {
+        madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+    }
+    m->data = (const unsigned char*)data;
+    m->size = (size_t)st.st_size;
+    return 1;
+}
+
+void mapped_file_close(MappedFile* m) {
+    if (m->data) {
+        munmap((void*)m->data, m->size);
+        m->data = NULL;
+    }
+}
+
+#endif
+
+#endif // MAPPED_FILE_IMPLEMENTATION
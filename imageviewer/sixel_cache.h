@@ -0,0 +1,304 @@
+// sixel_cache.h - encoded images kept on disk between runs
+//
+// Single-header library: define SIXEL_CACHE_IMPLEMENTATION in exactly one
+// translation unit before including it. That translation unit also needs the
+// implementation of mapped_file.h.
+//
+// Entries are named after the XXH64 of the image file's bytes followed by a
+// string of everything else that changes the output (encoder settings, color
+// registers), so an edited file or a different terminal simply misses. A hit
+// maps the entry and writes it out as is. Entries are written under a
+// temporary name of their own per process and renamed once complete, so two
+// viewers encoding the same image never write into one file. Every hit
+// refreshes the entry's modification time, and after each new entry the
+// oldest ones are deleted until the directory is back under its size limit.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#define SIXEL_CACHE_DEFAULT_MB 256
+
+typedef struct {
+    std::string dir;     // empty if there is nowhere to put the cache
+    uint64_t max_bytes;
+} SixelCache;
+
+typedef struct {
+    FILE* fp;
+    std::string tmp_path, path;
+} SixelCacheEntry;
+
+// <user cache dir>/hello_sixel/sixel, next to the terminal capability cache
+int sixel_cache_open(SixelCache* c, uint64_t max_bytes);
+uint64_t sixel_cache_key(const unsigned char* data, size_t size, const std::string& settings);
+// writes the entry to 'out'; returns 0 on a miss
+int sixel_cache_serve(SixelCache* c, uint64_t key, FILE* out);
+int sixel_cache_begin(SixelCache* c, uint64_t key, SixelCacheEntry* e);
+void sixel_cache_append(SixelCacheEntry* e, const char* data, size_t size);
+// publishes the entry and evicts the least recently used ones over the limit
+void sixel_cache_commit(SixelCache* c, SixelCacheEntry* e);
+void sixel_cache_abort(SixelCacheEntry* e);
+
+#ifdef SIXEL_CACHE_IMPLEMENTATION
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <vector>
+#ifdef _WIN32
+# include <process.h>
+#else
+# include <unistd.h>
+#endif
+
+#include "mapped_file.h"
+
+// ---- XXH64 ----
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ull
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define XXH_PRIME64_3 0x165667B19E3779F9ull
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ull
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ull
+
+typedef struct {
+    uint64_t v[4];
+    uint64_t total;
+    unsigned char buf[32];
+    size_t buf_len;
+} Xxh64State;
+
+static inline uint64_t xxh_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);  // little endian hosts only, like everything else here
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME64_2;
+    return xxh_rotl(acc, 31) * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh_round(0, v);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static void xxh64_init(Xxh64State* s, uint64_t seed) {
+    s->v[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    s->v[1] = seed + XXH_PRIME64_2;
+    s->v[2] = seed;
+    s->v[3] = seed - XXH_PRIME64_1;
+    s->total = 0;
+    s->buf_len = 0;
+}
+
+static void xxh64_update(Xxh64State* s, const unsigned char* p, size_t len) {
+    s->total += len;
+    if (s->buf_len + len < 32) {
+        memcpy(s->buf + s->buf_len, p, len);
+        s->buf_len += len;
+        return;
+    }
+    if (s->buf_len) {
+        const size_t fill = 32 - s->buf_len;
+        memcpy(s->buf + s->buf_len, p, fill);
+        for (int i = 0; i < 4; i++) s->v[i] = xxh_round(s->v[i], xxh_read64(s->buf + i * 8));
+        p += fill;
+        len -= fill;
+        s->buf_len = 0;
+    }
+    uint64_t v0 = s->v[0], v1 = s->v[1], v2 = s->v[2], v3 = s->v[3];
+    for (; len >= 32; p += 32, len -= 32) {
+        v0 = xxh_round(v0, xxh_read64(p));
+        v1 = xxh_round(v1, xxh_read64(p + 8));
+        v2 = xxh_round(v2, xxh_read64(p + 16));
+        v3 = xxh_round(v3, xxh_read64(p + 24));
+    }
+    s->v[0] = v0; s->v[1] = v1; s->v[2] = v2; s->v[3] = v3;
+    memcpy(s->buf, p, len);
+    s->buf_len = len;
+}
+
+static uint64_t xxh64_digest(const Xxh64State* s) {
+    uint64_t h;
+    if (s->total >= 32) {
+        h = xxh_rotl(s->v[0], 1) + xxh_rotl(s->v[1], 7) + xxh_rotl(s->v[2], 12) + xxh_rotl(s->v[3], 18);
+        for (int i = 0; i < 4; i++) h = xxh_merge(h, s->v[i]);
+    }
+    else {
+        h = s->v[2] + XXH_PRIME64_5;
+    }
+    h += s->total;
+
+    const unsigned char* p = s->buf;
+    size_t len = s->buf_len;
+    for (; len >= 8; p += 8, len -= 8) {
+        h ^= xxh_round(0, xxh_read64(p));
+        h = xxh_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (len >= 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        h ^= (uint64_t)v * XXH_PRIME64_1;
+        h = xxh_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+        len -= 4;
+    }
+    for (; len > 0; p++, len--) {
+        h ^= *p * XXH_PRIME64_5;
+        h = xxh_rotl(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// ---- cache ----
+
+int sixel_cache_open(SixelCache* c, uint64_t max_bytes) {
+    namespace fs = std::filesystem;
+    c->dir.clear();
+    c->max_bytes = max_bytes;
+#ifdef _WIN32
+    const char* base = getenv("LOCALAPPDATA");
+    if (base == NULL) return 0;
+    fs::path dir = fs::path(base) / "hello_sixel" / "sixel";
+#else
+    fs::path dir;
+    if (const char* xdg = getenv("XDG_CACHE_HOME")) dir = xdg;
+    else if (const char* home = getenv("HOME")) dir = fs::path(home) / ".cache";
+    else return 0;
+    dir = dir / "hello_sixel" / "sixel";
+#endif
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (!fs::is_directory(dir, ec)) return 0;
+    c->dir = dir.string();
+    return 1;
+}
+
+uint64_t sixel_cache_key(const unsigned char* data, size_t size, const std::string& settings) {
+    Xxh64State s;
+    xxh64_init(&s, 0);
+    xxh64_update(&s, data, size);
+    xxh64_update(&s, (const unsigned char*)settings.data(), settings.size());
+    return xxh64_digest(&s);
+}
+
+static std::string sixel_cache_path(const SixelCache* c, uint64_t key) {
+    return (std::filesystem::path(c->dir) / std::format("{:016x}.six", key)).string();
+}
+
+int sixel_cache_serve(SixelCache* c, uint64_t key, FILE* out) {
+    if (c->dir.empty()) return 0;
+    const std::string path = sixel_cache_path(c, key);
+    MappedFile entry;
+    if (!mapped_file_open(&entry, path.c_str(), 1)) {
+        return 0;
+    }
+    fwrite(entry.data, 1, entry.size, out);
+    mapped_file_close(&entry);
+
+    // the modification time is the entry's last use
+    std::error_code ec;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+    return 1;
+}
+
+int sixel_cache_begin(SixelCache* c, uint64_t key, SixelCacheEntry* e) {
+    e->fp = NULL;
+    if (c->dir.empty()) return 0;
+    e->path = sixel_cache_path(c, key);
+#ifdef _WIN32
+    e->tmp_path = std::format("{}.{:d}.tmp", e->path, _getpid());
+#else
+    e->tmp_path = std::format("{}.{:d}.tmp", e->path, (int)getpid());
+#endif
+    e->fp = fopen(e->tmp_path.c_str(), "wb");
+    return e->fp != NULL;
+}
+
+void sixel_cache_append(SixelCacheEntry* e, const char* data, size_t size) {
+    if (e->fp && fwrite(data, 1, size, e->fp) != size) {
+        sixel_cache_abort(e);
+    }
+}
+
+void sixel_cache_abort(SixelCacheEntry* e) {
+    if (e->fp) {
+        fclose(e->fp);
+        e->fp = NULL;
+        remove(e->tmp_path.c_str());
+    }
+}
+
+void sixel_cache_commit(SixelCache* c, SixelCacheEntry* e) {
+    namespace fs = std::filesystem;
+    if (!e->fp) return;
+    const bool written = fclose(e->fp) == 0;
+    e->fp = NULL;
+    std::error_code ec;
+    if (!written) {
+        fs::remove(e->tmp_path, ec);
+        return;
+    }
+    fs::rename(e->tmp_path, e->path, ec);
+    if (ec) {
+        fs::remove(e->tmp_path, ec);
+        return;
+    }
+
+    typedef struct {
+        fs::file_time_type used;
+        uint64_t size;
+        fs::path path;
+    } CacheFile;
+    std::vector<CacheFile> files;
+    uint64_t total = 0;
+    const fs::file_time_type now = fs::file_time_type::clock::now();
+    // other viewers rename and evict entries while this one looks, so the
+    // iterator is advanced by hand: its operator++ throws when that bites, and
+    // entries that vanished in between are skipped
+    fs::directory_iterator it(c->dir, ec);
+    for (; !ec && it != fs::directory_iterator(); it.increment(ec)) {
+        const fs::directory_entry& entry = *it;
+        std::error_code entry_ec;
+        if (entry.path().extension() == ".tmp") {
+            // left behind by a viewer that died mid-write, a live one is never this old
+            const fs::file_time_type modified = entry.last_write_time(entry_ec);
+            if (!entry_ec && now - modified > std::chrono::hours(1)) fs::remove(entry.path(), entry_ec);
+            continue;
+        }
+        if (entry.path().extension() != ".six") continue;
+        const fs::file_time_type used = entry.last_write_time(entry_ec);
+        if (entry_ec) continue;
+        const uintmax_t size = entry.file_size(entry_ec);
+        if (entry_ec) continue;
+        files.push_back({ used, (uint64_t)size, entry.path() });
+        total += size;
+    }
+    if (total <= c->max_bytes) return;
+
+    std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) { return a.used < b.used; });
+    for (const CacheFile& f : files) {
+        if (total <= c->max_bytes) break;
+        if (fs::remove(f.path, ec)) total -= f.size;
+    }
+}
+
+#endif // SIXEL_CACHE_IMPLEMENTATION
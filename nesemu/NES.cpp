@@ -73,6 +73,8 @@
 // scouring every inch of, especially to figure out the mappers and PPU.
 //
 
+#define AUDIO_RING_IMPLEMENTATION
+#define BLIP_BUFFER_IMPLEMENTATION
 #include "NES.h"
 
 constexpr float pulse_tbl[] = { 0.0f, 0.01160913892f, 0.02293948084f, 0.03400094807f, 0.04480300099f, 0.05535465851f, 0.0656645298f, 0.07574082166f, 0.08559139818f, 0.09522374719f, 0.1046450436f, 0.1138621494f, 0.1228816435f, 0.1317097992f, 0.1403526366f, 0.1488159597f, 0.1571052521f, 0.1652258784f, 0.1731829196f, 0.1809812635f, 0.188625589f, 0.1961204559f, 0.2034701705f, 0.2106789351f, 0.2177507579f, 0.2246894985f, 0.2314988673f, 0.2381824702f, 0.2447437793f, 0.2511860728f, 0.2575125694f, 0.2637263834f };
@@ -91,11 +93,15 @@ constexpr uint8_t tri_tbl[] = {
 	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
 };
 
-void spritePixel(PPU* ppu, uint8_t& i, uint8_t& sprite) {
+// sprite_line entries: the sprite pixel (palette bits and color) and these
+constexpr uint8_t sprite_behind = 0x20; // background priority
+constexpr uint8_t sprite_zero = 0x40;   // the pixel belongs to sprite 0
+
+void spritePixel(PPU* ppu, int x, uint8_t& i, uint8_t& sprite) {
 	i = sprite = 0;
 	if (ppu->flag_show_sprites == 0) return;
 	for (i = 0; i < ppu->sprite_cnt; ++i) {
-		int offset = (ppu->cycle - 1) - static_cast<int>(ppu->sprite_pos[i]);
+		int offset = x - static_cast<int>(ppu->sprite_pos[i]);
 		if (offset < 0 || offset > 7) continue;
 		offset = 7 - offset;
 		sprite = static_cast<uint8_t>((ppu->sprite_patterns[i] >> static_cast<uint8_t>(offset << 2)) & 0x0F);
@@ -105,6 +111,161 @@ void spritePixel(PPU* ppu, uint8_t& i, uint8_t& sprite) {
 	return;
 }
 
+// draw the sprites picked for the line into sprite_line, resolved the way
+// spritePixel resolves each pixel: the first of them with an opaque pixel there wins
+static void rasterizeSprites(PPU* ppu) {
+	memset(ppu->sprite_line, 0, 256);
+	// last to first, so earlier sprites overwrite later ones
+	for (int i = ppu->sprite_cnt - 1; i >= 0; --i) {
+		const uint32_t pattern = ppu->sprite_patterns[i];
+		const uint8_t flags = (ppu->sprite_priorities[i] != 0 ? sprite_behind : 0) | (ppu->sprite_idx[i] == 0 ? sprite_zero : 0);
+		const int pos = ppu->sprite_pos[i];
+		const int width = std::min(8, 256 - pos);
+		for (int j = 0; j < width; ++j) {
+			const uint8_t pixel = static_cast<uint8_t>((pattern >> (28 - 4 * j)) & 0x0F);
+			if ((pixel & 3) != 0) {
+				ppu->sprite_line[pos + j] = pixel | flags;
+			}
+		}
+	}
+}
+
+// palette index of pixel x from the background pixel and the sprites on the line.
+// also where sprite zero hits
+static inline uint8_t composePixel(PPU* ppu, int x, uint8_t background) {
+	uint8_t sprite = 0;
+	uint8_t flags = 0;
+	if (ppu->reference) {
+		uint8_t i;
+		spritePixel(ppu, x, i, sprite);
+		flags = (ppu->sprite_priorities[i] != 0 ? sprite_behind : 0) | (ppu->sprite_idx[i] == 0 ? sprite_zero : 0);
+	}
+	else if (ppu->flag_show_sprites != 0) {
+		sprite = ppu->sprite_line[x] & 0x0F;
+		flags = ppu->sprite_line[x];
+	}
+
+	if (x < 8 && ppu->flag_show_left_background == 0) {
+		background = 0;
+	}
+	if (x < 8 && ppu->flag_show_left_sprites == 0) {
+		sprite = 0;
+	}
+
+	const bool b = (background & 3) != 0;
+	const bool s = (sprite & 3) != 0;
+
+	uint8_t color = 0;
+	if (!b && !s) {
+		color = 0;
+	}
+	else if (!b && s) {
+		color = sprite | 0x10;
+	}
+	else if (b && !s) {
+		color = background;
+	}
+	else {
+		if ((flags & sprite_zero) != 0 && x < 255) {
+			ppu->flag_sprite_zero_hit = 1;
+		}
+		if ((flags & sprite_behind) == 0) {
+			color = sprite | 0x10;
+		}
+		else {
+			color = background;
+		}
+	}
+	return color;
+}
+
+// coarse X, wrapping into the next nametable
+static inline void incrementX(PPU* ppu) {
+	if ((ppu->v & 0x001F) == 31) {
+		// coarse X = 0
+		ppu->v &= 0xFFE0;
+		// switch horizontal nametable
+		ppu->v ^= 0x0400;
+	}
+	else {
+		// increment coarse X
+		++ppu->v;
+	}
+}
+
+// fine Y, then coarse Y, wrapping into the next nametable
+static inline void incrementY(PPU* ppu) {
+	if ((ppu->v & 0x7000) != 0x7000) {
+		ppu->v += 0x1000;
+	}
+	else {
+		ppu->v &= 0x8FFF;
+		uint16_t y = (ppu->v & 0x03E0) >> 5;
+		if (y == 29) {
+			y = 0;
+			ppu->v ^= 0x0800;
+		}
+		else if (y == 31) {
+			y = 0;
+		}
+		else {
+			++y;
+		}
+		ppu->v = (ppu->v & 0xFC1F) | (y << 5);
+	}
+}
+
+// decode the 16 bytes of a CHR tile into its rows, as is and mirrored
+static void decodeTile(NES* nes, PatternCache* cache, int tile) {
+	const uint16_t address = static_cast<uint16_t>(tile << 4);
+	for (int row = 0; row < 8; ++row) {
+		const uint8_t low = readPPU(nes, address + row);
+		const uint8_t high = readPPU(nes, address + row + 8);
+		uint32_t pixels = 0;
+		uint32_t mirrored = 0;
+		for (int i = 0; i < 8; ++i) {
+			const uint32_t p = ((low >> (7 - i)) & 1) | (((high >> (7 - i)) & 1) << 1);
+			pixels |= p << (28 - 4 * i);
+			mirrored |= p << (4 * i);
+		}
+		cache->rows[tile][0][row] = pixels;
+		cache->rows[tile][1][row] = mirrored;
+	}
+	cache->valid[tile] = true;
+}
+
+// the pattern row at 'address' (tile << 4 | row, row 0-7), one nibble per pixel
+static inline uint32_t patternRow(NES* nes, PPU* ppu, uint16_t address, bool mirrored) {
+	const int tile = (address >> 4) & 511;
+	if (!ppu->patterns.valid[tile]) {
+		decodeTile(nes, &ppu->patterns, tile);
+	}
+	return ppu->patterns.rows[tile][mirrored][address & 7];
+}
+
+// the same row read from CHR on every call, the way the reference PPU does
+// all its fetches, so --ppu-dots doesn't go through the cache it checks
+static uint32_t readPatternRow(NES* nes, uint16_t address, bool mirrored) {
+	const uint8_t low = readPPU(nes, address);
+	const uint8_t high = readPPU(nes, address + 8);
+	uint32_t pixels = 0;
+	for (int i = 0; i < 8; ++i) {
+		const int bit = mirrored ? i : 7 - i;
+		const uint32_t p = ((low >> bit) & 1) | (((high >> bit) & 1) << 1);
+		pixels |= p << (28 - 4 * i);
+	}
+	return pixels;
+}
+
+// CHR at pattern addresses 'address' to 'address + size' changed
+void invalidatePatterns(PPU* ppu, uint16_t address, int size) {
+	const int first = (address >> 4) & 511;
+	const int last = ((address + size - 1) >> 4) & 511;
+	for (int tile = first; tile <= last; ++tile) {
+		ppu->patterns.valid[tile] = false;
+	}
+}
+
 void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
 	if (ppu->nmi_delay > 0) {
 		ppu->nmi_delay--;
@@ -142,8 +303,8 @@ void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
 
 	if (do_render) {
 		if (line_visible && cycle_visible) {
-			int x = ppu->cycle - 1;
-			int y = ppu->scanline;
+			const int x = ppu->cycle - 1;
+			const int y = ppu->scanline;
 
 			uint8_t background = 0;
 			if (ppu->flag_show_background != 0) {
@@ -151,41 +312,7 @@ void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
 				background = static_cast<uint8_t>(data & 0x0F);
 			}
 
-			uint8_t i, sprite;
-			spritePixel(ppu, i, sprite);
-
-			if (x < 8 && ppu->flag_show_left_background == 0) {
-				background = 0;
-			}
-			if (x < 8 && ppu->flag_show_left_sprites == 0) {
-				sprite = 0;
-			}
-
-			const bool b = (background & 3) != 0;
-			const bool s = (sprite & 3) != 0;
-
-			uint8_t color = 0;
-			if (!b && !s) {
-				color = 0;
-			}
-			else if (!b && s) {
-				color = sprite | 0x10;
-			}
-			else if (b && !s) {
-				color = background;
-			}
-			else {
-				if (ppu->sprite_idx[i] == 0 && x < 255) {
-					ppu->flag_sprite_zero_hit = 1;
-				}
-				if (ppu->sprite_priorities[i] == 0) {
-					color = sprite | 0x10;
-				}
-				else {
-					color = background;
-				}
-			}
-
+			const uint8_t color = composePixel(ppu, x, background);
 			ppu->back[(y << 8) + x] = palette[readPalette(ppu, static_cast<uint16_t>(color)) & 63];
 		}
 		if (do_line_render && fetch_cycle) {
@@ -235,36 +362,10 @@ void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
 		}
 		if (do_line_render) {
 			if (fetch_cycle && (ppu->cycle & 7) == 0) {
-				if ((ppu->v & 0x001F) == 31) {
-					// coarse X = 0
-					ppu->v &= 0xFFE0;
-					// switch horizontal nametable
-					ppu->v ^= 0x0400;
-				}
-				else {
-					// increment coarse X
-					++ppu->v;
-				}
+				incrementX(ppu);
 			}
 			if (ppu->cycle == 256) {
-				if ((ppu->v & 0x7000) != 0x7000) {
-					ppu->v += 0x1000;
-				}
-				else {
-					ppu->v &= 0x8FFF;
-					uint16_t y = (ppu->v & 0x03E0) >> 5;
-					if (y == 29) {
-						y = 0;
-						ppu->v ^= 0x0800;
-					}
-					else if (y == 31) {
-						y = 0;
-					}
-					else {
-						++y;
-					}
-					ppu->v = (ppu->v & 0xFC1F) | (y << 5);
-				}
+				incrementY(ppu);
 			}
 			if (ppu->cycle == 257) {
 				ppu->v = (ppu->v & 0xFBE0) | (ppu->t & 0x041F);
@@ -284,7 +385,6 @@ void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
 				int row = ppu->scanline - static_cast<int>(y);
 				if (row < 0 || row >= h) continue;
 				if (count < 8) {
-					uint32_t sprite_pattern = 0;
 					uint8_t tile = ppu->oam_tbl[4 * i + 1];
 					const uint8_t attributes = ppu->oam_tbl[4 * i + 2];
 					uint16_t address = 0;
@@ -307,28 +407,11 @@ void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
 						}
 						address = (static_cast<uint16_t>(table) << 12) + (static_cast<uint16_t>(tile) << 4) + static_cast<uint16_t>(row);
 					}
-					uint8_t atts = (attributes & 3) << 2;
-					uint8_t low_tile_u8 = readPPU(nes, address);
-					uint8_t high_tile_u8 = readPPU(nes, address + 8);
-
-					for (int j = 0; j < 8; ++j) {
-						uint8_t p1, p2;
-						if ((attributes & 0x40) == 0x40) {
-							p1 = low_tile_u8 & 1;
-							p2 = (high_tile_u8 & 1) << 1;
-							low_tile_u8 >>= 1;
-							high_tile_u8 >>= 1;
-						}
-						else {
-							p1 = (low_tile_u8 & 0x80) >> 7;
-							p2 = (high_tile_u8 & 0x80) >> 6;
-							low_tile_u8 <<= 1;
-							high_tile_u8 <<= 1;
-						}
-						sprite_pattern <<= 4;
-						sprite_pattern |= static_cast<uint32_t>(atts | p1 | p2);
-					}
-					ppu->sprite_patterns[count] = sprite_pattern;
+					// the palette bits go into every pixel's nibble
+					const uint32_t atts = static_cast<uint32_t>((attributes & 3) << 2) * 0x11111111u;
+					const bool mirrored = (attributes & 0x40) == 0x40;
+					const uint32_t pattern = ppu->reference ? readPatternRow(nes, address, mirrored) : patternRow(nes, ppu, address, mirrored);
+					ppu->sprite_patterns[count] = pattern | atts;
 					ppu->sprite_pos[count] = x;
 					ppu->sprite_priorities[count] = (a >> 5) & 1;
 					ppu->sprite_idx[count] = static_cast<uint8_t>(i);
@@ -344,6 +427,7 @@ void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
 		else {
 			ppu->sprite_cnt = 0;
 		}
+		rasterizeSprites(ppu);
 	}
 
 	// v_blank logic
@@ -363,6 +447,151 @@ void tickPPU(NES* nes, CPU* cpu, PPU* ppu) {
 	}
 }
 
+// dots 1-256 of a visible line with rendering on, all at once: the same reads,
+// pixels and register updates as 256 calls to tickPPU, without sending every
+// dot through all of its branches. only valid if nothing touches the PPU or the
+// mapper before dot 256, runPPU makes sure of that
+static void renderLine(NES* nes, PPU* ppu) {
+	// the line's background pixels in order: the two tiles prefetched on the
+	// previous line, then the 32 fetched along this one. fine X picks where
+	// the screen starts
+	uint8_t tiles[34 * 8];
+	for (int i = 0; i < 16; ++i) {
+		tiles[i] = static_cast<uint8_t>((ppu->tile_data >> (60 - 4 * i)) & 0x0F);
+	}
+	const uint16_t fineY = (ppu->v >> 12) & 7;
+	const uint16_t table = static_cast<uint16_t>(ppu->flag_background_tbl) << 12;
+	for (int k = 2; k < 34; ++k) {
+		const uint16_t v = ppu->v;
+		ppu->name_tbl_u8 = readPPU(nes, 0x2000 | (v & 0x0FFF));
+		const uint16_t address = 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07);
+		const int shift = ((v >> 4) & 4) | (v & 2);
+		ppu->attrib_tbl_u8 = ((readPPU(nes, address) >> shift) & 3) << 2;
+		const uint16_t pattern = table + (static_cast<uint16_t>(ppu->name_tbl_u8) << 4) + fineY;
+		const uint32_t row = patternRow(nes, ppu, pattern, false);
+		for (int i = 0; i < 8; ++i) {
+			tiles[8 * k + i] = static_cast<uint8_t>(ppu->attrib_tbl_u8 | ((row >> (28 - 4 * i)) & 3));
+		}
+		incrementX(ppu);
+	}
+	incrementY(ppu);
+
+	// what the shifters hold after dot 256: the last two tiles, fully shifted in
+	ppu->low_tile_u8 = 0;
+	ppu->high_tile_u8 = 0;
+	ppu->tile_data = 0;
+	for (int i = 256; i < 272; ++i) {
+		ppu->tile_data = (ppu->tile_data << 4) | tiles[i];
+	}
+
+	// nothing can write the palette mid-line either
+	uint32_t colors[32];
+	for (int i = 0; i < 32; ++i) {
+		colors[i] = palette[readPalette(ppu, static_cast<uint16_t>(i)) & 63];
+	}
+	const uint8_t* background = tiles + ppu->x;
+	const bool show_background = ppu->flag_show_background != 0;
+	uint32_t* out = ppu->back + (ppu->scanline << 8);
+	for (int x = 0; x < 256; ++x) {
+		out[x] = colors[composePixel(ppu, x, show_background ? background[x] : 0)];
+	}
+}
+
+// the next dot on the current line tickPPU has to run for real. every dot
+// before it only moves the position along. 341 is the step to the next line
+static int nextBusyDot(const PPU* ppu) {
+	const int next = ppu->cycle + 1;
+	const int line = ppu->scanline;
+	const bool do_render = ppu->flag_show_background != 0 || ppu->flag_show_sprites != 0;
+	if (do_render && (line < 240 || line == 261)) {
+		// fetches and pixels, sprite evaluation, the mapper's scanline
+		// counter, the preline's vertical copy, the prefetch
+		if (next <= 257) return next;
+		if (next <= 280) return 280;
+		if (line == 261 && next <= 304) return next;
+		if (next <= 321) return 321;
+		if (next <= 336) return next;
+	}
+	else {
+		// v_blank set and cleared, the sprite count reset
+		if ((line == 241 || line == 261) && next <= 1) return 1;
+		if (do_render && next <= 257) return 257;
+	}
+	// the odd frame skip, then the step to the next line
+	return (line == 261 && next <= 340) ? 340 : 341;
+}
+
+// advance the PPU from its own dot to 'until'. a visible line the CPU doesn't
+// touch before dot 256 is drawn by renderLine in one go; one it does touch
+// falls back to tickPPU for every dot, and is counted. dots with nothing to do
+// are skipped either way. with 'hold_line', a run that would end early in a
+// visible line stops at its start instead, the rest of it comes with the next run
+void runPPU(NES* nes, PPU* ppu, uint64_t until, bool hold_line) {
+	while (ppu->dot < until) {
+		const uint64_t left = until - ppu->dot;
+		if (!ppu->reference && ppu->nmi_delay == 0) {
+			const bool do_render = ppu->flag_show_background != 0 || ppu->flag_show_sprites != 0;
+			if (do_render && ppu->cycle == 0 && ppu->scanline < 240) {
+				if (left >= 256) {
+					renderLine(nes, ppu);
+					ppu->cycle = 256;
+					ppu->dot += 256;
+					++ppu->lines_batched;
+					continue;
+				}
+				if (hold_line) {
+					break;
+				}
+				++ppu->lines_fallback;
+			}
+			const int idle = nextBusyDot(ppu) - ppu->cycle - 1;
+			if (idle > 0) {
+				const int n = static_cast<int>(std::min<uint64_t>(idle, left));
+				ppu->cycle += n;
+				ppu->dot += n;
+				continue;
+			}
+		}
+
+		tickPPU(nes, nes->cpu, ppu);
+		++ppu->dot;
+		if ((ppu->cycle == 280) && (ppu->scanline <= 239 || ppu->scanline >= 261) && (ppu->flag_show_background != 0 || ppu->flag_show_sprites != 0)) {
+			nes->mapper->updateCounter(nes->cpu);
+		}
+	}
+	schedulePPU(ppu);
+}
+
+// the earliest dot the PPU does something the CPU can see without reading a
+// register: v_blank and NMI, the mapper's scanline counter (IRQ), a new frame.
+// it must be run before the CPU goes past it
+void schedulePPU(PPU* ppu) {
+	const int c = ppu->cycle;
+	const bool do_render = ppu->flag_show_background != 0 || ppu->flag_show_sprites != 0;
+	int dots;
+	if ((ppu->scanline == 241 || ppu->scanline == 261) && c < 1) {
+		dots = 1 - c;
+	}
+	else if (c < 280) {
+		dots = 280 - c;
+	}
+	else if (do_render && ppu->f == 1 && ppu->scanline == 261 && c <= 339) {
+		dots = 340 - c;
+	}
+	else {
+		dots = 341 - c;
+	}
+	if (ppu->nmi_delay > 0) {
+		dots = std::min(dots, static_cast<int>(ppu->nmi_delay));
+	}
+	ppu->deadline = ppu->dot + dots;
+}
+
+// bring the PPU up to the dot the CPU has reached, before the CPU accesses it
+void catchUpPPU(NES* nes) {
+	runPPU(nes, nes->ppu, nes->ppu->target_dot, false);
+}
+
 void pulseTickEnvelope(Pulse* p) {
 	if (p->envelope_start) {
 		p->envelope_vol = 15;
@@ -510,207 +739,331 @@ void Mapper4::updateCounter(CPU* cpu) {
 	}
 }
 
-void tickAPU(NES* nes, APU* apu) {
-	uint64_t cycle1 = apu->cycle;
-	++apu->cycle;
-	uint64_t cycle2 = apu->cycle;
+// combined output of all channels through the non-linear mixer
+int32_t mixLevel(APU* apu) {
+	const uint8_t p1_output = pulseOutput(&apu->pulse1);
+	const uint8_t p2_output = pulseOutput(&apu->pulse2);
+
+	Triangle* t = &apu->triangle;
+	const uint8_t tri_output = (!t->enabled || t->length_val == 0 || t->counter_val == 0) ? 0 : tri_tbl[t->duty_val];
+
+	Noise* n = &apu->noise;
+	uint8_t noise_out;
+	if (!n->enabled || n->length_val == 0 || (n->shift_reg & 1) == 1) {
+		noise_out = 0;
+	}
+	else if (n->envelope_enabled) {
+		noise_out = n->envelope_vol;
+	}
+	else {
+		noise_out = n->const_vol;
+	}
 
-	// tick timers
-	if ((apu->cycle & 1) == 0) {
-		tickPulseTimer(&apu->pulse1);
-		tickPulseTimer(&apu->pulse2);
+	const uint8_t dOut = apu->dmc.value;
 
-		Noise* n = &apu->noise;
-		if (n->timer_val == 0) {
-			n->timer_val = n->timer_period;
-			uint8_t shift = n->mode ? 6 : 1;
-			uint16_t b1 = n->shift_reg & 1;
-			uint16_t b2 = (n->shift_reg >> shift) & 1;
-			n->shift_reg >>= 1;
-			n->shift_reg |= (b1 ^ b2) << 14;
+	const float output = tnd_tbl[(3 * tri_output) + (2 * noise_out) + dOut] + pulse_tbl[p1_output + p2_output];
+	return static_cast<int32_t>(output * APU_LEVEL_SCALE + 0.5f);
+}
+
+void tickNoiseTimer(Noise* n) {
+	if (n->timer_val == 0) {
+		n->timer_val = n->timer_period;
+		uint8_t shift = n->mode ? 6 : 1;
+		uint16_t b1 = n->shift_reg & 1;
+		uint16_t b2 = (n->shift_reg >> shift) & 1;
+		n->shift_reg >>= 1;
+		n->shift_reg |= (b1 ^ b2) << 14;
+	}
+	else {
+		--n->timer_val;
+	}
+}
+
+void tickDMC(NES* nes, DMC* d) {
+	// tick reader
+	if (d->cur_len > 0 && d->bit_count == 0) {
+		nes->cpu->stall += 4;
+		d->shift_reg = readByte(nes, d->cur_addr);
+		d->bit_count = 8;
+		++d->cur_addr;
+		if (d->cur_addr == 0) {
+			d->cur_addr = 0x8000;
 		}
-		else {
-			--n->timer_val;
-		}
-
-		DMC* d = &apu->dmc;
-		if (d->enabled) {
-			// tick reader
-			if (d->cur_len > 0 && d->bit_count == 0) {
-				nes->cpu->stall += 4;
-				d->shift_reg = readByte(nes, d->cur_addr);
-				d->bit_count = 8;
-				++d->cur_addr;
-				if (d->cur_addr == 0) {
-					d->cur_addr = 0x8000;
-				}
-				--d->cur_len;
-				if (d->cur_len == 0 && d->loop) {
-					dmcRestart(d);
-				}
-			}
+		--d->cur_len;
+		if (d->cur_len == 0 && d->loop) {
+			dmcRestart(d);
+		}
+	}
 
-			if (d->tick_val == 0) {
-				d->tick_val = d->tick_period;
+	if (d->tick_val == 0) {
+		d->tick_val = d->tick_period;
 
-				// tick shifter
-				if (d->bit_count != 0) {
-					if ((d->shift_reg & 1) == 1) {
-						if (d->value <= 125) {
-							d->value += 2;
-						}
-					}
-					else {
-						if (d->value >= 2) {
-							d->value -= 2;
-						}
-					}
-					d->shift_reg >>= 1;
-					--d->bit_count;
+		// tick shifter
+		if (d->bit_count != 0) {
+			if ((d->shift_reg & 1) == 1) {
+				if (d->value <= 125) {
+					d->value += 2;
 				}
 			}
 			else {
-				--d->tick_val;
+				if (d->value >= 2) {
+					d->value -= 2;
+				}
 			}
+			d->shift_reg >>= 1;
+			--d->bit_count;
 		}
 	}
+	else {
+		--d->tick_val;
+	}
+}
 
-	Triangle* t = &apu->triangle;
+void tickTriangleTimer(Triangle* t) {
 	if (t->timer_val == 0) {
 		t->timer_val = t->timer_period;
-			if (t->length_val > 0 && t->counter_val > 0) {
-				t->duty_val = (t->duty_val + 1) & 31;
+		if (t->length_val > 0 && t->counter_val > 0) {
+			t->duty_val = (t->duty_val + 1) & 31;
+		}
+	}
+	else {
+		--t->timer_val;
+	}
+}
+
+void tickFrameCounter(NES* nes, APU* apu) {
+	const uint8_t fp = apu->frame_period;
+	if (fp == 4) {
+		apu->frame_val = (apu->frame_val + 1) & 3;
+		switch (apu->frame_val) {
+		case 0:
+		case 2:
+			tickEnvelope(apu);
+			break;
+		case 1:
+			tickEnvelope(apu);
+			tickSweep(apu);
+			tickLength(apu);
+			break;
+		case 3:
+			tickEnvelope(apu);
+			tickSweep(apu);
+			tickLength(apu);
+			if (apu->frame_IRQ) {
+				triggerIRQ(nes->cpu);
 			}
+			break;
 		}
-		else {
-			--t->timer_val;
-		}
-
-	const int f1 = static_cast<int>(static_cast<double>(cycle1) / FRAME_CTR_FREQ);
-	const int f2 = static_cast<int>(static_cast<double>(cycle2) / FRAME_CTR_FREQ);
-	if (f1 != f2) {
-		const uint8_t fp = apu->frame_period;
-		if (fp == 4) {
-			apu->frame_val = (apu->frame_val + 1) & 3;
-				switch (apu->frame_val) {
-				case 0:
-				case 2:
-					tickEnvelope(apu);
-					break;
-				case 1:
-					tickEnvelope(apu);
-					tickSweep(apu);
-					tickLength(apu);
-					break;
-				case 3:
-					tickEnvelope(apu);
-					tickSweep(apu);
-					tickLength(apu);
-					if (apu->frame_IRQ) {
-						triggerIRQ(nes->cpu);
-					}
-					break;
-				}
+	}
+	else if (fp == 5) {
+		apu->frame_val = (apu->frame_val + 1) % 5;
+		switch (apu->frame_val) {
+		case 1:
+		case 3:
+			tickEnvelope(apu);
+			break;
+		case 0:
+		case 2:
+			tickEnvelope(apu);
+			tickSweep(apu);
+			tickLength(apu);
+			break;
 		}
-		else if (fp == 5) {
-			apu->frame_val = (apu->frame_val + 1) % 5;
-			switch (apu->frame_val) {
-			case 1:
-			case 3:
-				tickEnvelope(apu);
-				break;
-			case 0:
-			case 2:
-				tickEnvelope(apu);
-				tickSweep(apu);
-				tickLength(apu);
+	}
+}
+
+// pulse, noise and DMC timers tick on even cycles: the first one after 'cycle'
+// that runs out with 'timer_val' ticks left
+static inline uint64_t evenExpiry(uint64_t cycle, uint16_t timer_val) {
+	return ((cycle + 2) & ~1ull) + 2ull * timer_val;
+}
+
+// schedule the frame counter step after the current one. the exact times are
+// kept as a whole cycle count plus a fraction, and each step falls on the
+// first whole cycle at or after its exact time
+static void nextFrameStep(APU* apu) {
+	apu->frame_base += FRAME_CTR_CYCLES;
+	apu->frame_frac += FRAME_CTR_FRAC;
+	if (apu->frame_frac >= FRAME_CTR_DIVISOR) {
+		apu->frame_frac -= FRAME_CTR_DIVISOR;
+		++apu->frame_base;
+	}
+	apu->frame_next = apu->frame_base + (apu->frame_frac != 0);
+}
+
+// next cycle the DMC reads memory or changes its output
+static uint64_t nextDMCEvent(const DMC* d, uint64_t cycle) {
+	if (!d->enabled) {
+		return UINT64_MAX;
+	}
+	if (d->cur_len > 0 && d->bit_count == 0) {
+		return (cycle + 2) & ~1ull;
+	}
+	return evenExpiry(cycle, d->tick_val);
+}
+
+// the earliest cycle the APU does something the CPU can see: a frame counter
+// step (IRQ) or a DMC read (stall). it must be run before the CPU goes past it
+void scheduleAPU(APU* apu) {
+	apu->deadline = std::min(apu->frame_next, nextDMCEvent(&apu->dmc, apu->cycle));
+}
+
+// advance the APU from its own cycle to 'until'. between two events (a timer
+// running out, a frame counter step) every timer only counts down, so those
+// stretches are skipped in one subtraction and the full tick logic only runs
+// on the cycle of the next event. the output can only change on such a cycle
+void runAPU(NES* nes, APU* apu, uint64_t until) {
+	uint64_t cycle = apu->cycle;
+	if (cycle < until) {
+		// a register write since the last run is heard from the next cycle on
+		uint64_t next = cycle + 1;
+		for (;;) {
+			const uint64_t even = (next >> 1) - (cycle >> 1);
+			if (even > 0) {
+				apu->pulse1.timer_val -= static_cast<uint16_t>(even - 1);
+				apu->pulse2.timer_val -= static_cast<uint16_t>(even - 1);
+				apu->noise.timer_val -= static_cast<uint16_t>(even - 1);
+				tickPulseTimer(&apu->pulse1);
+				tickPulseTimer(&apu->pulse2);
+				tickNoiseTimer(&apu->noise);
+				if (apu->dmc.enabled) {
+					apu->dmc.tick_val -= static_cast<uint8_t>(even - 1);
+					tickDMC(nes, &apu->dmc);
+				}
+			}
+			apu->triangle.timer_val -= static_cast<uint16_t>(next - cycle - 1);
+			tickTriangleTimer(&apu->triangle);
+
+			if (next == apu->frame_next) {
+				tickFrameCounter(nes, apu);
+				nextFrameStep(apu);
+			}
+			cycle = apu->cycle = next;
+
+			const int32_t level = mixLevel(apu);
+			if (level != apu->level) {
+				blip_add_delta(&apu->blip, static_cast<uint32_t>(cycle - apu->blip_cycle), level - apu->level);
+				apu->level = level;
+			}
+
+			if (cycle == until) {
 				break;
 			}
+			next = std::min(until, apu->frame_next);
+			next = std::min(next, evenExpiry(cycle, apu->pulse1.timer_val));
+			next = std::min(next, evenExpiry(cycle, apu->pulse2.timer_val));
+			next = std::min(next, evenExpiry(cycle, apu->noise.timer_val));
+			next = std::min(next, nextDMCEvent(&apu->dmc, cycle));
+			next = std::min(next, cycle + apu->triangle.timer_val + 1);
 		}
 	}
+	scheduleAPU(apu);
+}
 
-	const int s1 = static_cast<int>(static_cast<double>(cycle1) / SAMPLE_RATE);
-	const int s2 = static_cast<int>(static_cast<double>(cycle2) / SAMPLE_RATE);
+// bring the APU up to the cycle the CPU has reached
+void catchUpAPU(NES* nes) {
+	runAPU(nes, nes->apu, nes->apu->target_cycle);
+}
 
-	if (s1 != s2) {
-		const uint8_t p1_output = pulseOutput(&apu->pulse1);
-		const uint8_t p2_output = pulseOutput(&apu->pulse2);
+// resample everything since the last flush and hand it to the audio callback in one batch
+void flushSamples(APU* apu) {
+	const int count = blip_end_frame(&apu->blip, static_cast<uint32_t>(apu->cycle - apu->blip_cycle));
+	apu->blip_cycle = apu->cycle;
+	const size_t first = apu->samples.size();
+	apu->samples.resize(first + count);
+	blip_read_samples(&apu->blip, apu->samples.data() + first, count, 1.0f / APU_LEVEL_SCALE);
 
-		const uint8_t tri_output = (!t->enabled || t->length_val == 0 || t->counter_val == 0) ? 0 : tri_tbl[t->duty_val];
+	audio_ring_write(&apu->stream, apu->samples.data(), apu->samples.size());
+	apu->samples.clear();
+}
 
-		Noise* n = &apu->noise;
-		uint8_t noise_out;
-		if (!n->enabled || n->length_val == 0 || (n->shift_reg & 1) == 1) {
-			noise_out = 0;
+// produce 'ratio' times as many samples per emulated second as nominal. takes
+// effect from the next frame, call it right after flushSamples
+void setSampleRatio(APU* apu, double ratio) {
+	blip_set_rate(&apu->blip, SAMPLE_RATE / ratio);
+}
+
+// execute one CPU instruction (or one stall cycle) and advance PPU and APU to match.
+// returns the number of CPU cycles consumed
+int step(NES* nes) {
+	int cpuCycles = 0;
+	CPU* cpu = nes->cpu;
+	if (cpu->stall > 0) {
+		--cpu->stall;
+		cpuCycles = 1;
+	}
+	else {
+		uint64_t startCycles = cpu->cycles;
+
+		if (cpu->interrupt != interruptNone && nes->trace != nullptr && !nes->trace->replay) {
+			nes->trace->interrupts.push_back({ cpu->cycles, cpu->interrupt });
+		}
+		if (cpu->interrupt == interruptNMI) {
+			push16(nes, cpu->PC);
+			php(cpu, nes, 0, 0);
+			cpu->PC = read16(nes, 0xFFFA);
+			setI(cpu, true);
+			cpu->cycles += 7;
 		}
-		else if (n->envelope_enabled) {
-			noise_out = n->envelope_vol;
+		else if (cpu->interrupt == interruptIRQ) {
+			push16(nes, cpu->PC);
+			php(cpu, nes, 0, 0);
+			cpu->PC = read16(nes, 0xFFFE);
+			setI(cpu, true);
+			cpu->cycles += 7;
+		}
+		cpu->interrupt = interruptNone;
+		uint8_t opcode = readByte(nes, cpu->PC);
+		if (cpu->reference) {
+			execute(nes, opcode);
 		}
 		else {
-			noise_out = n->const_vol;
+			executeSpecialized(nes, opcode);
 		}
+		++cpu->instructions;
+		cpuCycles = static_cast<int>(cpu->cycles - startCycles);
+	}
 
-		const uint8_t dOut = apu->dmc.value;
-
-		// combined outputs
-		float output[2];
-		output[1] = output[0] = tnd_tbl[(3 * tri_output) + (2 * noise_out) + dOut] + pulse_tbl[p1_output + p2_output];
+	advanceClocks(nes, cpuCycles);
+	return cpuCycles;
+}
 
-//		if (Pa_GetStreamWriteAvailable(apu->stream)) Pa_WriteStream(apu->stream, output, 1);
-        apu->streamMutex.lock();
-        apu->stream.push_back(output[0]);
-//        apu->stream.push_back(output[1]); only mono, copy to stereo in sound callback
-        apu->streamMutex.unlock();
-	}
+// whether the specialized core can run on in runSpecialized. interrupts and
+// stall cycles only ever go through step
+static bool canRunSpecialized(const CPU* cpu) {
+	return !cpu->reference && cpu->stall == 0 && cpu->interrupt == interruptNone;
 }
 
 void emulate(NES* nes, double seconds) {
+	CPU* cpu = nes->cpu;
 	int cycles = static_cast<int>(CPU_FREQ * seconds + 0.5);
 	while (cycles > 0) {
-		int cpuCycles = 0;
-		CPU* cpu = nes->cpu;
-		if (cpu->stall > 0) {
-			--cpu->stall;
-			cpuCycles = 1;
+		if (canRunSpecialized(cpu)) {
+			const uint64_t start = cpu->cycles;
+			runSpecialized(nes, start + cycles);
+			cycles -= static_cast<int>(cpu->cycles - start);
 		}
 		else {
-			uint64_t startCycles = cpu->cycles;
-
-			if (cpu->interrupt == interruptNMI) {
-				push16(nes, cpu->PC);
-				php(cpu, nes, 0, 0);
-				cpu->PC = read16(nes, 0xFFFA);
-				setI(cpu, true);
-				cpu->cycles += 7;
-			}
-			else if (cpu->interrupt == interruptIRQ) {
-				push16(nes, cpu->PC);
-				php(cpu, nes, 0, 0);
-				cpu->PC = read16(nes, 0xFFFE);
-				setI(cpu, true);
-				cpu->cycles += 7;
-			}
-			cpu->interrupt = interruptNone;
-			uint8_t opcode = readByte(nes, cpu->PC);
-			execute(nes, opcode);
-			cpuCycles = static_cast<int>(cpu->cycles - startCycles);
+			cycles -= step(nes);
 		}
+	}
+	catchUpAPU(nes);
+}
 
-		const int ppuCycles = cpuCycles * 3;
-		for (int i = 0; i < ppuCycles; ++i) {
-			PPU* ppu = nes->ppu;
-			tickPPU(nes, nes->cpu, ppu);
-
-			if ((ppu->cycle == 280) && (ppu->scanline <= 239 || ppu->scanline >= 261) && (ppu->flag_show_background != 0 || ppu->flag_show_sprites != 0)) {
-				nes->mapper->updateCounter(nes->cpu);
-			}
+// run until the PPU wraps to the next frame. one full frame always contains one
+// v_blank, so the front buffer holds a freshly completed picture afterwards
+void emulateFrame(NES* nes) {
+	CPU* cpu = nes->cpu;
+	const uint64_t frame = nes->ppu->frame;
+	while (nes->ppu->frame == frame) {
+		if (canRunSpecialized(cpu)) {
+			runSpecialized(nes, UINT64_MAX);
 		}
-
-		for (int i = 0; i < cpuCycles; ++i) {
-			tickAPU(nes, nes->apu);
+		else {
+			step(nes);
 		}
-		cycles -= cpuCycles;
 	}
+	catchUpAPU(nes);
 }
 
 void PPUnmiShift(PPU* ppu) {
@@ -80,17 +80,25 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <algorithm>
 #include <iostream>
 #include <vector>
-#include <mutex>
+
+#include "audio_ring.h"
+#include "blip_buffer.h"
 
 //#include <portaudio.h>
 
 
 constexpr int INES_MAGIC = 0x1a53454e;
 constexpr double CPU_FREQ = 1789773.0;
-constexpr double FRAME_CTR_FREQ = CPU_FREQ / 240.0;
+// the frame counter steps 240 times a second, 7457 93/240 CPU cycles apart
+constexpr uint32_t FRAME_CTR_CYCLES = 7457;
+constexpr uint32_t FRAME_CTR_FRAC = 93;
+constexpr uint32_t FRAME_CTR_DIVISOR = 240;
+static_assert(FRAME_CTR_CYCLES * FRAME_CTR_DIVISOR + FRAME_CTR_FRAC == static_cast<uint32_t>(CPU_FREQ));
 constexpr double SAMPLE_RATE = CPU_FREQ / (44100.0);
+constexpr float APU_LEVEL_SCALE = 32768.0f;
 
 enum Buttons {
 	ButtonA = 0,
@@ -225,19 +233,31 @@ struct Noise {
 
 struct APU {
 //	PaStream* stream;
-    std::vector<float> stream;
-    std::mutex streamMutex;
+	std::vector<float> samples; // resampled by flushSamples on the way to the ring, emulation thread only
+	AudioRing stream; // shared with the audio callback
 	Pulse pulse1;
 	Pulse pulse2;
 	Triangle triangle;
 	Noise noise;
 	DMC dmc;
-	uint64_t cycle;
+	uint64_t cycle; // how far the APU has run
+	uint64_t target_cycle; // how far the CPU has run, the APU catches up to it on demand
+	uint64_t deadline; // the APU must run before the CPU goes past this, see scheduleAPU
+	uint64_t frame_next; // cycle of the next frame counter step
+	uint64_t frame_base; // its exact time, whole cycles
+	uint32_t frame_frac; // and the remainder in 1 / FRAME_CTR_DIVISOR cycles
 	uint8_t frame_period;
 	uint8_t frame_val;
 	bool frame_IRQ;
-
-	APU() : cycle(0), frame_period(0), frame_val(0), frame_IRQ(false) {}
+	BlipBuffer blip; // mixer output steps since the last flushSamples
+	int32_t level; // mixer output last added to blip, in units of 1 / APU_LEVEL_SCALE
+	uint64_t blip_cycle; // cycle the current blip frame started at
+
+	APU() : cycle(0), target_cycle(0), deadline(0), frame_next(FRAME_CTR_CYCLES + 1), frame_base(FRAME_CTR_CYCLES), frame_frac(FRAME_CTR_FRAC), frame_period(0), frame_val(0), frame_IRQ(false), level(0), blip_cycle(0) {
+		samples.reserve(1024);
+		audio_ring_reset(&stream);
+		blip_init(&blip, SAMPLE_RATE);
+	}
 };
 
 struct Cartridge {
@@ -253,7 +273,7 @@ struct Cartridge {
 	uint8_t mirror; // mirroring mode
 	uint8_t battery_present; // battery present
 
-	Cartridge(const char* path, const char* SRAM_path) : initialized(false) {
+	Cartridge(const char* path, const char* SRAM_path, bool quiet) : initialized(false), PRG(nullptr), CHR(nullptr), SRAM(nullptr), trainer(nullptr) {
 		FILE* fp = fopen(path, "rb");
 		if (fp == nullptr) {
 			std::cerr << "ERROR: failed to open ROM file!" << std::endl;
@@ -323,10 +343,10 @@ struct Cartridge {
 		memset(SRAM, 0, 8192);
 		if (battery_present) {
 			// try to read saved SRAM
-			std::cout << "Attempting to read previously saved SRAM..." << std::endl;
+			if (!quiet) std::cout << "Attempting to read previously saved SRAM..." << std::endl;
 			fp = fopen(SRAM_path, "rb");
 			if (fp == nullptr || (fread(SRAM, 8192, 1, fp) != 1)) {
-				std::cout << "WARN: failed to open SRAM file!" << std::endl;
+				if (!quiet) std::cout << "WARN: failed to open SRAM file!" << std::endl;
 			}
 			else {
 				fclose(fp);
@@ -334,6 +354,16 @@ struct Cartridge {
 		}
 		initialized = true;
 	}
+
+	~Cartridge() {
+		delete[] PRG;
+		delete[] CHR;
+		delete[] SRAM;
+		delete[] trainer;
+	}
+
+	Cartridge(const Cartridge&) = delete;
+	Cartridge& operator=(const Cartridge&) = delete;
 };
 
 struct CPU {
@@ -346,8 +376,20 @@ struct CPU {
 	uint8_t flags;     // flags register
 	uint8_t interrupt; // interrupt type
 	int stall;
+	uint64_t instructions; // executed so far, for the benchmark
+	bool reference; // interpret through the instructions table instead of the specialized handlers
+
+	CPU() : cycles(0), PC(0), SP(0), A(0), X(0), Y(0), flags(0), interrupt(0), stall(0), instructions(0), reference(false) {}
+};
 
-	CPU() : cycles(0), PC(0), SP(0), A(0), X(0), Y(0), flags(0), interrupt(0), stall(0) {}
+// CHR tiles decoded for the PPU's fetches: every 8 pixel row as one nibble per
+// pixel (the 2-bit color in the low bits, leftmost pixel on top), the way rows
+// go into tile_data and sprite_patterns, plus the row mirrored for flipped
+// sprites. tiles are decoded on first use and dropped when their CHR is written
+// or banked out, see patternRow and invalidatePatterns
+struct PatternCache {
+	uint32_t rows[512][2][8]; // tile (pattern address >> 4), mirrored, row
+	bool valid[512];
 };
 
 struct PPU {
@@ -387,6 +429,7 @@ struct PPU {
 	uint8_t sprite_pos[8];
 	uint8_t sprite_priorities[8];
 	uint8_t sprite_idx[8];
+	uint8_t sprite_line[256]; // the sprites above resolved per pixel, see rasterizeSprites
 
 	// $2000 PPUCTRL
 	uint8_t flag_name_tbl;       // 0: $2000.  1: $2400. 2: $2800. 3: $2C00
@@ -416,11 +459,20 @@ struct PPU {
 	// $2007 PPUDATA
 	uint8_t buffered_data;
 
+	uint64_t dot; // how far the PPU has run, in PPU cycles
+	uint64_t target_dot; // how far the CPU has run, the PPU catches up to it on demand
+	uint64_t deadline; // the PPU must run before the CPU goes past this, see schedulePPU
+	bool reference; // no shortcuts: every dot through tickPPU, sprites found pixel by pixel. what --verify checks against
+	uint64_t lines_batched;
+	uint64_t lines_fallback; // drawn dot by dot, the CPU touched the PPU or the mapper mid-line
+
+	PatternCache patterns;
+
 	PPU() : cycle(0), scanline(0), frame(0), v(0), t(0), x(0), w(0), f(0), reg(0), nmi_occurred(false), nmi_out(false), nmi_last(false),
 		nmi_delay(0), name_tbl_u8(0), attrib_tbl_u8(0), low_tile_u8(0), high_tile_u8(0), tile_data(0), sprite_cnt(0), flag_name_tbl(0), flag_increment(0),
 		flag_sprite_tbl(0), flag_background_tbl(0), flag_sprite_size(0), flag_rw(0), flag_gray(0), flag_show_left_background(0), flag_show_left_sprites(0),
 		flag_show_background(0), flag_show_sprites(0), flag_red_tint(0), flag_green_tint(0), flag_blue_tint(0), flag_sprite_zero_hit(0), flag_sprite_overflow(0),
-		oam_addr(0), buffered_data(0)
+		oam_addr(0), buffered_data(0), dot(0), target_dot(0), deadline(0), reference(false), lines_batched(0), lines_fallback(0)
 	{
 		memset(palette_tbl, 0, 32);
 		memset(name_tbl, 0, 2048);
@@ -429,6 +481,8 @@ struct PPU {
 		memset(sprite_pos, 0, 8);
 		memset(sprite_priorities, 0, 8);
 		memset(sprite_idx, 0, 8);
+		memset(sprite_line, 0, 256);
+		memset(patterns.valid, 0, sizeof(patterns.valid));
 	}
 };
 
@@ -444,9 +498,22 @@ struct Controller {
 };
 
 struct Mapper {
-	virtual uint8_t read(Cartridge* cartridge, uint16_t address) = 0;
+	// host memory behind the cartridge's address ranges, kept current by
+	// updatePages whenever a bank switches. CPU pages are 8 KB, by address >> 13
+	// (SRAM at $6000, PRG from $8000 on, the first three are never used); PPU
+	// pages are 1 KB over the pattern tables, by address >> 10. readByte and
+	// readPPU index these directly, only register writes reach the mapper
+	uint8_t* prg_pages[8];
+	uint8_t* chr_pages[8];
+
+	virtual ~Mapper() {}
+
+	// $8000-$FFFF
 	virtual void write(Cartridge* cartridge, uint16_t address, uint8_t value) = 0;
 	virtual void updateCounter(CPU* cpu) = 0;
+	virtual void updatePages(Cartridge* cartridge) = 0;
+
+	Mapper() : prg_pages{}, chr_pages{} {}
 };
 
 struct Mapper1 : public Mapper {
@@ -465,76 +532,52 @@ struct Mapper1 : public Mapper {
 	void updateOffsets(Cartridge* cartridge);
 	void writeCtrl(Cartridge* cartridge, uint8_t value);
 
-	uint8_t read(Cartridge* cartridge, uint16_t address) {
-		if (address < 0x2000) {
-			const uint16_t bank = address >> 12;
-			const uint16_t offset = address & 4095;
-			return cartridge->CHR[chr_offsets[bank] + static_cast<int>(offset)];
-		}
-		else if (address >= 0x8000) {
-			address -= 0x8000;
-			const uint16_t bank = address >> 14;
-			const uint16_t offset = address & 16383;
-			return cartridge->PRG[prg_offsets[bank] + static_cast<int>(offset)];
-		}
-		else if (address >= 0x6000) {
-			return cartridge->SRAM[static_cast<int>(address) - 0x6000];
-		}
-		else {
-			std::cerr << "ERROR: Mapper1 encountered unrecognized read (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-			return 0;
-		}
-	}
-
 	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
-		if (address < 0x2000) {
-			const uint16_t bank = address >> 12;
-			const uint16_t offset = address & 4095;
-			cartridge->CHR[chr_offsets[bank] + static_cast<int>(offset)] = value;
+		if ((value & 0x80) == 0x80) {
+			shift_reg = 0x10;
+			writeCtrl(cartridge, control | 0x0C);
+			updateOffsets(cartridge);
 		}
-		else if (address >= 0x8000) {
-			if ((value & 0x80) == 0x80) {
-				shift_reg = 0x10;
-				writeCtrl(cartridge, control | 0x0C);
-				updateOffsets(cartridge);
-			}
-			else {
-				const bool complete = (shift_reg & 1) == 1;
-				shift_reg >>= 1;
-				shift_reg |= (value & 1) << 4;
-				if (complete) {
-					if (address <= 0x9FFF) {
-						writeCtrl(cartridge, shift_reg);
-					}
-					else if (address <= 0xBFFF) {
-						// CHRbank 0 ($A000-$BFFF)
-						chr_bank0 = shift_reg;
-					}
-					else if (address <= 0xDFFF) {
-						// CHRbank 1 ($C000-$DFFF)
-						chr_bank1 = shift_reg;
-					}
-					else {
-						// PRGbank ($E000-$FFFF)
-						prg_bank = shift_reg & 0x0F;
-					}
-					updateOffsets(cartridge);
-					shift_reg = 0x10;
+		else {
+			const bool complete = (shift_reg & 1) == 1;
+			shift_reg >>= 1;
+			shift_reg |= (value & 1) << 4;
+			if (complete) {
+				if (address <= 0x9FFF) {
+					writeCtrl(cartridge, shift_reg);
+				}
+				else if (address <= 0xBFFF) {
+					// CHRbank 0 ($A000-$BFFF)
+					chr_bank0 = shift_reg;
+				}
+				else if (address <= 0xDFFF) {
+					// CHRbank 1 ($C000-$DFFF)
+					chr_bank1 = shift_reg;
+				}
+				else {
+					// PRGbank ($E000-$FFFF)
+					prg_bank = shift_reg & 0x0F;
 				}
+				updateOffsets(cartridge);
+				shift_reg = 0x10;
 			}
 		}
-		else if (address >= 0x6000) {
-			cartridge->SRAM[static_cast<int>(address) - 0x6000] = value;
-		}
-		else {
-			std::cerr << "ERROR: Mapper1 encountered unrecognized write (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-		}
 	}
 
 	void updateCounter(CPU* cpu) {
 		static_cast<void>(cpu);
 	}
 
+	void updatePages(Cartridge* cartridge) {
+		prg_pages[3] = cartridge->SRAM;
+		for (int i = 0; i < 4; ++i) {
+			prg_pages[4 + i] = cartridge->PRG + prg_offsets[i >> 1] + ((i & 1) << 13);
+		}
+		for (int i = 0; i < 8; ++i) {
+			chr_pages[i] = cartridge->CHR + chr_offsets[i >> 2] + ((i & 3) << 10);
+		}
+	}
+
 	Mapper1() : shift_reg(0), control(0), prg_mode(0), chr_mode(0), prg_bank(0), chr_bank0(0), chr_bank1(0), prg_offsets{ 0, 0 }, chr_offsets{ 0, 0 } {}
 };
 
@@ -543,48 +586,27 @@ struct Mapper2 : public Mapper {
 	int prg_bank1;
 	int prg_bank2;
 
-	uint8_t read(Cartridge* cartridge, uint16_t address) {
-		if (address < 0x2000) {
-			return cartridge->CHR[address];
-		}
-		else if (address >= 0xC000) {
-			const int index = (prg_bank2 << 14) + static_cast<int>(address - 0xC000);
-			return cartridge->PRG[index];
-		}
-		else if (address >= 0x8000) {
-			const int index = (prg_bank1 << 14) + static_cast<int>(address - 0x8000);
-			return cartridge->PRG[index];
-		}
-		else if (address >= 0x6000) {
-			const int index = static_cast<int>(address) - 0x6000;
-			return cartridge->SRAM[index];
-		}
-		else {
-			std::cerr << "ERROR: Mapper2 encountered unrecognized read (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-			return 0;
-		}
-	}
-
 	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
-		if (address < 0x2000) {
-			cartridge->CHR[address] = value;
-		}
-		else if (address >= 0x8000) {
-			prg_bank1 = static_cast<int>(value) % prg_banks;
-		}
-		else if (address >= 0x6000) {
-			const int index = static_cast<int>(address) - 0x6000;
-			cartridge->SRAM[index] = value;
-		}
-		else {
-			std::cerr << "ERROR: Mapper2 encountered unrecognized write (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-		}
+		static_cast<void>(address);
+		prg_bank1 = static_cast<int>(value) % prg_banks;
+		updatePages(cartridge);
 	}
 
 	void updateCounter(CPU* cpu) {
 		static_cast<void>(cpu);
 	}
 
+	void updatePages(Cartridge* cartridge) {
+		prg_pages[3] = cartridge->SRAM;
+		prg_pages[4] = cartridge->PRG + (prg_bank1 << 14);
+		prg_pages[5] = prg_pages[4] + 0x2000;
+		prg_pages[6] = cartridge->PRG + (prg_bank2 << 14);
+		prg_pages[7] = prg_pages[6] + 0x2000;
+		for (int i = 0; i < 8; ++i) {
+			chr_pages[i] = cartridge->CHR + (i << 10);
+		}
+	}
+
 	Mapper2(int _prgBanks, int _prgBank1, int _prgBank2) : prg_banks(_prgBanks), prg_bank1(_prgBank1), prg_bank2(_prgBank2) {}
 };
 
@@ -593,49 +615,27 @@ struct Mapper3 : public Mapper {
 	int prg_bank1;
 	int prg_bank2;
 
-	uint8_t read(Cartridge* cartridge, uint16_t address) {
-		if (address < 0x2000) {
-			const int index = chr_bank * 0x2000 + static_cast<int>(address);
-			return cartridge->CHR[index];
-		}
-		else if (address >= 0xC000) {
-			const int index = prg_bank2 * 0x4000 + static_cast<int>(address - 0xC000);
-			return cartridge->PRG[index];
-		}
-		else if (address >= 0x8000) {
-			const int index = prg_bank1 * 0x4000 + static_cast<int>(address - 0x8000);
-			return cartridge->PRG[index];
-		}
-		else if (address >= 0x6000) {
-			const int index = int(address) - 0x6000;
-			return cartridge->SRAM[index];
-		}
-		else {
-			std::cerr << "ERROR: Mapper3 encountered unrecognized read (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-			return 0;
-		}
-	}
-
 	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
-		if (address < 0x2000) {
-			const int index = chr_bank * 0x2000 + static_cast<int>(address);
-			cartridge->CHR[index] = value;
-		}
-		else if (address >= 0x8000) {
-			chr_bank = static_cast<int>(value & 3);
-		}
-		else if (address >= 0x6000) {
-			const int index = static_cast<int>(address) - 0x6000;
-			cartridge->SRAM[index] = value;
-		}
-		else {
-			std::cerr << "ERROR: Mapper3 encountered unrecognized write (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-		}
+		static_cast<void>(address);
+		chr_bank = static_cast<int>(value & 3);
+		updatePages(cartridge);
 	}
+
 	void updateCounter(CPU* cpu) {
 		static_cast<void>(cpu);
 	}
 
+	void updatePages(Cartridge* cartridge) {
+		prg_pages[3] = cartridge->SRAM;
+		prg_pages[4] = cartridge->PRG + prg_bank1 * 0x4000;
+		prg_pages[5] = prg_pages[4] + 0x2000;
+		prg_pages[6] = cartridge->PRG + prg_bank2 * 0x4000;
+		prg_pages[7] = prg_pages[6] + 0x2000;
+		for (int i = 0; i < 8; ++i) {
+			chr_pages[i] = cartridge->CHR + chr_bank * 0x2000 + (i << 10);
+		}
+	}
+
 	Mapper3(int _chrBank, int _prgBank1, int _prgBank2) : chr_bank(_chrBank), prg_bank1(_prgBank1), prg_bank2(_prgBank2) {}
 };
 
@@ -654,141 +654,117 @@ struct Mapper4 : public Mapper {
 	int chrBankOffset(Cartridge* cartridge, int index);
 	void updateOffsets(Cartridge* cartridge);
 
-	uint8_t read(Cartridge* cartridge, uint16_t address) {
-		if (address < 0x2000) {
-			const uint16_t bank = address >> 10;
-			const uint16_t offset = address & 1023;
-			return cartridge->CHR[chr_offsets[bank] + static_cast<int>(offset)];
+	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
+		if (address <= 0x9FFF && (address & 1) == 0) {
+			// bank select
+			prg_mode = (value >> 6) & 1;
+			chr_mode = (value >> 7) & 1;
+			reg = value & 7;
+			updateOffsets(cartridge);
+		}
+		else if (address <= 0x9FFF && (address & 1)) {
+			// bank data
+			regs[reg] = value;
+			updateOffsets(cartridge);
+		}
+		else if (address <= 0xBFFF && (address & 1) == 0) {
+			switch (value & 1) {
+			case 0:
+				cartridge->mirror = MirrorVertical;
+				break;
+			case 1:
+				cartridge->mirror = MirrorHorizontal;
+				break;
+			}
 		}
-		else if (address >= 0x8000) {
-			address -= 0x8000;
-			const uint16_t bank = address >> 13;
-			const uint16_t offset = address & 8191;
-			return cartridge->PRG[prg_offsets[bank] + static_cast<int>(offset)];
+		else if (address <= 0xBFFF && (address & 1)) {
+			// TODO
 		}
-		else if (address >= 0x6000) {
-			return cartridge->SRAM[static_cast<int>(address) - 0x6000];
+		else if (address <= 0xDFFF && (address & 1) == 0) {
+			// IRQ latch
+			reload = value;
 		}
-		else {
-			std::cerr << "ERROR: Mapper4 encountered unrecognized read (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-			return 0;
+		else if (address <= 0xDFFF && (address & 1)) {
+			// IRQ reload
+			counter = 0;
 		}
-	}
-
-	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
-		if (address < 0x2000) {
-			const uint16_t bank = address >> 10;
-			const uint16_t offset = address & 1023;
-			cartridge->CHR[chr_offsets[bank] + static_cast<int>(offset)] = value;
-		}
-		else if (address >= 0x8000) {
-			if (address <= 0x9FFF && (address & 1) == 0) {
-				// bank select
-				prg_mode = (value >> 6) & 1;
-				chr_mode = (value >> 7) & 1;
-				reg = value & 7;
-				updateOffsets(cartridge);
-			}
-			else if (address <= 0x9FFF && (address & 1)) {
-				// bank data
-				regs[reg] = value;
-				updateOffsets(cartridge);
-			}
-			else if (address <= 0xBFFF && (address & 1) == 0) {
-				switch (value & 1) {
-				case 0:
-					cartridge->mirror = MirrorVertical;
-					break;
-				case 1:
-					cartridge->mirror = MirrorHorizontal;
-					break;
-				}
-			}
-			else if (address <= 0xBFFF && (address & 1)) {
-				// TODO
-			}
-			else if (address <= 0xDFFF && (address & 1) == 0) {
-				// IRQ latch
-				reload = value;
-			}
-			else if (address <= 0xDFFF && (address & 1)) {
-				// IRQ reload
-				counter = 0;
-			}
-			else if ((address & 1) == 0) {
-				// IRQ disable
-				IRQ_enable = false;
-			}
-			else {
-				// IRQ enable
-				IRQ_enable = true;
-			}
-		}
-		else if (address >= 0x6000) {
-			cartridge->SRAM[static_cast<int>(address) - 0x6000] = value;
+		else if ((address & 1) == 0) {
+			// IRQ disable
+			IRQ_enable = false;
 		}
 		else {
-			std::cerr << "ERROR: Mapper4 encountered unrecognized write (address 0x" << std::hex << address << std::dec << ')' << std::endl;
+			// IRQ enable
+			IRQ_enable = true;
 		}
 	}
 
 	void updateCounter(CPU* cpu);
 
+	void updatePages(Cartridge* cartridge) {
+		prg_pages[3] = cartridge->SRAM;
+		for (int i = 0; i < 4; ++i) {
+			prg_pages[4 + i] = cartridge->PRG + prg_offsets[i];
+		}
+		for (int i = 0; i < 8; ++i) {
+			chr_pages[i] = cartridge->CHR + chr_offsets[i];
+		}
+	}
+
 	Mapper4() : reg(0), regs{ 0, 0, 0, 0, 0, 0, 0, 0 }, prg_mode(0), chr_mode(0), prg_offsets{ 0, 0, 0, 0 }, chr_offsets{ 0, 0, 0, 0, 0, 0, 0, 0 }, reload(0), counter(0), IRQ_enable(false) {}
 };
 
 struct Mapper7 : public Mapper {
 	int prg_bank;
 
-	uint8_t read(Cartridge* cartridge, uint16_t address) {
-		if (address < 0x2000) {
-			return cartridge->CHR[address];
-		}
-		else if (address >= 0x8000) {
-			const int index = (prg_bank << 15) + static_cast<int>(address - 0x8000);
-			return cartridge->PRG[index];
-		}
-		else if (address >= 0x6000) {
-			const int index = static_cast<int>(address) - 0x6000;
-			return cartridge->SRAM[index];
-		}
-		else {
-			std::cerr << "ERROR: Mapper7 encountered unrecognized read (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-			return 0;
-		}
-	}
-
 	void write(Cartridge* cartridge, uint16_t address, uint8_t value) {
-		if (address < 0x2000) {
-			cartridge->CHR[address] = value;
-		}
-		else if (address >= 0x8000) {
-			prg_bank = static_cast<int>(value & 7);
-			switch (value & 0x10) {
-			case 0x00:
-				cartridge->mirror = MirrorSingle0;
-				break;
-			case 0x10:
-				cartridge->mirror = MirrorSingle1;
-				break;
-			}
-		}
-		else if (address >= 0x6000) {
-			int index = static_cast<int>(address) - 0x6000;
-			cartridge->SRAM[index] = value;
-		}
-		else {
-			std::cerr << "ERROR: Mapper7 encountered unrecognized write (address 0x" << std::hex << address << std::dec << ')' << std::endl;
-		}
+		static_cast<void>(address);
+		prg_bank = static_cast<int>(value & 7);
+		switch (value & 0x10) {
+		case 0x00:
+			cartridge->mirror = MirrorSingle0;
+			break;
+		case 0x10:
+			cartridge->mirror = MirrorSingle1;
+			break;
+		}
+		updatePages(cartridge);
 	}
 
 	void updateCounter(CPU* cpu) {
 		static_cast<void>(cpu);
 	}
 
+	void updatePages(Cartridge* cartridge) {
+		prg_pages[3] = cartridge->SRAM;
+		for (int i = 0; i < 4; ++i) {
+			prg_pages[4 + i] = cartridge->PRG + (prg_bank << 15) + (i << 13);
+		}
+		for (int i = 0; i < 8; ++i) {
+			chr_pages[i] = cartridge->CHR + (i << 10);
+		}
+	}
+
 	Mapper7() : prg_bank(0) {}
 };
 
+// what the CPU saw from outside during a run, for --cpu-bench: every value a
+// register read returned, and every interrupt with the CPU cycle it was taken
+// at. replayed, it runs the same instructions again with no PPU, APU or
+// controllers behind the registers
+struct CPUTrace {
+	struct Interrupt {
+		uint64_t cycle;
+		uint8_t type;
+	};
+
+	bool replay; // false while recording
+	std::vector<uint8_t> reads;
+	std::vector<Interrupt> interrupts;
+	size_t next_read;
+
+	CPUTrace() : replay(false), next_read(0) {}
+};
+
 struct NES {
 	bool initialized;
 	CPU* cpu;
@@ -799,10 +775,40 @@ struct NES {
 	Controller* controller2;
 	Mapper* mapper;
 	uint8_t* RAM;
+	CPUTrace* trace; // recorded or replayed, nullptr normally
 
-	NES(const char* path, const char* SRAM_path);
+	// 'quiet' leaves out the progress banner, errors are still reported
+	NES(const char* path, const char* SRAM_path, bool quiet = false);
+	~NES();
+
+	NES(const NES&) = delete;
+	NES& operator=(const NES&) = delete;
 };
 
+// for the small functions every instruction goes through. the compiler stops
+// inlining them by itself in a function as large as runSpecialized
+#if defined(_MSC_VER)
+#define CPU_INLINE __forceinline
+#elif defined(__GNUC__)
+#define CPU_INLINE inline __attribute__((always_inline))
+#else
+#define CPU_INLINE inline
+#endif
+
+uint8_t readRegister(NES* nes, uint16_t address);
+
+// RAM and cartridge reads, which includes every opcode and operand fetch, are
+// inlined and go straight through the page tables. $2000-$5FFF is registers
+CPU_INLINE uint8_t readByte(NES* nes, uint16_t address) {
+	if (address < 0x2000) {
+		return nes->RAM[address & 2047];
+	}
+	if (address >= 0x6000) {
+		return nes->mapper->prg_pages[address >> 13][address & 8191];
+	}
+	return readRegister(nes, address);
+}
+
 struct Instruction {
 	const uint8_t opcode;
 	const char* name;
@@ -820,18 +826,45 @@ void dmcRestart(DMC* d);
 
 uint8_t readPalette(PPU* ppu, uint16_t address);
 uint8_t readPPU(NES* nes, uint16_t address);
-uint8_t readByte(NES* nes, uint16_t address);
 void push16(NES* nes, uint16_t value);
 void php(CPU* cpu, NES* nes, uint16_t address, uint8_t mode);
 
 uint16_t read16(NES* nes, uint16_t address);
 void execute(NES* nes, uint8_t opcode);
+void executeSpecialized(NES* nes, uint8_t opcode);
+void runSpecialized(NES* nes, uint64_t until);
 void writeByte(NES* nes, uint16_t address, uint8_t value);
+int step(NES* nes);
 void emulate(NES* nes, double seconds);
+void emulateFrame(NES* nes);
+void invalidatePatterns(PPU* ppu, uint16_t address, int size);
+void runPPU(NES* nes, PPU* ppu, uint64_t until, bool hold_line);
+void catchUpPPU(NES* nes);
+void schedulePPU(PPU* ppu);
+void catchUpAPU(NES* nes);
+void scheduleAPU(APU* apu);
+void flushSamples(APU* apu);
+void setSampleRatio(APU* apu, double ratio);
 
 void setI(CPU* cpu, bool value);
 uint8_t getI(CPU* cpu);
 
 void tickEnvelope(APU* apu);
 void tickSweep(APU* apu);
-void tickLength(APU* apu);
\ No newline at end of file
+void tickLength(APU* apu);
+// move the PPU and APU along behind an instruction that took 'cycles' CPU
+// cycles. they only run when they reach something the CPU could see, see
+// runPPU and runAPU
+CPU_INLINE void advanceClocks(NES* nes, int cycles) {
+	PPU* ppu = nes->ppu;
+	ppu->target_dot += cycles * 3;
+	if (ppu->target_dot >= ppu->deadline) {
+		runPPU(nes, ppu, ppu->target_dot, true);
+	}
+
+	APU* apu = nes->apu;
+	apu->target_cycle += cycles;
+	if (apu->target_cycle >= apu->deadline) {
+		catchUpAPU(nes);
+	}
+}
@@ -0,0 +1,155 @@
+// audio_ring.h - lock-free sample queue from the emulation thread to the audio callback
+//
+// Single-header library: define AUDIO_RING_IMPLEMENTATION in exactly one
+// translation unit before including it.
+//
+// One producer (the emulator, once per emulated frame) and one consumer (the
+// audio device callback, once per period) share a fixed ring of mono samples.
+// Each side owns one index and only reads the other's, so neither ever waits
+// on a lock the other may be holding while the OS has it descheduled.
+//
+// When the ring is full the producer drops the samples that don't fit
+// (overrun): the oldest ones belong to the consumer and are about to be
+// played anyway. When it runs dry the consumer repeats the last sample it
+// played (underrun), which is quieter than dropping to zero mid-waveform.
+//
+// The emulator's clock and the sound card's are never exactly in step, so a
+// fixed sample rate slowly fills or drains any buffer. AudioRateControl nudges
+// the rate samples are produced at by up to +-0.5% (well below audible pitch
+// change) to hold the ring at a target fill level, i.e. a fixed latency.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// power of two; about 370 ms at 44.1 kHz
+#define AUDIO_RING_CAPACITY 16384
+#define AUDIO_RATE_MAX_DEVIATION 0.005
+#define AUDIO_RATE_SMOOTHING 0.05  // weight of each new fill level, the callback makes it jumpy
+#define AUDIO_RATE_INTEGRAL 0.01   // how fast a steady clock difference is learned
+
+typedef struct {
+    alignas(64) std::atomic<uint32_t> head;  // next sample to write, producer only
+    alignas(64) std::atomic<uint32_t> tail;  // next sample to read, consumer only
+    float last;                              // consumer only
+    std::atomic<uint64_t> overrun;           // samples dropped by the producer
+    std::atomic<uint64_t> underrun;          // samples made up by the consumer
+    std::atomic<uint64_t> underrun_events;   // callbacks that ran dry
+    float data[AUDIO_RING_CAPACITY];
+} AudioRing;
+
+void audio_ring_reset(AudioRing* r);
+// producer: returns how many samples fit, the rest count as overrun
+size_t audio_ring_write(AudioRing* r, const float* samples, size_t count);
+// consumer: always fills 'count' samples, returns how many were real
+size_t audio_ring_read(AudioRing* r, float* out, size_t count);
+// samples waiting to be played, from either side
+size_t audio_ring_fill(const AudioRing* r);
+
+typedef struct {
+    double target;      // samples the ring should hold
+    double fill;        // smoothed fill level
+    double drift;       // accumulated error, what the clocks differ by in the long run
+    double ratio;       // production rate relative to nominal, 1 +- AUDIO_RATE_MAX_DEVIATION
+    // for the report on exit
+    size_t fill_min, fill_max;
+    double fill_sum;
+    uint64_t updates;
+} AudioRateControl;
+
+void audio_rate_init(AudioRateControl* c, size_t target);
+// call once per flush with the current fill level; returns the new ratio
+double audio_rate_update(AudioRateControl* c, size_t fill);
+
+#ifdef AUDIO_RING_IMPLEMENTATION
+
+#include <cstring>
+
+void audio_ring_reset(AudioRing* r) {
+    r->head.store(0, std::memory_order_relaxed);
+    r->tail.store(0, std::memory_order_relaxed);
+    r->last = 0.0f;
+    r->overrun.store(0, std::memory_order_relaxed);
+    r->underrun.store(0, std::memory_order_relaxed);
+    r->underrun_events.store(0, std::memory_order_relaxed);
+}
+
+size_t audio_ring_write(AudioRing* r, const float* samples, size_t count) {
+    const uint32_t head = r->head.load(std::memory_order_relaxed);
+    const uint32_t tail = r->tail.load(std::memory_order_acquire);
+    const size_t space = AUDIO_RING_CAPACITY - (uint32_t)(head - tail);
+    const size_t n = count < space ? count : space;
+
+    // at most two copies, split where the ring wraps
+    const uint32_t at = head & (AUDIO_RING_CAPACITY - 1);
+    const size_t first = n < AUDIO_RING_CAPACITY - at ? n : AUDIO_RING_CAPACITY - at;
+    memcpy(r->data + at, samples, first * sizeof(float));
+    memcpy(r->data, samples + first, (n - first) * sizeof(float));
+    r->head.store(head + (uint32_t)n, std::memory_order_release);
+
+    if (n < count) {
+        r->overrun.fetch_add(count - n, std::memory_order_relaxed);
+    }
+    return n;
+}
+
+size_t audio_ring_read(AudioRing* r, float* out, size_t count) {
+    const uint32_t tail = r->tail.load(std::memory_order_relaxed);
+    const uint32_t head = r->head.load(std::memory_order_acquire);
+    const size_t available = (uint32_t)(head - tail);
+    const size_t n = count < available ? count : available;
+
+    const uint32_t at = tail & (AUDIO_RING_CAPACITY - 1);
+    const size_t first = n < AUDIO_RING_CAPACITY - at ? n : AUDIO_RING_CAPACITY - at;
+    memcpy(out, r->data + at, first * sizeof(float));
+    memcpy(out + first, r->data, (n - first) * sizeof(float));
+    r->tail.store(tail + (uint32_t)n, std::memory_order_release);
+
+    if (n > 0) {
+        r->last = out[n - 1];
+    }
+    if (n < count) {
+        for (size_t i = n; i < count; i++) {
+            out[i] = r->last;
+        }
+        r->underrun.fetch_add(count - n, std::memory_order_relaxed);
+        r->underrun_events.fetch_add(1, std::memory_order_relaxed);
+    }
+    return n;
+}
+
+size_t audio_ring_fill(const AudioRing* r) {
+    return (uint32_t)(r->head.load(std::memory_order_acquire) - r->tail.load(std::memory_order_acquire));
+}
+
+void audio_rate_init(AudioRateControl* c, size_t target) {
+    c->target = target > 0 ? (double)target : 1.0;
+    c->fill = c->target;
+    c->drift = 0.0;
+    c->ratio = 1.0;
+    c->fill_min = SIZE_MAX;
+    c->fill_max = 0;
+    c->fill_sum = 0.0;
+    c->updates = 0;
+}
+
+double audio_rate_update(AudioRateControl* c, size_t fill) {
+    c->fill += ((double)fill - c->fill) * AUDIO_RATE_SMOOTHING;
+    const double error = (c->target - c->fill) / c->target;
+    c->drift += error * AUDIO_RATE_INTEGRAL;
+    c->drift = c->drift < -1.0 ? -1.0 : c->drift > 1.0 ? 1.0 : c->drift;
+    // too few samples queued: make more of them, and fewer when there are too many
+    double adjust = error + c->drift;
+    adjust = adjust < -1.0 ? -1.0 : adjust > 1.0 ? 1.0 : adjust;
+    c->ratio = 1.0 + AUDIO_RATE_MAX_DEVIATION * adjust;
+
+    if (fill < c->fill_min) c->fill_min = fill;
+    if (fill > c->fill_max) c->fill_max = fill;
+    c->fill_sum += (double)fill;
+    ++c->updates;
+    return c->ratio;
+}
+
+#endif // AUDIO_RING_IMPLEMENTATION
@@ -0,0 +1,138 @@
+// blip_buffer.h - band-limited resampling of a stepped waveform
+//
+// Single-header library: define BLIP_BUFFER_IMPLEMENTATION in exactly one
+// translation unit before including it.
+//
+// The APU's output only ever jumps between levels, at CPU cycle granularity.
+// Instead of point-sampling it (which folds everything above 22 kHz back into
+// the audible range), each jump is recorded as an amplitude delta at its exact
+// clock time. The delta is spread over the output samples around it as a
+// band-limited impulse (a windowed sinc, tabulated at BLIP_PHASES sub-sample
+// positions), and reading sums the impulses back up into clean steps.
+//
+// Everything is integer arithmetic and each kernel row sums to exactly
+// 1 << BLIP_KERNEL_BITS, so a step always settles on its exact level and the
+// running sum never drifts. The output lags the input by BLIP_WIDTH / 2
+// samples.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#define BLIP_WIDTH 16        // kernel taps per delta
+#define BLIP_PHASE_BITS 6
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)  // sub-sample positions
+#define BLIP_KERNEL_BITS 15
+#define BLIP_TIME_BITS 32    // fractional bits of the sample position
+#define BLIP_CUTOFF 0.45     // of the output rate, just under Nyquist
+
+typedef struct {
+    uint64_t factor;          // output samples per input clock, BLIP_TIME_BITS fixed point
+    uint64_t offset;          // position of the current frame's clock 0 in the buffer, same format
+    int64_t integrator;       // sum of everything read so far
+    std::vector<int64_t> buf; // pending deltas, one slot per output sample
+} BlipBuffer;
+
+void blip_init(BlipBuffer* b, double clocks_per_sample);
+// only between frames: a frame in progress keeps the rate it started with
+void blip_set_rate(BlipBuffer* b, double clocks_per_sample);
+// 'clock' counts from the start of the current frame
+void blip_add_delta(BlipBuffer* b, uint32_t clock, int32_t delta);
+// ends the frame after 'clocks' clocks; returns the samples now ready
+int blip_end_frame(BlipBuffer* b, uint32_t clocks);
+// takes 'count' samples, at most what blip_end_frame returned, scaled by 'gain'
+void blip_read_samples(BlipBuffer* b, float* out, int count, float gain);
+
+#ifdef BLIP_BUFFER_IMPLEMENTATION
+
+#include <cmath>
+#include <cstring>
+
+typedef struct {
+    int32_t taps[BLIP_PHASES][BLIP_WIDTH];
+} BlipKernel;
+
+static BlipKernel blip_kernel_table() {
+    BlipKernel k;
+    const double pi = 3.14159265358979323846;
+    for (int p = 0; p < BLIP_PHASES; p++) {
+        // tap i lands on output sample i, the step itself at BLIP_WIDTH / 2 + p / BLIP_PHASES
+        double h[BLIP_WIDTH];
+        double sum = 0.0;
+        for (int i = 0; i < BLIP_WIDTH; i++) {
+            const double x = i - BLIP_WIDTH / 2 - (double)p / BLIP_PHASES;
+            const double y = 2.0 * BLIP_CUTOFF * x;
+            const double sinc = y == 0.0 ? 1.0 : sin(pi * y) / (pi * y);
+            const double w = x / BLIP_WIDTH;  // -0.5..0.5, Blackman window
+            const double window = 0.42 + 0.5 * cos(2.0 * pi * w) + 0.08 * cos(4.0 * pi * w);
+            h[i] = sinc * window;
+            sum += h[i];
+        }
+        // rounding error goes to the largest tap so the row sums exactly
+        int32_t total = 0;
+        int largest = 0;
+        for (int i = 0; i < BLIP_WIDTH; i++) {
+            k.taps[p][i] = (int32_t)lround(h[i] / sum * (1 << BLIP_KERNEL_BITS));
+            total += k.taps[p][i];
+            if (k.taps[p][i] > k.taps[p][largest]) largest = i;
+        }
+        k.taps[p][largest] += (1 << BLIP_KERNEL_BITS) - total;
+    }
+    return k;
+}
+
+static const BlipKernel blip_kernel = blip_kernel_table();
+
+void blip_init(BlipBuffer* b, double clocks_per_sample) {
+    b->offset = 0;
+    b->integrator = 0;
+    // a second of 44.1 kHz output to begin with, grown for longer frames
+    b->buf.assign(44100 + BLIP_WIDTH, 0);
+    blip_set_rate(b, clocks_per_sample);
+}
+
+void blip_set_rate(BlipBuffer* b, double clocks_per_sample) {
+    b->factor = (uint64_t)((double)(1ull << BLIP_TIME_BITS) / clocks_per_sample + 0.5);
+}
+
+void blip_add_delta(BlipBuffer* b, uint32_t clock, int32_t delta) {
+    const uint64_t time = b->offset + clock * b->factor;
+    const size_t index = (size_t)(time >> BLIP_TIME_BITS);
+    const int phase = (int)(time >> (BLIP_TIME_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1);
+    if (index + BLIP_WIDTH > b->buf.size()) {
+        b->buf.resize((index + BLIP_WIDTH) * 2, 0);
+    }
+    int64_t* out = &b->buf[index];
+    const int32_t* taps = blip_kernel.taps[phase];
+    for (int i = 0; i < BLIP_WIDTH; i++) {
+        out[i] += (int64_t)taps[i] * delta;
+    }
+}
+
+int blip_end_frame(BlipBuffer* b, uint32_t clocks) {
+    b->offset += clocks * b->factor;
+    const size_t ready = (size_t)(b->offset >> BLIP_TIME_BITS);
+    if (ready + BLIP_WIDTH > b->buf.size()) {
+        b->buf.resize(ready + BLIP_WIDTH, 0);
+    }
+    return (int)ready;
+}
+
+void blip_read_samples(BlipBuffer* b, float* out, int count, float gain) {
+    const float scale = gain / (float)(1 << BLIP_KERNEL_BITS);
+    int64_t sum = b->integrator;
+    for (int i = 0; i < count; i++) {
+        sum += b->buf[i];
+        out[i] = (float)sum * scale;
+    }
+    b->integrator = sum;
+
+    // the kernel tails of the last deltas move to the front
+    const size_t pending = (size_t)(b->offset >> BLIP_TIME_BITS) - count + BLIP_WIDTH;
+    memmove(b->buf.data(), b->buf.data() + count, pending * sizeof(int64_t));
+    memset(b->buf.data() + pending, 0, count * sizeof(int64_t));
+    b->offset -= (uint64_t)count << BLIP_TIME_BITS;
+}
+
+#endif // BLIP_BUFFER_IMPLEMENTATION
@@ -980,59 +980,56 @@ constexpr Instruction instructions[256] = {
 	{ 255, "ISC", nop, 2, 0, 7, 0 }
 };
 
-void execute(NES* nes, uint8_t opcode) {
-	const Instruction& instruction = instructions[opcode];
-	CPU* cpu = nes->cpu;
-
-	uint16_t address = 0;
-	bool page_crossed = false;
-	uint16_t offset;
-
-	switch (instruction.mode) {
+// the address an instruction works on, from the bytes after its opcode. the
+// table core passes the mode at run time; the specialized handlers pass it as
+// a constant, and the switch folds away once this is inlined into them
+static CPU_INLINE uint16_t operandAddress(CPU* cpu, NES* nes, uint8_t mode, bool& page_crossed) {
+	switch (mode) {
 	case modeAbsolute:
-		address = read16(nes, cpu->PC + 1);
-		break;
-	case modeAbsoluteX:
-		address = read16(nes, cpu->PC + 1) + static_cast<uint16_t>(cpu->X);
+		return read16(nes, cpu->PC + 1);
+	case modeAbsoluteX: {
+		const uint16_t address = read16(nes, cpu->PC + 1) + static_cast<uint16_t>(cpu->X);
 		page_crossed = pagesDiffer(address - static_cast<uint16_t>(cpu->X), address);
-		break;
-	case modeAbsoluteY:
-		address = read16(nes, cpu->PC + 1) + static_cast<uint16_t>(cpu->Y);
+		return address;
+	}
+	case modeAbsoluteY: {
+		const uint16_t address = read16(nes, cpu->PC + 1) + static_cast<uint16_t>(cpu->Y);
 		page_crossed = pagesDiffer(address - static_cast<uint16_t>(cpu->Y), address);
-		break;
-	case modeAccumulator:
-		address = 0;
-		break;
+		return address;
+	}
 	case modeImmediate:
-		address = cpu->PC + 1;
-		break;
-	case modeImplied:
-		address = 0;
-		break;
+		return cpu->PC + 1;
 	case modeIndexedIndirect:
-		address = read16_ff_bug(nes, static_cast<uint16_t>(static_cast<uint8_t>(readByte(nes, cpu->PC + 1) + cpu->X)));
-		break;
+		return read16_ff_bug(nes, static_cast<uint16_t>(static_cast<uint8_t>(readByte(nes, cpu->PC + 1) + cpu->X)));
 	case modeIndirect:
-		address = read16_ff_bug(nes, read16(nes, cpu->PC + 1));
-		break;
-	case modeIndirectIndexed:
-		address = read16_ff_bug(nes, static_cast<uint16_t>(readByte(nes, cpu->PC + 1))) + static_cast<uint16_t>(cpu->Y);
+		return read16_ff_bug(nes, read16(nes, cpu->PC + 1));
+	case modeIndirectIndexed: {
+		const uint16_t address = read16_ff_bug(nes, static_cast<uint16_t>(readByte(nes, cpu->PC + 1))) + static_cast<uint16_t>(cpu->Y);
 		page_crossed = pagesDiffer(address - static_cast<uint16_t>(cpu->Y), address);
-		break;
-	case modeRelative:
-		offset = static_cast<uint16_t>(readByte(nes, cpu->PC + 1));
-		address = cpu->PC + 2 + offset - ((offset >= 128) << 8);
-		break;
+		return address;
+	}
+	case modeRelative: {
+		const uint16_t offset = static_cast<uint16_t>(readByte(nes, cpu->PC + 1));
+		return cpu->PC + 2 + offset - ((offset >= 128) << 8);
+	}
 	case modeZeroPage:
-		address = static_cast<uint16_t>(readByte(nes, cpu->PC + 1));
-		break;
+		return static_cast<uint16_t>(readByte(nes, cpu->PC + 1));
 	case modeZeroPageX:
-		address = static_cast<uint16_t>(static_cast<uint8_t>(readByte(nes, cpu->PC + 1) + cpu->X));
-		break;
+		return static_cast<uint16_t>(static_cast<uint8_t>(readByte(nes, cpu->PC + 1) + cpu->X));
 	case modeZeroPageY:
-		address = static_cast<uint16_t>(static_cast<uint8_t>(readByte(nes, cpu->PC + 1) + cpu->Y));
-		break;
+		return static_cast<uint16_t>(static_cast<uint8_t>(readByte(nes, cpu->PC + 1) + cpu->Y));
+	default:
+		// accumulator, implied
+		return 0;
 	}
+}
+
+void execute(NES* nes, uint8_t opcode) {
+	const Instruction& instruction = instructions[opcode];
+	CPU* cpu = nes->cpu;
+
+	bool page_crossed = false;
+	const uint16_t address = operandAddress(cpu, nes, instruction.mode, page_crossed);
 
 	cpu->PC += static_cast<uint16_t>(instruction.size);
 	cpu->cycles += static_cast<uint64_t>(instruction.cycles);
@@ -1041,4 +1038,94 @@ void execute(NES* nes, uint8_t opcode) {
 	}
 
 	instruction.dispatch(cpu, nes, address, instruction.mode);
-}
\ No newline at end of file
+}
+
+// the same instructions, specialized per opcode. each handler has its
+// addressing mode, timing and operation fixed at compile time from the entry
+// in 'instructions', so the mode switch folds away and the operation is a
+// direct call the compiler can inline. 'execute' stays the reference
+
+// computed goto (GCC, Clang) or a table of handlers. build with
+// -DCPU_COMPUTED_GOTO=0 to use the table anyway
+#ifndef CPU_COMPUTED_GOTO
+#if defined(__GNUC__)
+#define CPU_COMPUTED_GOTO 1
+#else
+#define CPU_COMPUTED_GOTO 0
+#endif
+#endif
+
+template <uint8_t opcode>
+CPU_INLINE void executeOpcode(NES* nes) {
+	constexpr Instruction instruction = instructions[opcode];
+	CPU* cpu = nes->cpu;
+
+	bool page_crossed = false;
+	const uint16_t address = operandAddress(cpu, nes, instruction.mode, page_crossed);
+
+	cpu->PC += static_cast<uint16_t>(instruction.size);
+	cpu->cycles += static_cast<uint64_t>(instruction.cycles);
+	if constexpr (instruction.page_cross_cycles != 0) {
+		if (page_crossed) {
+			cpu->cycles += static_cast<uint64_t>(instruction.page_cross_cycles);
+		}
+	}
+
+	constexpr auto dispatch = instruction.dispatch;
+	dispatch(cpu, nes, address, instruction.mode);
+}
+
+// all 256 opcodes, 0x00-0xFF, through 'op'
+#define CPU_OPCODE_ROW(op, h) op(0x##h##0) op(0x##h##1) op(0x##h##2) op(0x##h##3) op(0x##h##4) op(0x##h##5) op(0x##h##6) op(0x##h##7) \
+	op(0x##h##8) op(0x##h##9) op(0x##h##A) op(0x##h##B) op(0x##h##C) op(0x##h##D) op(0x##h##E) op(0x##h##F)
+#define CPU_OPCODES(op) CPU_OPCODE_ROW(op, 0) CPU_OPCODE_ROW(op, 1) CPU_OPCODE_ROW(op, 2) CPU_OPCODE_ROW(op, 3) \
+	CPU_OPCODE_ROW(op, 4) CPU_OPCODE_ROW(op, 5) CPU_OPCODE_ROW(op, 6) CPU_OPCODE_ROW(op, 7) \
+	CPU_OPCODE_ROW(op, 8) CPU_OPCODE_ROW(op, 9) CPU_OPCODE_ROW(op, A) CPU_OPCODE_ROW(op, B) \
+	CPU_OPCODE_ROW(op, C) CPU_OPCODE_ROW(op, D) CPU_OPCODE_ROW(op, E) CPU_OPCODE_ROW(op, F)
+
+#define CPU_HANDLER(opcode) executeOpcode<opcode>,
+constexpr void(*handlers[256])(NES*) = { CPU_OPCODES(CPU_HANDLER) };
+#undef CPU_HANDLER
+
+// one instruction, for step
+void executeSpecialized(NES* nes, uint8_t opcode) {
+	handlers[opcode](nes);
+}
+
+// the bookkeeping step does after an instruction that started at CPU cycle
+// 'start', then whether runSpecialized may go on to the next one itself
+static CPU_INLINE bool finishInstruction(NES* nes, uint64_t start, uint64_t until, uint64_t frame) {
+	CPU* cpu = nes->cpu;
+	++cpu->instructions;
+	advanceClocks(nes, static_cast<int>(cpu->cycles - start));
+	return cpu->cycles < until && nes->ppu->frame == frame && cpu->interrupt == interruptNone && cpu->stall == 0;
+}
+
+// run instructions until the CPU reaches cycle 'until', the PPU a new frame,
+// or an interrupt or a stall is pending, which step has to take. runs at
+// least one, the caller makes sure neither is pending on the way in. with
+// computed goto every handler fetches and jumps to the next one itself, so
+// each has its own indirect branch to predict
+void runSpecialized(NES* nes, uint64_t until) {
+	CPU* cpu = nes->cpu;
+	const uint64_t frame = nes->ppu->frame;
+	uint64_t start = cpu->cycles;
+#if CPU_COMPUTED_GOTO
+#define CPU_LABEL(opcode) &&op_##opcode,
+	static void* const labels[256] = { CPU_OPCODES(CPU_LABEL) };
+#undef CPU_LABEL
+	goto *labels[readByte(nes, cpu->PC)];
+#define CPU_CASE(opcode) op_##opcode: \
+	executeOpcode<opcode>(nes); \
+	if (!finishInstruction(nes, start, until, frame)) return; \
+	start = cpu->cycles; \
+	goto *labels[readByte(nes, cpu->PC)];
+	CPU_OPCODES(CPU_CASE)
+#undef CPU_CASE
+#else
+	do {
+		start = cpu->cycles;
+		handlers[readByte(nes, cpu->PC)](nes);
+	} while (finishInstruction(nes, start, until, frame));
+#endif
+}
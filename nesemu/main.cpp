@@ -1,6 +1,7 @@
 #include <cmath>
 #include <vector>
 #include <chrono>
+#include <memory>
 #include <string>
 #include <format>
 #include <windows.h>
@@ -9,136 +10,397 @@
 #define MINIAUDIO_IMPLEMENTATION
 #include "miniaudio.h"
 
-#define SIXEL_START "\x1bPq"
-#define SIXEL_END   "\x1b\\"
-#define MAX_COLORS  256
+#define FRAME_STATS_IMPLEMENTATION
+#include "frame_stats.h"
 
-typedef struct {
-    uint8_t r, g, b;
-    int used;
-} ColorPalette;
+#define SIXEL_IMPLEMENTATION
+#include "sixel.h"
 
-ColorPalette palette[MAX_COLORS];
-int palette_size = 0;
+#define SIXEL_CAPTURE_IMPLEMENTATION
+#include "sixel_capture.h"
 
-int find_closest_color(uint8_t r, uint8_t g, uint8_t b) {
-    int min_dist = 255*3;
-    int index = 0;
+#define KITTY_IMPLEMENTATION
+#include "kitty.h"
 
-    for (int i = 0; i < palette_size; i++) {
-        int dr = abs(r - palette[i].r);
-        int dg = abs(g - palette[i].g);
-        int db = abs(b - palette[i].b);
-        int dist = dr + dg + db;
+#define HALFBLOCK_IMPLEMENTATION
+#include "halfblock.h"
 
-        if (dist < min_dist) {
-            min_dist = dist;
-            index = i;
-        }
+#define TERM_PROBE_IMPLEMENTATION
+#include "term_probe.h"
+
+#define FRAME_OUTPUT_IMPLEMENTATION
+#include "frame_output.h"
+
+void audio_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount)
+{
+    auto apu = (APU*)pDevice->pUserData;
+    if (apu == nullptr) {
+        return;
     }
-    return index;
-}
 
-void generate_palette(unsigned char *data, int width, int height, int channels) {
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            int idx = (i * width + j) * channels;
-            uint8_t r = data[idx];
-            uint8_t g = data[idx + 1];
-            uint8_t b = data[idx + 2];
-
-            int found = 0;
-            for (int k = 0; k < palette_size; k++) {
-                if (palette[k].r == r && palette[k].g == g && palette[k].b == b) {
-                    found = 1;
-                    break;
-                }
-            }
+    auto* outStream = (float*) pOutput;
 
-            if (!found && palette_size < MAX_COLORS) {
-                palette[palette_size].r = r;
-                palette[palette_size].g = g;
-                palette[palette_size].b = b;
-                palette_size++;
-            }
-        }
+    // mono samples into the first half of the buffer, then spread to stereo
+    // from the back so nothing is overwritten before it is read
+    audio_ring_read(&apu->stream, outStream, frameCount);
+    for (int i = (int)frameCount - 1; i >= 0; i--) {
+        const float tmp = outStream[i];
+        outStream[i * 2 + 0] = tmp;
+        outStream[i * 2 + 1] = tmp;
     }
 }
 
-std::string encode_sixel(unsigned char *img, int width, int height, int channels) {
-    std::string result;
-    result += SIXEL_START;
-    result += std::format("\"1;1;{:d};{:d}", width, height);
-
-    for (int i = 0; i < palette_size; i++) {
-        result += std::format("#{:d};2;{:d};{:d};{:d}", i,
-               palette[i].r * 100 / 255,
-               palette[i].g * 100 / 255,
-               palette[i].b * 100 / 255);
+constexpr auto nes_width  = 256;
+constexpr auto nes_height = 240;
+constexpr auto nes_fps    = 60.0988;
+constexpr auto audio_rate = 44100;
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+void write_stats(const FrameStats* stats, const char* path) {
+#if ENABLE_FRAME_STATS
+    if (path != nullptr && !frame_stats_dump_json_file(stats, path)) {
+        std::cout << "WARN: failed to write stats file!" << std::endl;
     }
+#else
+    (void)stats;
+    (void)path;
+#endif
+}
 
-    for (int y = 0; y < height; y += 6) {
-        int band_height = (height - y) < 6 ? (height - y) : 6;
+// how many visible lines this ROM touches the PPU or the mapper in the middle of,
+// which sends them down the dot by dot path
+void print_ppu_lines(const PPU* ppu) {
+    const uint64_t lines = ppu->lines_batched + ppu->lines_fallback;
+    if (lines > 0) {
+        printf("ppu: %llu of %llu visible lines drawn dot by dot (%.2f%%)\n", (unsigned long long)ppu->lines_fallback,
+               (unsigned long long)lines, ppu->lines_fallback * 100.0 / lines);
+    }
+}
 
-        for (int c = 0; c < palette_size; c++) {
-            result += std::format("#{:d}", c);
+// benchmark mode: no audio device, no console output and no pacing.
+// emulates 'frames' frames as fast as possible and reports the emulated fps.
+// with 'encode' every frame also goes through the output backend into the null
+// device, timed separately so encoder cost doesn't skew the emulation figure.
+// 'dump_path' receives the last frame as a raw index dump for sixel_bench.
+// encoded frames are recorded into 'recorder' (if open) at emulated time.
+int run_headless(NES* nes, int frames, bool encode, FrameOutput* output, const char* dump_path, SixelRecorder* recorder, FrameStats* stats) {
+    FILE* null_out = nullptr;
+    if (encode) {
+        null_out = fopen(NULL_DEVICE, "wb");
+        if (null_out == nullptr) {
+            std::cerr << "ERROR: failed to open " NULL_DEVICE << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
 
-            for (int x = 0; x < width; x++) {
-                uint8_t sixel_byte = 0;
+    using clock = std::chrono::steady_clock;
+    clock::duration emulate_time{};
+    clock::duration encode_time{};
+    uint64_t bytes = 0;
+    const uint64_t first_frame = nes->ppu->frame;
+
+    const clock::time_point start = clock::now();
+    for (int f = 0; f < frames; f++) {
+        FRAME_STATS_FRAME_BEGIN(stats);
+
+        FRAME_STATS_BEGIN(stats, STAGE_EMULATE);
+        const clock::time_point t0 = clock::now();
+        emulateFrame(nes);
+        // resampling is part of emulating a frame. nothing drains the ring
+        // without an audio device, so it simply stays full
+        flushSamples(nes->apu);
+        const clock::time_point t1 = clock::now();
+        FRAME_STATS_END(stats, STAGE_EMULATE);
+        emulate_time += t1 - t0;
+
+        size_t frame_bytes = 0;
+        if (encode) {
+            unsigned char* image = (unsigned char*)nes->ppu->front;
+            std::string result = frame_output_encode(output, stats, image, nes_width, nes_height, 4);
+
+            FRAME_STATS_BEGIN(stats, STAGE_WRITE);
+            fwrite(result.data(), 1, result.size(), null_out);
+            sixel_recorder_write_at(recorder, result.data(), result.size(), (uint64_t)(f * 1e6 / nes_fps));
+            FRAME_STATS_END(stats, STAGE_WRITE);
+
+            encode_time += clock::now() - t1;
+            frame_bytes = result.size();
+            bytes += frame_bytes;
+        }
+        FRAME_STATS_FRAME_END(stats, frame_bytes);
+    }
+    const double total_s = std::chrono::duration<double>(clock::now() - start).count();
+    const double emulate_s = std::chrono::duration<double>(emulate_time).count();
+    const double encode_s = std::chrono::duration<double>(encode_time).count();
 
-                for (int dy = 0; dy < band_height; dy++) {
-                    int current_y = y + dy;
-                    if (current_y >= height) break;
+    if (null_out != nullptr) {
+        fclose(null_out);
+    }
 
-                    int idx = (current_y * width + x) * channels;
-                    uint8_t r = img[idx];
-                    uint8_t g = img[idx + 1];
-                    uint8_t b = img[idx + 2];
+    if (dump_path != nullptr) {
+        unsigned char* image = (unsigned char*)nes->ppu->front;
+        generate_palette(image, nes_width, nes_height, 4);
+        if (!write_index_dump(dump_path, image, nes_width, nes_height, 4)) {
+            std::cerr << "ERROR: failed to write " << dump_path << std::endl;
+        }
+    }
 
-                    int color_idx = find_closest_color(r, g, b);
-                    if (color_idx == c) {
-                        sixel_byte |= (1 << dy);
-                    }
-                }
+    printf("headless: %d frames (%llu PPU frames) in %.3f s\n", frames,
+           (unsigned long long)(nes->ppu->frame - first_frame), total_s);
+    printf("  emulation: %9.1f fps  %8.3f ms/frame\n", frames / emulate_s, emulate_s * 1000.0 / frames);
+    if (encode) {
+        printf("  encode:    %9.1f fps  %8.3f ms/frame  %llu bytes/frame\n", frames / encode_s,
+               encode_s * 1000.0 / frames, (unsigned long long)(bytes / frames));
+    }
+    printf("  overall:   %9.1f fps\n", frames / total_s);
+    print_ppu_lines(nes->ppu);
+    return EXIT_SUCCESS;
+}
 
-                result += char(sixel_byte + 0x3F);
+// checks the PPU's shortcuts and the specialized CPU core: runs the ROM on
+// 'nes' and, in lockstep, on 'reference' with all of them off, and compares
+// every finished frame. stops at the first one that differs
+int run_verify(NES* nes, NES* reference, int frames) {
+    const size_t pixels = (size_t)nes_width * nes_height;
+    for (int f = 0; f < frames; f++) {
+        emulateFrame(nes);
+        emulateFrame(reference);
+        // nothing plays the audio, but it has to be taken out of the resampler
+        flushSamples(nes->apu);
+        flushSamples(reference->apu);
+
+        const uint32_t* image = nes->ppu->front;
+        const uint32_t* expected = reference->ppu->front;
+        size_t differ = 0;
+        size_t first = 0;
+        for (size_t i = 0; i < pixels; i++) {
+            if (image[i] != expected[i]) {
+                if (differ == 0) first = i;
+                ++differ;
             }
-            result += "$";
         }
-        result += "-";
+        if (differ > 0) {
+            printf("verify: frame %d differs from the reference in %zu pixels, the first at %zu,%zu\n", f, differ,
+                   first % nes_width, first / nes_width);
+            return EXIT_FAILURE;
+        }
+        // a sprite zero hit at the wrong time shows up here before it shows on screen
+        if (nes->cpu->cycles != reference->cpu->cycles) {
+            printf("verify: frame %d ends at CPU cycle %llu, the reference at %llu\n", f,
+                   (unsigned long long)nes->cpu->cycles, (unsigned long long)reference->cpu->cycles);
+            return EXIT_FAILURE;
+        }
     }
+    printf("verify: %d frames identical to the reference\n", frames);
+    print_ppu_lines(nes->ppu);
+    return EXIT_SUCCESS;
+}
 
-    result += SIXEL_END;
-    return result;
+// runs 'nes' up to CPU cycle 'cycle' on its core, the way emulateFrame does
+static void run_cpu_until(NES* nes, uint64_t cycle) {
+    while (nes->cpu->cycles < cycle) {
+        if (nes->cpu->reference) {
+            step(nes);
+        }
+        else {
+            runSpecialized(nes, cycle);
+        }
+    }
 }
 
-void audio_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount)
-{
-    auto apu = (APU*)pDevice->pUserData;
-    if (apu == nullptr) {
-        return;
+// runs the instructions of 'trace' again on a fresh 'nes', up to CPU cycle
+// 'end'. the recorded interrupts go in at the cycles they were taken at
+static void replay_cpu(NES* nes, CPUTrace* trace, uint64_t end) {
+    trace->next_read = 0;
+    for (const CPUTrace::Interrupt& interrupt : trace->interrupts) {
+        run_cpu_until(nes, interrupt.cycle);
+        nes->cpu->interrupt = interrupt.type;
+        step(nes);
     }
+    run_cpu_until(nes, end);
+}
 
-    auto* outStream = (float*) pOutput;
+// the CPU cores against each other: runs 'frames' frames of the ROM on 'nes'
+// and records what its CPU saw of the rest of the NES, then replays that on
+// fresh NESes with the PPU and APU never running, once through the
+// instructions table and once through the specialized handlers. a warm-up
+// pass of each comes first, then rounds in alternating order, and the fastest
+// round of each is reported in instructions per second
+int run_cpu_bench(NES* nes, const char* rom, const char* SRAM_path, int frames) {
+    using clock = std::chrono::steady_clock;
+    constexpr int rounds = 5;
+
+    CPUTrace trace;
+    nes->trace = &trace;
+    for (int f = 0; f < frames; f++) {
+        emulateFrame(nes);
+        flushSamples(nes->apu);
+    }
+    nes->trace = nullptr;
+    trace.replay = true;
+    const uint64_t cycles = nes->cpu->cycles;
+    const uint64_t instructions = nes->cpu->instructions;
+
+    // built up front, out of the timed part
+    std::unique_ptr<NES> runs[rounds + 1][2];
+    for (int r = 0; r <= rounds; r++) {
+        for (int c = 0; c < 2; c++) {
+            NES* run = new NES(rom, SRAM_path, true);
+            runs[r][c].reset(run);
+            if (!run->initialized) return EXIT_FAILURE;
+            run->trace = &trace;
+            run->cpu->reference = c == 0;
+            run->ppu->deadline = UINT64_MAX;
+            run->apu->deadline = UINT64_MAX;
+        }
+    }
 
-    apu->streamMutex.lock();
-    for (int i = 0; i < frameCount; i++) {
-        if (i < apu->stream.size()) {
-            float tmp = apu->stream.front();
-            outStream[i * 2 + 0] = tmp;
-            outStream[i * 2 + 1] = tmp;
-            apu->stream.erase(apu->stream.begin());
+    double seconds[2] = { HUGE_VAL, HUGE_VAL };
+    for (int r = 0; r <= rounds; r++) {
+        for (int k = 0; k < 2; k++) {
+            const int c = (r & 1) ? 1 - k : k;
+            NES* run = runs[r][c].get();
+            const clock::time_point start = clock::now();
+            replay_cpu(run, &trace, cycles);
+            const double s = std::chrono::duration<double>(clock::now() - start).count();
+            // round 0 is the warm-up
+            if (r > 0) seconds[c] = std::min(seconds[c], s);
+
+            if (run->cpu->instructions != instructions || run->cpu->cycles != cycles ||
+                trace.next_read != trace.reads.size()) {
+                printf("cpu: the %s core went off the recorded run, %llu instructions in %llu cycles against %llu in %llu\n",
+                       c == 0 ? "table" : "specialized", (unsigned long long)run->cpu->instructions,
+                       (unsigned long long)run->cpu->cycles, (unsigned long long)instructions,
+                       (unsigned long long)cycles);
+                return EXIT_FAILURE;
+            }
         }
     }
-    apu->streamMutex.unlock();
-}
 
-constexpr auto nes_width  = 256;
-constexpr auto nes_height = 240;
+    printf("cpu: %d frames, %llu instructions, %zu register reads and %zu interrupts replayed, best of %d rounds\n",
+           frames, (unsigned long long)instructions, trace.reads.size(), trace.interrupts.size(), rounds);
+    printf("  table:       %8.2f M instructions/s\n", instructions / seconds[0] / 1e6);
+    printf("  specialized: %8.2f M instructions/s  %.2fx\n", instructions / seconds[1] / 1e6, seconds[0] / seconds[1]);
+    return EXIT_SUCCESS;
+}
 
 int main(int argc, const char* argv[]) {
     if (argc < 2) {
         std::cerr << "Please pass ROM path as first parameter.\n";
+        std::cerr << "Options: --stats            show per-stage frame times\n";
+        std::cerr << "         --stats-json <file> write frame time histograms on exit\n";
+        std::cerr << "         --headless          benchmark: no audio, no output, no frame pacing\n";
+        std::cerr << "         --frames <n>        frames to run in headless mode (default 600)\n";
+        std::cerr << "         --encode            also encode each headless frame to " NULL_DEVICE "\n";
+        std::cerr << "         --dump <file>       save the last headless frame as a raw index dump\n";
+        std::cerr << "         --record <file>     save every emitted frame to a capture for sixel_replay\n";
+        std::cerr << "         --backend <name>    terminal output: " OUTPUT_BACKEND_NAMES " (default auto)\n";
+        std::cerr << "         --reprobe           ask the terminal again instead of using cached capabilities\n";
+        std::cerr << "         --latency <ms>      audio buffered ahead of the sound card (default 40)\n";
+        std::cerr << "         --ppu-dots          run the PPU without shortcuts, dot by dot (reference)\n";
+        std::cerr << "         --cpu-table         interpret the CPU through its instruction table (reference)\n";
+        std::cerr << "         --verify            compare headless frames against --ppu-dots --cpu-table, report the first difference\n";
+        std::cerr << "         --cpu-bench         instructions per second of --cpu-table against the specialized CPU core\n";
+        return EXIT_FAILURE;
+    }
+
+    bool show_stats = false;
+    const char* stats_json_path = nullptr;
+    bool headless = false;
+    bool headless_encode = false;
+    int headless_frames = 600;
+    const char* dump_path = nullptr;
+    const char* record_path = nullptr;
+    OutputBackend backend = OUTPUT_AUTO;
+    bool reprobe = false;
+    int latency_ms = 40;
+    bool ppu_dots = false;
+    bool cpu_table = false;
+    bool verify = false;
+    bool cpu_bench = false;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = true;
+        }
+        else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc) {
+            stats_json_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            headless_frames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--encode") == 0) {
+            headless_encode = true;
+        }
+        else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dump_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            if (!frame_output_parse_backend(argv[++i], &backend)) {
+                std::cerr << "unknown backend " << argv[i] << ", expected one of " OUTPUT_BACKEND_NAMES << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--reprobe") == 0) {
+            reprobe = true;
+        }
+        else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            latency_ms = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--ppu-dots") == 0) {
+            ppu_dots = true;
+        }
+        else if (strcmp(argv[i], "--cpu-table") == 0) {
+            cpu_table = true;
+        }
+        else if (strcmp(argv[i], "--verify") == 0) {
+            verify = true;
+        }
+        else if (strcmp(argv[i], "--cpu-bench") == 0) {
+            cpu_bench = true;
+        }
+    }
+    if (headless_frames <= 0) {
+        std::cerr << "--frames must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // leave the ring room to absorb a slow frame on top of the target
+    const int max_latency_ms = AUDIO_RING_CAPACITY * 1000 / audio_rate / 2;
+    if (latency_ms <= 0 || latency_ms > max_latency_ms) {
+        std::cerr << "--latency must be between 1 and " << max_latency_ms << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    static FrameStats stats;
+#if ENABLE_FRAME_STATS
+    frame_stats_init(&stats, "emulate", show_stats || stats_json_path != nullptr);
+#else
+    (void)show_stats;
+#endif
+
+    static FrameOutput frame_output;
+    if (backend == OUTPUT_AUTO && !headless) {
+        TermCaps caps;
+        term_probe_console(&caps, reprobe);
+        frame_output_init_auto(&frame_output, &caps, nes_width, nes_height);
+    }
+    else {
+        frame_output_init(&frame_output, backend);
+    }
+
+    static SixelRecorder recorder;
+    if (record_path != nullptr && !sixel_recorder_open(&recorder, record_path, nes_width, nes_height)) {
+        std::cerr << "ERROR: failed to open " << record_path << std::endl;
         return EXIT_FAILURE;
     }
 
@@ -149,6 +411,28 @@ int main(int argc, const char* argv[]) {
     std::cout << "Initializing NES..." << std::endl;
     NES* nes = new NES(argv[1], SRAM_path);
     if (!nes->initialized) return EXIT_FAILURE;
+    nes->ppu->reference = ppu_dots;
+    nes->cpu->reference = cpu_table;
+
+    if (verify) {
+        NES* reference = new NES(argv[1], SRAM_path);
+        if (!reference->initialized) return EXIT_FAILURE;
+        reference->ppu->reference = true;
+        reference->cpu->reference = true;
+        return run_verify(nes, reference, headless_frames);
+    }
+
+    if (cpu_bench) {
+        return run_cpu_bench(nes, argv[1], SRAM_path, headless_frames);
+    }
+
+    if (headless) {
+        const int ret = run_headless(nes, headless_frames, headless_encode, &frame_output, dump_path, &recorder, &stats);
+        write_stats(&stats, stats_json_path);
+        sixel_recorder_close(&recorder);
+        frame_output_free(&frame_output);
+        return ret;
+    }
 
     // init miniaudio
     ma_device_config deviceConfig;
@@ -157,7 +441,7 @@ int main(int argc, const char* argv[]) {
     deviceConfig = ma_device_config_init(ma_device_type_playback);
     deviceConfig.playback.format = ma_format_f32;
     deviceConfig.playback.channels = 2;
-    deviceConfig.sampleRate = 44100;
+    deviceConfig.sampleRate = audio_rate;
 //    deviceConfig.noFixedSizedCallback = false;
 //    deviceConfig.periodSizeInFrames = 64;
     deviceConfig.dataCallback = audio_callback;
@@ -168,6 +452,15 @@ int main(int argc, const char* argv[]) {
         return EXIT_FAILURE;
     }
 
+    // start at the target latency with silence, rate control keeps it there
+    AudioRateControl rate;
+    const size_t latency_samples = (size_t)latency_ms * audio_rate / 1000;
+    audio_rate_init(&rate, latency_samples);
+    {
+        const std::vector<float> silence(latency_samples, 0.0f);
+        audio_ring_write(&nes->apu->stream, silence.data(), silence.size());
+    }
+
     if (ma_device_start(&device) != MA_SUCCESS) {
         std::cout << "Failed to start playback device." << std::endl;
         ma_device_uninit(&device);
@@ -189,6 +482,8 @@ int main(int argc, const char* argv[]) {
         dt = static_cast<double>(std::chrono::duration_cast<std::chrono::milliseconds>(time - prev_time).count()) / 1000.0f;
         prev_time = time;
 
+        FRAME_STATS_FRAME_BEGIN(&stats);
+        FRAME_STATS_BEGIN(&stats, STAGE_INPUT);
         uint8_t ret = 0;
         for (int i = 0; i < 256; i++) {
             if ((GetAsyncKeyState(i) & 0x8000) || (GetAsyncKeyState(i) & 0b1)) {
@@ -209,20 +504,33 @@ int main(int argc, const char* argv[]) {
             }
         }
         controller1 = ret;
+        FRAME_STATS_END(&stats, STAGE_INPUT);
 
         // processe input
         nes->controller1->buttons = controller1;
         nes->controller2->buttons = 0;
 
         // step the NES state forward by 'dt' seconds, or more if in fast-forward
+        FRAME_STATS_BEGIN(&stats, STAGE_EMULATE);
         emulate(nes, dt);
+        flushSamples(nes->apu);
+        setSampleRatio(nes->apu, audio_rate_update(&rate, audio_ring_fill(&nes->apu->stream)));
+        FRAME_STATS_END(&stats, STAGE_EMULATE);
 
         unsigned char* image = (unsigned char*)nes->ppu->front;
-        generate_palette(image, nes_width, nes_height, 4);
-        std::string result = encode_sixel(image, nes_width, nes_height, 4);
+        std::string result = frame_output_encode(&frame_output, &stats, image, nes_width, nes_height, 4);
 
+        FRAME_STATS_BEGIN(&stats, STAGE_WRITE);
         SetConsoleCursorPosition(output, bufferInfo.dwCursorPosition);
         printf(result.c_str());
+        sixel_recorder_write(&recorder, result.data(), result.size());
+#if ENABLE_FRAME_STATS
+        if (show_stats) {
+            printf("\n%s", frame_stats_status_line(&stats).c_str());
+        }
+#endif
+        FRAME_STATS_END(&stats, STAGE_WRITE);
+        FRAME_STATS_FRAME_END(&stats, result.size());
 
         using namespace std::chrono_literals;
         double time_to_16ms = (1.0 / 60) - dt;
@@ -244,5 +552,22 @@ int main(int argc, const char* argv[]) {
 
     ma_device_uninit(&device);
 
+    const AudioRing* ring = &nes->apu->stream;
+    const double ms_per_sample = 1000.0 / audio_rate;
+    printf("\naudio: target %d ms, fill avg %.1f ms (min %.1f, max %.1f), rate %+.3f%%\n", latency_ms,
+           rate.updates > 0 ? rate.fill_sum / rate.updates * ms_per_sample : 0.0,
+           rate.updates > 0 ? rate.fill_min * ms_per_sample : 0.0, rate.fill_max * ms_per_sample,
+           (rate.ratio - 1.0) * 100.0);
+    printf("       %llu underruns (%llu samples), %llu samples overrun\n",
+           (unsigned long long)ring->underrun_events.load(), (unsigned long long)ring->underrun.load(),
+           (unsigned long long)ring->overrun.load());
+    print_ppu_lines(nes->ppu);
+
+    write_stats(&stats, stats_json_path);
+    if (!sixel_recorder_close(&recorder)) {
+        std::cout << "WARN: failed to write capture file!" << std::endl;
+    }
+    frame_output_free(&frame_output);
+
     return 0;
 }
@@ -141,18 +141,18 @@ uint8_t readController(Controller* c) {
 	return value;
 }
 
-uint8_t readByte(NES* nes, uint16_t address) {
-	if (address < 0x2000) {
-		return nes->RAM[address & 2047];
-	}
-	else if (address < 0x4000) {
+static uint8_t readIO(NES* nes, uint16_t address) {
+	if (address < 0x4000) {
+		catchUpPPU(nes);
 		return readPPURegister(nes, 0x2000 + (address & 7));
 	}
 	else if (address == 0x4014) {
+		catchUpPPU(nes);
 		return readPPURegister(nes, address);
 	}
 	else if (address == 0x4015) {
 		// apu reg read
+		catchUpAPU(nes);
 		APU* apu = nes->apu;
 		uint8_t read_status = 0;
 		if (apu->pulse1.length_val > 0) {
@@ -181,15 +181,28 @@ uint8_t readByte(NES* nes, uint16_t address) {
 	else if (address < 0x6000) {
 		// I/O registers
 	}
-	else if (address >= 0x6000) {
-		return nes->mapper->read(nes->cartridge, address);
-	}
 	else {
 		std::cerr << "ERROR: CPU encountered unrecognized read (address 0x" << std::hex << address << std::dec << ')' << std::endl;
 	}
 	return 0;
 }
 
+// everything between RAM and the cartridge, see readByte
+uint8_t readRegister(NES* nes, uint16_t address) {
+	CPUTrace* trace = nes->trace;
+	if (trace == nullptr) {
+		return readIO(nes, address);
+	}
+	if (trace->replay) {
+		// past the end the replay has gone off the recorded path, which
+		// shows in the instruction count
+		return trace->next_read < trace->reads.size() ? trace->reads[trace->next_read++] : 0;
+	}
+	const uint8_t value = readIO(nes, address);
+	trace->reads.push_back(value);
+	return value;
+}
+
 void writeController(Controller* c, uint8_t value) {
 	c->strobe = value;
 	if ((c->strobe & 1) == 1) {
@@ -389,6 +402,7 @@ void Mapper1::updateOffsets(Cartridge* cartridge) {
 		chr_offsets[1] = chrBankOffset(cartridge, static_cast<int>(chr_bank1));
 		break;
 	}
+	updatePages(cartridge);
 }
 
 // Control ($8000-$9FFF)
@@ -475,21 +489,23 @@ void Mapper4::updateOffsets(Cartridge* cartridge) {
 		chr_offsets[7] = chrBankOffset(cartridge, static_cast<int>(regs[1] | 0x01));
 		break;
 	}
+	updatePages(cartridge);
 }
 
-NES::NES(const char* path, const char* SRAM_path) : initialized(false) {
-	std::cout << "Initializing cartridge..." << std::endl;
-	cartridge = new Cartridge(path, SRAM_path);
+NES::NES(const char* path, const char* SRAM_path, bool quiet) : initialized(false), cpu(nullptr), apu(nullptr), ppu(nullptr), cartridge(nullptr),
+	controller1(nullptr), controller2(nullptr), mapper(nullptr), RAM(nullptr), trace(nullptr) {
+	if (!quiet) std::cout << "Initializing cartridge..." << std::endl;
+	cartridge = new Cartridge(path, SRAM_path, quiet);
 	if (!cartridge->initialized) return;
 
-	std::cout << "Initializing controllers..." << std::endl;
+	if (!quiet) std::cout << "Initializing controllers..." << std::endl;
 	controller1 = new Controller;
 	controller2 = new Controller;
 
 	RAM = new uint8_t[2048];
 	memset(RAM, 0, 2048);
 
-	std::cout << "Initializing mapper..." << std::endl;
+	if (!quiet) std::cout << "Initializing mapper..." << std::endl;
 	if (cartridge->mapper == 0) {
 		const int prg_banks = cartridge->prg_size >> 14;
 		mapper = new Mapper2(prg_banks, 0, prg_banks - 1);
@@ -524,22 +540,23 @@ NES::NES(const char* path, const char* SRAM_path) : initialized(false) {
 		return;
 	}
 
-	std::cout << "Mapper " << static_cast<int>(cartridge->mapper) << " activated." << std::endl;
+	mapper->updatePages(cartridge);
+	if (!quiet) std::cout << "Mapper " << static_cast<int>(cartridge->mapper) << " activated." << std::endl;
 
-	std::cout << "Initializing NES CPU..." << std::endl;
+	if (!quiet) std::cout << "Initializing NES CPU..." << std::endl;
 	cpu = new CPU();
 
 	cpu->PC = read16(this, 0xFFFC);
 	cpu->SP = 0xFD;
 	cpu->flags = 0x24;
 
-	std::cout << "Initializing NES APU..." << std::endl;
+	if (!quiet) std::cout << "Initializing NES APU..." << std::endl;
 	apu = new APU();
 	apu->noise.shift_reg = 1;
 	apu->pulse1.channel = 1;
 	apu->pulse2.channel = 2;
 
-	std::cout << "Initializing NES PPU..." << std::endl;
+	if (!quiet) std::cout << "Initializing NES PPU..." << std::endl;
 	ppu = new PPU();
 	ppu->front = new uint32_t[256 * 240];
 	ppu->back = new uint32_t[256 * 240];
@@ -553,6 +570,21 @@ NES::NES(const char* path, const char* SRAM_path) : initialized(false) {
 	initialized = true;
 }
 
+NES::~NES() {
+	if (ppu != nullptr) {
+		delete[] ppu->front;
+		delete[] ppu->back;
+	}
+	delete ppu;
+	delete apu;
+	delete cpu;
+	delete mapper;
+	delete[] RAM;
+	delete controller1;
+	delete controller2;
+	delete cartridge;
+}
+
 uint16_t mirrorAddress(uint8_t mode, uint16_t address) {
 	address = (address - 0x2000) & 4095;
 	const uint16_t table = address >> 10;
@@ -563,7 +595,17 @@ uint16_t mirrorAddress(uint8_t mode, uint16_t address) {
 void writePPU(NES* nes, uint16_t address, uint8_t value) {
 	address &= 16383;
 	if (address < 0x2000) {
-		nes->mapper->write(nes->cartridge, address, value);
+		uint8_t* byte = &nes->mapper->chr_pages[address >> 10][address & 1023];
+		*byte = value;
+		// the pattern cache is keyed by PPU address, and the same CHR can be
+		// behind several windows (MMC1 with both 4 KB banks alike, MMC3 banks
+		// wrapping around CHR-RAM), so drop the byte from every one of them
+		for (int i = 0; i < 8; ++i) {
+			const uint8_t* page = nes->mapper->chr_pages[i];
+			if (byte >= page && byte < page + 1024) {
+				invalidatePatterns(nes->ppu, static_cast<uint16_t>((i << 10) + (byte - page)), 1);
+			}
+		}
 	}
 	else if (address < 0x3F00) {
 		const uint8_t mode = nes->cartridge->mirror;
@@ -647,30 +689,62 @@ void writeByte(NES* nes, uint16_t address, uint8_t value) {
 	if (address < 0x2000) {
 		nes->RAM[address & 2047] = value;
 	}
+	else if (nes->trace != nullptr && nes->trace->replay && (address < 0x6000 || address >= 0x8000)) {
+		// a replay has nothing behind the registers, see CPUTrace. bank
+		// switches still matter to the CPU, but there is no PPU to catch up
+		if (address >= 0x8000) {
+			nes->mapper->write(nes->cartridge, address, value);
+		}
+	}
 	else if (address < 0x4000) {
+		catchUpPPU(nes);
 		writeRegisterPPU(nes, 0x2000 + (address & 7), value);
+		schedulePPU(nes->ppu);
 	}
 	else if (address < 0x4014) {
+		catchUpAPU(nes);
 		writeRegisterAPU(nes->apu, address, value);
+		scheduleAPU(nes->apu);
 	}
 	else if (address == 0x4014) {
+		catchUpPPU(nes);
 		writeRegisterPPU(nes, address, value);
+		schedulePPU(nes->ppu);
 	}
 	else if (address == 0x4015) {
+		catchUpAPU(nes);
 		writeRegisterAPU(nes->apu, address, value);
+		scheduleAPU(nes->apu);
 	}
 	else if (address == 0x4016) {
 		writeController(nes->controller1, value);
 		writeController(nes->controller2, value);
 	}
 	else if (address == 0x4017) {
+		catchUpAPU(nes);
 		writeRegisterAPU(nes->apu, address, value);
+		scheduleAPU(nes->apu);
 	}
 	else if (address < 0x6000) {
 		// I/O registers
 	}
-	else if (address >= 0x6000) {
+	else if (address >= 0x8000) {
+		// bank switches, mirroring, scanline counter setup: the PPU has to
+		// have drawn everything up to here with the old ones
+		catchUpPPU(nes);
+		uint8_t* before[8];
+		memcpy(before, nes->mapper->chr_pages, sizeof(before));
 		nes->mapper->write(nes->cartridge, address, value);
+		for (int i = 0; i < 8; ++i) {
+			if (nes->mapper->chr_pages[i] != before[i]) {
+				invalidatePatterns(nes->ppu, static_cast<uint16_t>(i << 10), 1024);
+			}
+		}
+		schedulePPU(nes->ppu);
+	}
+	else if (address >= 0x6000) {
+		// SRAM
+		nes->mapper->prg_pages[address >> 13][address & 8191] = value;
 	}
 	else {
 		std::cerr << "ERROR: CPU encountered unrecognized write (address 0x" << std::hex << address << std::dec << ')' << std::endl;
@@ -680,7 +754,7 @@ void writeByte(NES* nes, uint16_t address, uint8_t value) {
 uint8_t readPPU(NES* nes, uint16_t address) {
 	address &= 16383;
 	if (address < 0x2000) {
-		return nes->mapper->read(nes->cartridge, address);
+		return nes->mapper->chr_pages[address >> 10][address & 1023];
 	}
 	else if (address < 0x3F00) {
 		uint8_t mode = nes->cartridge->mirror;
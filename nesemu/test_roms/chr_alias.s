@@ -0,0 +1,116 @@
+; chr_alias.nes - CHR-RAM seen through two pattern table windows at once
+;
+; MMC1 (mapper 1), 16 KB PRG, 8 KB CHR-RAM. Both 4 KB CHR banks select bank 0,
+; so $0000-$0FFF and $1000-$1FFF are the same memory. The background is drawn
+; from $1000 (every name table entry is tile 0, i.e. $1000-$100F) while the NMI
+; handler rewrites that tile through $0000-$000F every frame. The CPU idles
+; while the PPU draws, so the lines take the batched path and its pattern
+; cache. If a CHR write only drops the tile at the address it was written to,
+; the background keeps an old pattern and
+;   nesemu chr_alias.nes --verify --frames 10
+; reports a difference from the reference.
+;
+; chr_alias.nes is this program assembled at $C000 into a 16 KB PRG bank,
+; behind the iNES header 4E 45 53 1A 01 00 10 00 00 00 00 00 00 00 00 00
+
+frame = $00
+
+.org $C000
+
+reset:
+    sei
+    cld
+    ldx #$FF
+    txs
+    lda #$00
+    sta $2000           ; no NMI
+    sta $2001           ; rendering off
+    bit $2002
+vblank1:
+    bit $2002
+    bpl vblank1
+vblank2:
+    bit $2002
+    bpl vblank2
+
+    ; MMC1 control %11110: two 4 KB CHR banks, fixed last PRG bank, vertical mirroring
+    lda #$80
+    sta $8000
+    lda #$1E
+    sta $8000
+    lsr a
+    sta $8000
+    lsr a
+    sta $8000
+    lsr a
+    sta $8000
+    lsr a
+    sta $8000
+    ; CHR bank 0 and CHR bank 1 both select 4 KB bank 0
+    lda #$00
+    sta $A000
+    sta $A000
+    sta $A000
+    sta $A000
+    sta $A000
+    sta $C000
+    sta $C000
+    sta $C000
+    sta $C000
+    sta $C000
+
+    ; background palette 0: black, white, red, blue
+    lda #$3F
+    sta $2006
+    lda #$00
+    sta $2006
+    lda #$0F
+    sta $2007
+    lda #$30
+    sta $2007
+    lda #$16
+    sta $2007
+    lda #$12
+    sta $2007
+
+    lda #$00
+    sta frame
+    lda #$90
+    sta $2000           ; NMI on, background at $1000
+
+    ; nothing touches the PPU while it draws
+main:
+    jmp main
+
+nmi:
+    ; tile 0 of the $0000 table, which is also tile 0 of the $1000 table
+    lda #$00
+    sta $2006
+    sta $2006
+    ldy #16
+    lda frame
+write_tile:
+    sta $2007
+    clc
+    adc #$1D
+    dey
+    bne write_tile
+
+    ; back to scroll 0,0 with the background at $1000, then show it
+    lda #$00
+    sta $2005
+    sta $2005
+    lda #$90
+    sta $2000
+    lda #$0A
+    sta $2001
+    inc frame
+    rti
+
+irq:
+    rti
+
+.org $FFFA
+    .word nmi
+    .word reset
+    .word irq
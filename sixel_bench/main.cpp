@@ -0,0 +1,443 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <new>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <format>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#define SIXEL_IMPLEMENTATION
+#include "sixel.h"
+
+#define SIXEL_DECODE_IMPLEMENTATION
+#include "sixel_decode.h"
+
+#define QUANTIZE_IMPLEMENTATION
+#include "quantize.h"
+
+// every operator new in the process is counted, so allocations per frame
+// include whatever std::string growth the encoder causes
+static uint64_t alloc_count = 0;
+
+void* operator new(size_t size) {
+    ++alloc_count;
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+typedef struct {
+    std::string name;
+    int width, height, channels;
+    std::vector<unsigned char> pixels;
+} BenchCase;
+
+// 'indices', unless NULL, receives the palette index the output gives every
+// pixel, palette_size or above for the ones it leaves unpainted
+typedef struct {
+    const char* name;
+    std::string (*encode)(const unsigned char* img, int width, int height, int channels, std::vector<uint8_t>* indices);
+} EncoderMode;
+
+std::string encode_baseline(const unsigned char* img, int width, int height, int channels, std::vector<uint8_t>* indices) {
+    reset_palette();
+    generate_palette(img, width, height, channels);
+    std::string out = encode_sixel(img, width, height, channels);
+    if (indices) {
+        indices->resize((size_t)width * height);
+        for (size_t i = 0; i < indices->size(); i++) {
+            const unsigned char* p = img + i * channels;
+            (*indices)[i] = (uint8_t)find_closest_color(p[0], p[1], p[2]);
+        }
+    }
+    return out;
+}
+
+// the transparent modes leave out a checkerboard of 16x16 blocks, standing in
+// for an image with an alpha channel
+static bool hidden_pixel(int x, int y) {
+    return ((x >> 4) ^ (y >> 4)) & 1;
+}
+
+// imageviewer's streaming path from the palette on: a lookup table over the
+// current palette, then one band of indices at a time through the band encoder
+static std::string encode_bands(const unsigned char* img, int width, int height, int channels, bool transparent,
+                                std::vector<uint8_t>* indices) {
+    static ColorLookup lut;
+    color_lookup_build(&lut);
+    if (indices) {
+        indices->resize((size_t)width * height);
+    }
+
+    std::string out = encode_sixel_header(width, height, transparent);
+    std::vector<uint8_t> band((size_t)6 * width);
+    for (int y = 0; y < height; y += 6) {
+        const int rows = std::min(6, height - y);
+        for (int dy = 0; dy < rows; dy++) {
+            const unsigned char* p = img + (size_t)(y + dy) * width * channels;
+            uint8_t* dst = &band[(size_t)dy * width];
+            for (int x = 0; x < width; x++, p += channels) {
+                dst[x] = transparent && hidden_pixel(x, y + dy) ? (uint8_t)palette_size : color_lookup(&lut, p[0], p[1], p[2]);
+            }
+        }
+        if (indices) {
+            memcpy(indices->data() + (size_t)y * width, band.data(), (size_t)rows * width);
+        }
+        encode_sixel_band(&out, band.data(), width, rows);
+    }
+    out += SIXEL_END;
+    return out;
+}
+
+std::string encode_band_uniform(const unsigned char* img, int width, int height, int channels, std::vector<uint8_t>* indices) {
+    quantize_uniform_palette();
+    return encode_bands(img, width, height, channels, false, indices);
+}
+
+std::string encode_band_median(const unsigned char* img, int width, int height, int channels, std::vector<uint8_t>* indices) {
+    static ColorHistogram histogram;
+    color_histogram_clear(&histogram);
+    color_histogram_add(&histogram, img, width * height, channels);
+    quantize_median_cut(&histogram);
+    return encode_bands(img, width, height, channels, false, indices);
+}
+
+// the index after the palette marks transparent pixels, so one register fewer
+std::string encode_band_transparent(const unsigned char* img, int width, int height, int channels, std::vector<uint8_t>* indices) {
+    static ColorHistogram histogram;
+    color_histogram_clear(&histogram);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const unsigned char* p = img + ((size_t)y * width + x) * channels;
+            if (!hidden_pixel(x, y)) histogram.count[quantize_bin(p[0], p[1], p[2])]++;
+        }
+    }
+    const int limit = palette_limit;
+    set_palette_limit(std::min(limit, 255));
+    quantize_median_cut(&histogram);
+    std::string out = encode_bands(img, width, height, channels, true, indices);
+    set_palette_limit(limit);
+    return out;
+}
+
+static const EncoderMode encoder_modes[] = {
+    { "baseline", encode_baseline },
+    { "band", encode_band_uniform },
+    { "band-mc", encode_band_median },
+    { "band-alpha", encode_band_transparent },
+};
+
+static uint32_t xorshift32(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// labels and case names are free text and file paths, so quote them for JSON
+static std::string json_escape(const char* s) {
+    std::string out;
+    for (; *s; s++) {
+        const unsigned char ch = (unsigned char)*s;
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+            out += (char)ch;
+        }
+        else if (ch < 0x20) {
+            out += std::format("\\u{:04x}", ch);
+        }
+        else {
+            out += (char)ch;
+        }
+    }
+    return out;
+}
+
+BenchCase make_case(const char* name, int width, int height) {
+    BenchCase c;
+    c.name = name;
+    c.width = width;
+    c.height = height;
+    c.channels = 3;
+    c.pixels.resize((size_t)width * height * 3);
+    return c;
+}
+
+void add_synthetic_cases(std::vector<BenchCase>& cases, int width, int height) {
+    uint32_t seed = 0x12345678;
+
+    // smooth gradient: more unique colors than registers
+    BenchCase gradient = make_case("synthetic/gradient", width, height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            unsigned char* p = &gradient.pixels[((size_t)y * width + x) * 3];
+            p[0] = (unsigned char)(x * 255 / (width > 1 ? width - 1 : 1));
+            p[1] = (unsigned char)(y * 255 / (height > 1 ? height - 1 : 1));
+            p[2] = 128;
+        }
+    }
+    cases.push_back(std::move(gradient));
+
+    // white noise: worst case for any run-length scheme
+    BenchCase noise = make_case("synthetic/noise", width, height);
+    for (unsigned char& v : noise.pixels) {
+        v = (unsigned char)xorshift32(&seed);
+    }
+    cases.push_back(std::move(noise));
+
+    // single color
+    BenchCase flat = make_case("synthetic/flat", width, height);
+    for (size_t i = 0; i < flat.pixels.size(); i += 3) {
+        flat.pixels[i + 0] = 40;
+        flat.pixels[i + 1] = 80;
+        flat.pixels[i + 2] = 120;
+    }
+    cases.push_back(std::move(flat));
+
+    // 8x8 tiles from a 16 color palette, roughly what the emulators produce
+    BenchCase tiles = make_case("synthetic/tiles16", width, height);
+    unsigned char colors[16][3];
+    for (auto& c : colors) {
+        c[0] = (unsigned char)xorshift32(&seed);
+        c[1] = (unsigned char)xorshift32(&seed);
+        c[2] = (unsigned char)xorshift32(&seed);
+    }
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint32_t tile_seed = (uint32_t)((y / 8) * 1024 + (x / 8)) * 2654435761u + 1;
+            const unsigned char* c = colors[xorshift32(&tile_seed) & 15];
+            memcpy(&tiles.pixels[((size_t)y * width + x) * 3], c, 3);
+        }
+    }
+    cases.push_back(std::move(tiles));
+}
+
+// what a terminal should show for 'indices': every pixel's palette entry
+// pushed through the 0-100 percent scale of the color definitions
+std::vector<uint8_t> expected_rgb(const std::vector<uint8_t>& indices) {
+    std::vector<uint8_t> expected(indices.size() * 3);
+    for (size_t i = 0; i < indices.size(); i++) {
+        if (indices[i] >= palette_size) continue;
+        const ColorPalette& color = palette[indices[i]];
+        const uint8_t rgb[3] = { color.r, color.g, color.b };
+        for (int k = 0; k < 3; k++) {
+            expected[i * 3 + k] = (uint8_t)(((rgb[k] * 100 / 255) * 255 + 50) / 100);
+        }
+    }
+    return expected;
+}
+
+// decode the mode's output and compare it against the quantized input;
+// returns the number of mismatching pixels and the decode time per frame
+size_t verify_mode(const BenchCase& c, const EncoderMode& mode, double min_time, double* decode_seconds) {
+    std::vector<uint8_t> indices;
+    const std::string out = mode.encode(c.pixels.data(), c.width, c.height, c.channels, &indices);
+    const std::vector<uint8_t> expected = expected_rgb(indices);
+
+    SixelDecoder decoder;
+    sixel_decoder_init(&decoder);
+
+    using clock = std::chrono::steady_clock;
+    int iterations = 0;
+    const clock::time_point start = clock::now();
+    double elapsed = 0;
+    do {
+        sixel_decoder_reset(&decoder);
+        sixel_decoder_feed(&decoder, out.data(), out.size());
+        ++iterations;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < min_time);
+    *decode_seconds = elapsed / iterations;
+
+    if (!decoder.done || decoder.error || decoder.width != c.width || decoder.height < c.height) {
+        fprintf(stderr, "%s/%s: decoded %dx%d (done %d, error %d), expected %dx%d\n",
+                c.name.c_str(), mode.name, decoder.width, decoder.height,
+                decoder.done, decoder.error, c.width, c.height);
+        sixel_decoder_free(&decoder);
+        return (size_t)c.width * c.height;
+    }
+
+    // the last band is padded to six rows, anything below the image must stay
+    // unset, and so must the pixels the mode leaves transparent
+    std::vector<uint8_t> decoded((size_t)decoder.width * decoder.height * 3);
+    const uint8_t background[3] = { 0, 0, 0 };
+    sixel_decoder_to_rgb(&decoder, decoded.data(), 3, background);
+
+    size_t mismatches = 0;
+    for (int y = 0; y < decoder.height; y++) {
+        for (int x = 0; x < decoder.width; x++) {
+            const size_t i = (size_t)y * decoder.width + x;
+            const uint16_t reg = decoder.pixels[(size_t)y * decoder.stride + x];
+            const bool ok = y < c.height && indices[i] < palette_size
+                ? reg != SIXEL_DECODE_UNSET && memcmp(&decoded[i * 3], &expected[i * 3], 3) == 0
+                : reg == SIXEL_DECODE_UNSET;
+            if (!ok && mismatches++ == 0) {
+                fprintf(stderr, "%s/%s: first mismatch at %d,%d\n", c.name.c_str(), mode.name, x, y);
+            }
+        }
+    }
+    sixel_decoder_free(&decoder);
+    return mismatches;
+}
+
+bool load_case(std::vector<BenchCase>& cases, const char* path) {
+    BenchCase c;
+    c.name = path;
+    c.channels = 3;
+
+    // raw index dumps from the emulators' --dump option
+    if (unsigned char* img = read_index_dump(path, &c.width, &c.height)) {
+        c.pixels.assign(img, img + (size_t)c.width * c.height * 3);
+        free(img);
+        cases.push_back(std::move(c));
+        return true;
+    }
+
+    int channels;
+    unsigned char* img = stbi_load(path, &c.width, &c.height, &channels, 3);
+    if (img == NULL) {
+        fprintf(stderr, "Error loading %s: %s\n", path, stbi_failure_reason());
+        return false;
+    }
+    c.pixels.assign(img, img + (size_t)c.width * c.height * 3);
+    stbi_image_free(img);
+    cases.push_back(std::move(c));
+    return true;
+}
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "Usage: %s [options] [files...]\n"
+            "  files are raw index dumps (nesemu/gbemu/doom --dump) or images\n"
+            "  --json          print one JSON object per result line\n"
+            "  --label <text>  tag every result, e.g. with a git revision\n"
+            "  --min-time <s>  minimum run time per case and mode (default 0.5)\n"
+            "  --size <WxH>    size of the synthetic frames (default 256x240)\n"
+            "  --no-synthetic  only run the given files\n"
+            "  --verify        decode every mode's output and compare it against the\n"
+            "                  quantized input instead of timing the encoder\n", argv0);
+}
+
+int main(int argc, char* argv[]) {
+    bool json = false;
+    bool synthetic = true;
+    bool verify = false;
+    const char* label = "";
+    double min_time = 0.5;
+    int width = 256, height = 240;
+    std::vector<const char*> files;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        }
+        else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc) {
+            label = argv[++i];
+        }
+        else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            min_time = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--no-synthetic") == 0) {
+            synthetic = false;
+        }
+        else if (strcmp(argv[i], "--verify") == 0) {
+            verify = true;
+        }
+        else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        }
+        else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    std::vector<BenchCase> cases;
+    if (synthetic) {
+        add_synthetic_cases(cases, width, height);
+    }
+    for (const char* path : files) {
+        if (!load_case(cases, path)) return 1;
+    }
+    if (cases.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (verify) {
+        size_t failures = 0;
+        printf("%-28s %-10s %11s %12s %12s\n", "case", "mode", "size", "decode MB/s", "mismatches");
+        for (const BenchCase& c : cases) {
+            for (const EncoderMode& mode : encoder_modes) {
+                double seconds = 0;
+                const size_t mismatches = verify_mode(c, mode, min_time, &seconds);
+                const std::string size = std::format("{:d}x{:d}", c.width, c.height);
+                // throughput in decoded RGB bytes, comparable to the encoder's MB/s
+                printf("%-28s %-10s %11s %12.2f %12zu\n", c.name.c_str(), mode.name, size.c_str(),
+                       (double)c.width * c.height * 3 / seconds / 1e6, mismatches);
+                fflush(stdout);
+                failures += mismatches != 0;
+            }
+        }
+        return failures ? 1 : 0;
+    }
+
+    if (!json) {
+        printf("%-28s %-10s %11s %10s %12s %10s %10s\n",
+               "case", "mode", "size", "MB/s", "bytes out", "ns/pixel", "allocs");
+    }
+
+    using clock = std::chrono::steady_clock;
+    for (const BenchCase& c : cases) {
+        const double pixels = (double)c.width * c.height;
+        const double input_bytes = pixels * c.channels;
+
+        for (const EncoderMode& mode : encoder_modes) {
+            int iterations = 0;
+            size_t bytes_out = 0;
+            const uint64_t allocs_before = alloc_count;
+            const clock::time_point start = clock::now();
+            double elapsed = 0;
+            do {
+                std::string out = mode.encode(c.pixels.data(), c.width, c.height, c.channels, NULL);
+                bytes_out = out.size();
+                ++iterations;
+                elapsed = std::chrono::duration<double>(clock::now() - start).count();
+            } while (elapsed < min_time);
+            const double allocs = (double)(alloc_count - allocs_before) / iterations;
+
+            const double seconds = elapsed / iterations;
+            const double mb_per_s = input_bytes / seconds / 1e6;
+            const double ns_per_pixel = seconds * 1e9 / pixels;
+
+            if (json) {
+                printf("{\"label\": \"%s\", \"case\": \"%s\", \"mode\": \"%s\", \"width\": %d, \"height\": %d, "
+                       "\"iterations\": %d, \"mb_per_s\": %.3f, \"bytes_out\": %zu, \"ns_per_pixel\": %.3f, "
+                       "\"allocs_per_frame\": %.1f}\n",
+                       json_escape(label).c_str(), json_escape(c.name.c_str()).c_str(), mode.name, c.width, c.height,
+                       iterations, mb_per_s, bytes_out, ns_per_pixel, allocs);
+            }
+            else {
+                const std::string size = std::format("{:d}x{:d}", c.width, c.height);
+                printf("%-28s %-10s %11s %10.2f %12zu %10.1f %10.1f\n",
+                       c.name.c_str(), mode.name, size.c_str(), mb_per_s, bytes_out, ns_per_pixel, allocs);
+            }
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#define SIXEL_CAPTURE_IMPLEMENTATION
+#include "sixel_capture.h"
+
+#define SIXEL_DECODE_IMPLEMENTATION
+#include "sixel_decode.h"
+
+// every frame is drawn from the cursor position saved before the first one,
+// like the frontends do with SetConsoleCursorPosition
+#define CURSOR_SAVE    "\x1b" "7"
+#define CURSOR_RESTORE "\x1b" "8"
+
+void usage(const char* argv0) {
+    fprintf(stderr,
+            "Usage: %s [options] capture\n"
+            "  captures are written by nesemu/gbemu/doom --record <file>\n"
+            "  --fast            write frames back to back instead of at recorded pacing\n"
+            "  --start <frame>   first frame to play\n"
+            "  --seek <seconds>  first frame at or after this recording time\n"
+            "  --frames <n>      number of frames to play (default all)\n"
+            "  --loop <n>        play the selected range n times\n"
+            "  --decode          run frames through the sixel decoder instead of writing them\n"
+            "  --info            print the capture's index summary and exit\n", argv0);
+}
+
+int main(int argc, char* argv[]) {
+    bool fast = false;
+    bool decode = false;
+    bool info = false;
+    long long start_frame = -1;
+    double seek_seconds = -1;
+    long long frame_limit = -1;
+    int loops = 1;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--fast") == 0) {
+            fast = true;
+        }
+        else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) {
+            start_frame = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) {
+            seek_seconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frame_limit = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--loop") == 0 && i + 1 < argc) {
+            loops = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--decode") == 0) {
+            decode = true;
+        }
+        else if (strcmp(argv[i], "--info") == 0) {
+            info = true;
+        }
+        else if (argv[i][0] == '-' || path != NULL) {
+            usage(argv[0]);
+            return 1;
+        }
+        else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL || loops <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    static SixelCapture capture;
+    if (!sixel_capture_open(&capture, path)) {
+        fprintf(stderr, "Error loading %s: not a sixel capture\n", path);
+        return 1;
+    }
+    if (!capture.complete) {
+        fprintf(stderr, "%s has no index (recording not closed), recovered %zu frames\n",
+                path, capture.index.size());
+    }
+
+    const size_t count = capture.index.size();
+    if (info) {
+        uint64_t bytes = 0;
+        for (const SixelCaptureEntry& e : capture.index) {
+            bytes += e.size;
+        }
+        const double duration = count ? capture.index[count - 1].time_us / 1e6 : 0.0;
+        printf("%s: %dx%d, %zu frames, %.2f s, %llu bytes (%.1f KB/frame, %.1f fps recorded)\n",
+               path, capture.width, capture.height, count, duration, (unsigned long long)bytes,
+               count ? bytes / 1024.0 / count : 0.0, duration > 0 ? (count - 1) / duration : 0.0);
+        sixel_capture_close(&capture);
+        return 0;
+    }
+
+    size_t first = 0;
+    if (start_frame >= 0) {
+        first = (size_t)start_frame;
+    }
+    else if (seek_seconds >= 0) {
+        first = sixel_capture_find_time(&capture, (uint64_t)(seek_seconds * 1e6));
+    }
+    if (first >= count) {
+        fprintf(stderr, "Nothing to play: %s has %zu frames\n", path, count);
+        sixel_capture_close(&capture);
+        return 1;
+    }
+    size_t last = count;
+    if (frame_limit >= 0 && first + (size_t)frame_limit < last) {
+        last = first + (size_t)frame_limit;
+    }
+
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    SixelDecoder decoder;
+    sixel_decoder_init(&decoder);
+    if (!decode) {
+        fputs(CURSOR_SAVE, stdout);
+    }
+
+    using clock = std::chrono::steady_clock;
+    std::string frame;
+    uint64_t bytes = 0;
+    size_t frames = 0;
+    size_t late = 0;
+    const clock::time_point start = clock::now();
+    clock::time_point loop_start = start;
+
+    for (int loop = 0; loop < loops; loop++) {
+        const uint64_t base_us = capture.index[first].time_us;
+        for (size_t f = first; f < last; f++) {
+            if (!sixel_capture_read_frame(&capture, f, &frame)) {
+                fprintf(stderr, "Error reading frame %zu\n", f);
+                sixel_capture_close(&capture);
+                return 1;
+            }
+
+            if (!fast) {
+                const clock::time_point due = loop_start + std::chrono::microseconds(capture.index[f].time_us - base_us);
+                // more than a frame behind counts as late
+                if (clock::now() > due + std::chrono::milliseconds(17)) {
+                    ++late;
+                }
+                std::this_thread::sleep_until(due);
+            }
+
+            if (decode) {
+                sixel_decoder_reset(&decoder);
+                sixel_decoder_feed(&decoder, frame.data(), frame.size());
+            }
+            else {
+                fputs(CURSOR_RESTORE, stdout);
+                fwrite(frame.data(), 1, frame.size(), stdout);
+                fflush(stdout);
+            }
+            bytes += frame.size();
+            ++frames;
+        }
+        loop_start = clock::now();
+    }
+
+    const double seconds = std::chrono::duration<double>(clock::now() - start).count();
+    sixel_decoder_free(&decoder);
+    sixel_capture_close(&capture);
+
+    // stdout carries the frames, so the report goes to stderr
+    fprintf(stderr, "\n%zu frames in %.3f s: %.1f fps, %.2f MB/s", frames, seconds,
+            frames / seconds, bytes / seconds / 1e6);
+    if (!fast) {
+        fprintf(stderr, ", %zu late", late);
+    }
+    fprintf(stderr, "\n");
+    return 0;
+}